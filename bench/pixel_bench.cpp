@@ -0,0 +1,61 @@
+// compares the scalar, SSE2 and AVX2 flush_bitmap_ex() converters
+// build with -DWINDUINO_BUILD_BENCHMARKS=ON
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include "winduino_pixels.h"
+
+#define BENCH_WIDTH 320
+#define BENCH_HEIGHT 240
+#define BENCH_FRAMES 2000
+
+static const char* format_names[] = {"native", "rgb565", "rgb565be", "rgb888", "indexed8"};
+static const char* isa_names[] = {"scalar", "sse2", "avx2"};
+
+int main() {
+    const size_t pixels = BENCH_WIDTH * BENCH_HEIGHT;
+    uint8_t* src = (uint8_t*)malloc(pixels * 4);
+    uint32_t* dst = (uint32_t*)malloc(pixels * 4);
+    uint32_t* expected = (uint32_t*)malloc(pixels * 4);
+    uint32_t palette[256];
+    if (src == nullptr || dst == nullptr || expected == nullptr) {
+        return 1;
+    }
+    srand(42);
+    for (size_t i = 0; i < pixels * 4; ++i) {
+        src[i] = (uint8_t)rand();
+    }
+    for (int i = 0; i < 256; ++i) {
+        palette[i] = 0xFF000000 | (uint32_t)rand();
+    }
+    printf("%-10s %-8s %10s %s\n", "format", "isa", "Mpx/s", "");
+    for (int f = FLUSH_FORMAT_NATIVE; f <= FLUSH_FORMAT_INDEXED8; ++f) {
+        pixel_converter((flush_format_t)f, PIXEL_ISA_SCALAR)(expected, src, pixels, palette);
+        for (int isa = PIXEL_ISA_SCALAR; isa <= PIXEL_ISA_AVX2; ++isa) {
+            pixel_convert_fn convert = pixel_converter((flush_format_t)f, (pixel_isa_t)isa);
+            if (convert == nullptr) {
+                printf("%-10s %-8s %10s\n", format_names[f], isa_names[isa], "n/a");
+                continue;
+            }
+            memset(dst, 0, pixels * 4);
+            auto start = std::chrono::steady_clock::now();
+            for (int i = 0; i < BENCH_FRAMES; ++i) {
+                // row by row, like flush_bitmap_ex() does
+                for (int y = 0; y < BENCH_HEIGHT; ++y) {
+                    convert(dst + y * BENCH_WIDTH,
+                            src + y * BENCH_WIDTH * pixel_format_size((flush_format_t)f),
+                            BENCH_WIDTH, palette);
+                }
+            }
+            double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            bool ok = 0 == memcmp(dst, expected, pixels * 4);
+            printf("%-10s %-8s %10.1f %s\n", format_names[f], isa_names[isa],
+                   (double)pixels * BENCH_FRAMES / secs / 1e6, ok ? "" : "MISMATCH");
+        }
+    }
+    free(src);
+    free(dst);
+    free(expected);
+    return 0;
+}
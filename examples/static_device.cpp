@@ -0,0 +1,48 @@
+// a device compiled into the app with WINDUINO_HARDWARE. It only has
+// Update(), so it relies on hardware_device_base for everything else.
+// Exits with 1 if the runtime doesn't update it before every loop()
+// build with -DWINDUINO_BUILD_EXAMPLES=ON
+#include <Arduino.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "winduino_hardware.h"
+
+#define EXAMPLE_ITERATIONS 10
+
+static int update_count = 0;
+
+class counter_device : public hardware_device_base {
+   public:
+    int CanUpdate() { return 1; }
+    int Update() {
+        ++update_count;
+        return 0;
+    }
+};
+WINDUINO_HARDWARE("counter", counter_device);
+
+void winduino() {
+    // so the run takes no time
+    hardware_set_virtual_clock(true);
+    if (hardware_load("counter") == nullptr) {
+        printf("couldn't load the counter device\n");
+        exit(1);
+    }
+}
+void setup() {
+}
+static int iterations = 0;
+void loop() {
+    if (++iterations < EXAMPLE_ITERATIONS) {
+        return;
+    }
+    // every iteration is preceded by an update
+    if (update_count != EXAMPLE_ITERATIONS) {
+        printf("Update() ran %d times in %d iterations\n", update_count, iterations);
+        exit(1);
+    }
+    printf("Update() ran before each of %d iterations\n", iterations);
+    raise(SIGINT);
+    delay(10);
+}
@@ -1,3 +1,4 @@
+#ifdef _WIN32
 #define UNICODE
 #if defined(UNICODE) && !defined(_UNICODE)
 #define _UNICODE
@@ -16,111 +17,220 @@
 /////////////////////////////////////////////////////
 #pragma comment(lib, "d2d1.lib")
 /////////////////////////////////////////////////////
+#else
+// headless POSIX backend: no window, the display
+// is an in-memory BGRA framebuffer
+#include <dlfcn.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#endif
+#include <atomic>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
 
 #include "Arduino.h"
-typedef __cdecl void (*gpio_set_callback)(uint32_t value, void* state);
-typedef __cdecl uint8_t (*gpio_get_callback)(void* state);
-class hardware_interface {
-public:
-    virtual int __cdecl CanConfigure() =0;
-    virtual int __cdecl Configure(int prop, 
-                            void* data, 
-                            size_t size) =0;
-    virtual int __cdecl CanConnect() =0;
-    virtual int __cdecl Connect(uint8_t pin, 
-                            gpio_get_callback getter, 
-                            gpio_set_callback setter, 
-                            void* state) =0;
-    virtual int __cdecl CanUpdate() =0;
-    virtual int __cdecl Update() =0;
-    virtual int __cdecl CanPinChange() =0;
-    virtual int __cdecl PinChange(uint8_t pin, 
-                            uint32_t value) =0;
-    virtual int __cdecl CanTransferBitsSPI() =0;
-    virtual int __cdecl TransferBitsSPI(uint8_t* data, 
-                                    size_t size_bits) =0;
-    virtual int __cdecl CanTransferBytesI2C() =0;
-    virtual int __cdecl TransferBytesI2C(const uint8_t* in, 
-                                    size_t in_size, 
-                                    uint8_t* out, 
-                                    size_t* in_out_out_size) =0;
-    virtual int __cdecl CanAttachLog() =0;
-    virtual int __cdecl AttachLog(hardware_log_callback logger, 
-                            const char* prefix, 
-                            uint8_t level) =0;
-    virtual int __cdecl Destroy() = 0;
-};
-typedef __cdecl int (*hardware_create_fn)(hardware_interface** out_hw);
+#include "esp_timer.h"
+#include "winduino_damage.h"
+#include "winduino_present.h"
+#include "winduino_pixels.h"
+#include "winduino_hash.h"
+#include "winduino_capture.h"
+#include "winduino_irq.h"
+#include "winduino_wheel.h"
+#include "winduino_pool.h"
+#include "winduino_hardware.h"
+#include "winduino_input.h"
+#include "winduino_journal.h"
+#include "winduino_log.h"
+#include "winduino_metrics.h"
+#include "winduino_trace.h"
+// what a device can do. Asked once when it's loaded rather than
+// before every call
+#define HARDWARE_CAP_CONFIGURE (1 << 0)
+#define HARDWARE_CAP_CONNECT (1 << 1)
+#define HARDWARE_CAP_UPDATE (1 << 2)
+#define HARDWARE_CAP_PIN_CHANGE (1 << 3)
+#define HARDWARE_CAP_SPI (1 << 4)
+#define HARDWARE_CAP_I2C (1 << 5)
+#define HARDWARE_CAP_LOG (1 << 6)
+#define HARDWARE_CAP_PINS_CHANGED (1 << 7)
+#define HARDWARE_CAP_UPDATE_SCHEDULED (1 << 8)
+#define HARDWARE_CAP_SPI_SEGMENTS (1 << 9)
+#define HARDWARE_CAP_I2C_SEGMENTS (1 << 10)
+// the interface is laid out like COM: a pointer to a table of __cdecl
+// functions in declaration order, each taking the object first. That
+// is what lets plugins built with another compiler work at all, and it
+// means a method can be looked up once and called without the vtable
+#define HARDWARE_SLOT_PIN_CHANGE 7
+#define HARDWARE_SLOT_TRANSFER_BITS_SPI 9
+#define HARDWARE_SLOT_TRANSFER_BYTES_I2C 11
+#define HARDWARE_SLOT_PINS_CHANGED 16
+#define HARDWARE_SLOT_TRANSFER_SEGMENTS_SPI 20
+#define HARDWARE_SLOT_TRANSFER_SEGMENTS_I2C 22
+static void* hardware_method(hardware_interface* hw, size_t slot) {
+    return (*(void***)hw)[slot];
+}
 typedef struct hardware_dev {
+#ifdef _WIN32
     HMODULE hmodule;
+#else
+    void* hmodule;
+#endif
     hardware_interface* hardware;
+    // the interface version the plugin implements
+    int version;
+    // HARDWARE_CAP_XXXX flags
+    uint32_t caps;
+    // only has entries for the capabilities it reports
+    hardware_dispatch_t dispatch;
+    // set by hardware_set_update_period() for devices that
+    // can't schedule themselves. 0 updates every iteration
+    uint32_t update_period_us;
+    // set by hardware_set_parallel_update() for devices whose
+    // Update() can run alongside the others
+    bool parallel;
+    // for the update scheduler
+    hardware_dev* wheel_next;
+    uint64_t wheel_deadline;
+    // when it's due again after the current update. 0 for every iteration
+    uint64_t update_next;
+    // the time spent in Update(), in nanoseconds
+    uint32_t update_count;
+    uint32_t update_last_ns;
+    uint32_t update_max_ns;
+    uint64_t update_total_ns;
     hardware_dev* next;
 } hardware_dev_t;
-typedef struct hardware_connection {
-    hardware_dev_t* handle;
+// a device that wants to hear about changes to a pin
+typedef struct hardware_subscriber {
+    hardware_interface* hardware;
+    hardware_pin_change_fn pin_change;
+    // set if the device takes PinsChanged() for this pin
+    hardware_pins_changed_fn pins_changed;
+    // the device's pin
     uint8_t pin;
-    hardware_connection* next;
-} hardware_connection_t;
-typedef struct hardware_spi_list {
-    hardware_dev_t* handle;
-    hardware_spi_list* next;
-} hardware_spi_list_t;
-typedef struct hardware_i2c_list {
-    hardware_dev_t* handle;
-    hardware_i2c_list* next;
-} hardware_i2c_list_t;
+} hardware_subscriber_t;
+// the devices on a bus, kept contiguous with their transfer
+// functions resolved so a transfer is a straight walk
+typedef struct hardware_spi_target {
+    hardware_interface* hardware;
+    hardware_spi_transfer_fn transfer;
+    // null if the device doesn't take segments
+    hardware_segments_fn transfer_segments;
+} hardware_spi_target_t;
+typedef struct hardware_spi_port {
+    hardware_spi_target_t* targets;
+    size_t count;
+    metric_counter* bits;
+} hardware_spi_port_t;
+typedef struct hardware_i2c_target {
+    hardware_interface* hardware;
+    hardware_i2c_transfer_fn transfer;
+    // null if the device doesn't take segments
+    hardware_segments_fn transfer_segments;
+} hardware_i2c_target_t;
+typedef struct hardware_i2c_port {
+    hardware_i2c_target_t* targets;
+    size_t count;
+    metric_counter* transactions;
+} hardware_i2c_port_t;
 void __attribute__((weak)) winduino() {
 
 }
-static bool is_isr = false;
+// the hot half of the pin table. One bit per pin, 32 pins (a port)
+// per word, so reads are lock free from any thread and the GPIO
+// registers can change a whole port at once. gpios[] holds the rest
+// a level bit is set when the pin's value is non-zero
+static std::atomic<uint32_t> gpio_level[8];
+static std::atomic<uint32_t> gpio_output[8];
+static std::atomic<uint32_t> gpio_input[8];
+// pins whose mode or value changed since the UI last looked, one bit
+// per pin. Setting a bit is all a pin write costs. The UI picks them
+// up on its own schedule
+static std::atomic<uint32_t> gpio_dirty[8];
+static inline void gpio_mark_dirty(uint8_t pin) {
+    gpio_dirty[pin >> 5].fetch_or(1u << (pin & 31), std::memory_order_release);
+}
+// set on the threads that run the sketch and the device updates, so
+// pin changes made anywhere else are known to come from outside
+static thread_local bool app_context = false;
+static bool pin_input(uint8_t pin, uint32_t value);
 typedef struct gpio {
     uint8_t id;
+#ifdef _WIN32
     HWND hwnd_text;
+#endif
     int interrupt_mode;
     void (*interrupt_cb)(void);
     uint8_t mode;
     uint32_t value() const {
-        return m_value;
-    }
-    void value(uint32_t value) {
+        return m_value.load(std::memory_order_acquire);
+    }
+    // from_port is true when a port write is setting several pins. The
+    // caller has already updated gpio_level and notifies the devices.
+    // ISRs run on their own thread alongside loop(), so a pin can be
+    // driven from two threads at once. The exchange makes sure each
+    // transition is seen, and reported, by exactly one of them
+    void value(uint32_t value, bool from_port = false) {
+        const uint32_t old = m_value.exchange(value, std::memory_order_acq_rel);
+        if (!from_port && (value != 0) != (old != 0)) {
+            uint32_t bit = 1u << (id & 31);
+            if (value) {
+                gpio_level[id >> 5].fetch_or(bit, std::memory_order_release);
+            } else {
+                gpio_level[id >> 5].fetch_and(~bit, std::memory_order_release);
+            }
+        }
         if (interrupt_mode == LOW) {
-            if (m_value != value) {
-                m_value = value;
-                notify_changed();
+            if (old != value) {
+                notify_changed(from_port, value);
             }
             if (!value && interrupt_cb != nullptr) {
-                is_isr = true;
-                interrupt_cb();
-                is_isr = false;
+                fire_interrupt();
             }
-        } else if (value != m_value) {
+        } else if (value != old) {
             switch (interrupt_mode) {
                 case FALLING:
                     if (!value && interrupt_cb != nullptr) {
-                        is_isr = true;
-                        interrupt_cb();
-                        is_isr = false;
+                        fire_interrupt();
                     }
                     break;
                 case RISING:
                     if (value && interrupt_cb != nullptr) {
-                        is_isr = true;
-                        interrupt_cb();
-                        is_isr = false;
+                        fire_interrupt();
                     }
                     break;
                 case CHANGE:
                     if (interrupt_cb != nullptr) {
-                        is_isr = true;
-                        interrupt_cb();
-                        is_isr = false;
+                        fire_interrupt();
                     }
                     break;
             }
-            m_value = value;
-            notify_changed();
+            notify_changed(from_port, value);
         }
     }
+    void set_mode(uint8_t value) {
+        uint32_t bit = 1u << (id & 31);
+        mode = value;
+        if (is_output()) {
+            gpio_output[id >> 5].fetch_or(bit, std::memory_order_release);
+        } else {
+            gpio_output[id >> 5].fetch_and(~bit, std::memory_order_release);
+        }
+        if (is_input()) {
+            gpio_input[id >> 5].fetch_or(bit, std::memory_order_release);
+        } else {
+            gpio_input[id >> 5].fetch_and(~bit, std::memory_order_release);
+        }
+        gpio_mark_dirty(id);
+    }
     bool is_input() const {
         switch (mode) {
             case INPUT:
@@ -141,39 +251,52 @@ typedef struct gpio {
         }
     }
     bool connect(hardware_dev_t* hw, uint8_t pin) {
-        if (hw == nullptr || !hw->hardware->CanConnect()) {
+        if (hw == nullptr || !(hw->caps & HARDWARE_CAP_CONNECT)) {
             return false;
         }
-        hardware_connection_t* con = new hardware_connection_t();
-        if (con == nullptr) {
+        if (0 != hw->hardware->Connect(pin, get_pin, set_pin, this)) {
             return false;
         }
-        if (0 != hw->hardware->Connect(pin, get_pin, set_pin, this)) {
-            delete con;
+        if (!(hw->caps & HARDWARE_CAP_PIN_CHANGE)) {
+            return true;
+        }
+        hardware_subscriber_t* subs = (hardware_subscriber_t*)realloc(
+            m_subscribers, (m_subscriber_count + 1) * sizeof(hardware_subscriber_t));
+        if (subs == nullptr) {
             return false;
         }
-
-        con->next = nullptr;
-        con->handle = hw;
-        con->pin = pin;
-        if (m_connect_list == nullptr) {
-            m_connect_list = con;
-        } else {
-            hardware_connection_t* p = m_connect_list;
-            while (p != nullptr) {
-                if (p->next == nullptr) {
-                    p->next = con;
-                    break;
-                }
-                p = p->next;
+        hardware_subscriber_t& sub = subs[m_subscriber_count++];
+        sub.hardware = hw->hardware;
+        sub.pin_change = hw->dispatch.pin_change;
+        sub.pins_changed = pin < 64 ? hw->dispatch.pins_changed : nullptr;
+        sub.pin = pin;
+        m_subscribers = subs;
+        return true;
+    }
+    // stops telling a device about changes to this pin
+    void disconnect(const hardware_dev_t* hw) {
+        size_t count = 0;
+        for (size_t i = 0; i < m_subscriber_count; ++i) {
+            if (m_subscribers[i].hardware != hw->hardware) {
+                m_subscribers[count++] = m_subscribers[i];
             }
         }
-        return true;
+        m_subscriber_count = count;
+    }
+    size_t subscriber_count() const {
+        return m_subscriber_count;
+    }
+    const hardware_subscriber_t& subscriber(size_t index) const {
+        return m_subscribers[index];
     }
 
    private:
-    uint32_t m_value;
-    hardware_connection_t* m_connect_list;
+    std::atomic<uint32_t> m_value;
+    // contiguous so fanning out a change is a straight walk
+    hardware_subscriber_t* m_subscribers;
+    size_t m_subscriber_count;
+
+    void fire_interrupt();
 
     static uint8_t get_pin(void* state) {
         gpio* st = (gpio*)state;
@@ -181,15 +304,19 @@ typedef struct gpio {
     }
     static void set_pin(uint32_t value, void* state) {
         gpio* st = (gpio*)state;
+        if (!app_context && pin_input(st->id, value)) {
+            // a plugin's own thread drove it, so it goes through the journal
+            return;
+        }
         st->value(value);
     }
-    void notify_changed() {
-        hardware_connection_t* p = m_connect_list;
-        while (p != nullptr) {
-            if (p->handle->hardware->CanPinChange()) {
-                p->handle->hardware->PinChange(p->pin, m_value);
-            }
-            p = p->next;
+    void notify_changed(bool from_port, uint32_t value) {
+        gpio_mark_dirty(id);
+        if (from_port) {
+            return;
+        }
+        for (size_t i = 0; i < m_subscriber_count; ++i) {
+            m_subscribers[i].pin_change(m_subscribers[i].hardware, m_subscribers[i].pin, value);
         }
     }
 } gpio_t;
@@ -205,24 +332,111 @@ static struct {
 } winduino_screen_size = {320,240};
 
 static hardware_dev_t* hardware_head;
-static hardware_spi_list_t* spi_devices[SPI_PORT_MAX] = {nullptr};
-static hardware_i2c_list_t* i2c_devices[I2C_PORT_MAX] = {nullptr};
+static hardware_dev_t* hardware_tail;
+static hardware_spi_port_t spi_ports[SPI_PORT_MAX];
+static hardware_i2c_port_t i2c_ports[I2C_PORT_MAX];
 static gpio_t gpios[256];
+int hardware_log_uart = 0;
+static uint16_t uart_com_ports[SOC_UART_NUM] = {0};
+static uart_state_t uart_states[SOC_UART_NUM] = {UART_STATE_UNATTACHED};
+// the number of touch points tracked, including the mouse
+#ifndef WINDUINO_TOUCH_POINTS
+#define WINDUINO_TOUCH_POINTS 10
+#endif
+// how many pointer events can wait for read_touch_events()
+#ifndef WINDUINO_TOUCH_QUEUE
+#define WINDUINO_TOUCH_QUEUE 1024
+#endif
+typedef struct touch_state {
+    // bit n is set while point n is pressed
+    uint32_t pressed;
+    int16_t x[WINDUINO_TOUCH_POINTS];
+    int16_t y[WINDUINO_TOUCH_POINTS];
+} touch_state_t;
+// pointer input goes from the message pump to the app thread without
+// locking. Every event is queued, and the latest state is published
+// separately for read_mouse()
+static spsc_ring<touch_event_t, WINDUINO_TOUCH_QUEUE> touch_events;
+static seqlock<touch_state_t> touch_latest;
+// the state the sketch sees. Whoever applies the events owns it
+static touch_state_t touch_applied;
+#ifdef _WIN32
+// the input thread's own copy of the state
+static touch_state_t touch_current;
+static void touch_post(uint8_t id, uint8_t type, int x, int y);
+#endif
+// log output goes through here, so writing it never waits on a sink
+log_ring log_output;
+static log_file log_file_output;
+static bool log_to_stdout = false;
+// runtime levels for log_x() and ESP_LOGx(). Everything compiled in logs until told otherwise
+std::atomic<uint32_t> log_filter_generation(1);
+static log_filter log_filters(ARDUHAL_LOG_LEVEL_VERBOSE);
+// when set, log_x() output goes here unformatted
+static std::atomic<bool> log_binary(false);
+static log_ring log_binary_output;
+static log_file log_binary_file;
+static std::mutex log_site_mutex;
+static uint32_t log_site_count = 0;
+// the runtime's own metrics. The bus and serial ones live with their ports
+metrics_registry metrics;
+static metric_histogram* loop_metric;
+static metric_histogram* update_metric;
+static metric_counter* flush_calls_metric;
+static metric_counter* flush_pixels_metric;
+static metric_histogram* flush_frame_metric;
+static metric_counter* irq_metric;
+// flush_bitmap() calls in the current iteration
+static uint32_t flush_frame_calls = 0;
+// when the rates were last reset, on the wall_ns() clock
+static uint64_t metrics_start_us = 0;
+// where to write the metrics on exit. Empty for the log
+static bool metrics_on_exit = false;
+static std::vector<char> metrics_exit_path;
+// a timeline of the runtime's threads
+trace_recorder traces;
+// everything from outside the sketch, for recording and replaying runs
+input_journal inputs;
+static uint64_t app_iterations = 0;
+static void apply_input(const input_event_t& in, const uint8_t* data);
+// the contents of the display, in the native pixel format.
+// flush_bitmap() writes here, and presenting uploads the damage
+static uint32_t* framebuffer = nullptr;
+static damage_region damage;
+// per tile hashes of the framebuffer, for checking the display against known good output
+static tile_hasher frame_hashes;
+static hash_manifest frame_manifest;
+// records the display to a file when started
+static frame_recorder frame_capture;
+// for FLUSH_FORMAT_INDEXED8
+static uint32_t palette[256] = {0};
 
+#ifdef _WIN32
 // so we can implement millis(), delay()
 static LARGE_INTEGER start_time;
+// queried once, since it can't change while the system is running
+static LARGE_INTEGER counter_freq;
 // frame counter
 static volatile DWORD frames = 0;
+// loop() iteration counter
+static volatile DWORD loops = 0;
+// set when the window needs to be redrawn even though nothing was flushed
+static std::atomic<bool> repaint(true);
 // handles for windows
 static HANDLE quit_event = NULL;
 static HANDLE app_thread = NULL;
+static HANDLE present_thread = NULL;
+// signalled when there's something new to present
+static HANDLE present_event = NULL;
+// hands frames from the app thread to the presenter
+static present_chain present_frames;
 static HANDLE app_mutex = NULL;
 static HWND hwnd_log=NULL;
 static HWND hwnd_main=NULL;
 static bool updating_gpios = false;
-int hardware_log_uart = 0;
-static uint16_t uart_com_ports[SOC_UART_NUM] = {0};
-static uart_state_t uart_states[SOC_UART_NUM] = {UART_STATE_UNATTACHED};
+// how often pin changes are reflected in the GPIO menu and windows
+#define GPIO_REFRESH_HZ 30
+#define GPIO_REFRESH_TIMER 1
 HMENU menu;
 HMENU gpio_menu;
 // flag to indicate quitting
@@ -231,36 +445,96 @@ static bool should_quit = false;
 static ID2D1HwndRenderTarget* render_target = nullptr;
 static ID2D1Factory* d2d_factory = nullptr;
 static ID2D1Bitmap* render_bitmap = nullptr;
-// mouse mess
-static struct {
-    int x;
-    int y;
-} mouse_loc;
-static int mouse_state = 0;  // 0 = released, 1 = pressed
-static int old_mouse_state = 0;
-static int mouse_req = 0;
-static char* pre_log = nullptr;
+// the Windows pointer ids of the touch points. 0 is the mouse
+static uint32_t touch_pointer_ids[WINDUINO_TOUCH_POINTS];
+// log text waiting for the message pump to put it in the log window.
+// It keeps the newest text when it gets too big, since the window
+// would only throw the oldest away anyway
+#define LOG_WINDOW_PENDING_MAX 32768
+#define WM_LOG (WM_APP + 1)
+static std::mutex log_window_mutex;
+static std::vector<char> log_window_pending;
+static std::atomic<bool> log_window_posted(false);
+#else
+// so we can implement millis(), delay()
+static uint64_t start_time;
+// flag to indicate quitting
+static std::atomic<bool> should_quit(false);
+#endif
+#ifdef _WIN32
 // updates the window title with the FPS and any mouse info
 static void update_title(HWND hwnd) {
     wchar_t wsztitle[64];
     wcscpy(wsztitle, L"Winduino - ");
     DWORD f = frames;
     _itow((int)f, wsztitle + wcslen(wsztitle), 10);
-    wcscat(wsztitle, L" FPS");
-    if (WAIT_OBJECT_0 == WaitForSingleObject(app_mutex, INFINITE)) {
-        if (mouse_state) {
-            wcscat(wsztitle, L" (");
-            f = mouse_loc.x;
-            _itow((int)f, wsztitle + wcslen(wsztitle), 10);
-            wcscat(wsztitle, L", ");
-            f = mouse_loc.y;
-            _itow((int)f, wsztitle + wcslen(wsztitle), 10);
-            wcscat(wsztitle, L")");
+    wcscat(wsztitle, L" FPS, ");
+    f = loops;
+    _itow((int)f, wsztitle + wcslen(wsztitle), 10);
+    wcscat(wsztitle, L" LPS");
+    // this is the input thread, so the state is ours to read
+    if (touch_current.pressed & 1) {
+        wcscat(wsztitle, L" (");
+        _itow(touch_current.x[0], wsztitle + wcslen(wsztitle), 10);
+        wcscat(wsztitle, L", ");
+        _itow(touch_current.y[0], wsztitle + wcslen(wsztitle), 10);
+        wcscat(wsztitle, L")");
+    }
+    SetWindowTextW(hwnd, wsztitle);
+}
+#ifndef WM_POINTERDOWN
+#define WM_POINTERUPDATE 0x0245
+#define WM_POINTERDOWN 0x0246
+#define WM_POINTERUP 0x0247
+#endif
+#ifndef GET_POINTERID_WPARAM
+#define GET_POINTERID_WPARAM(wParam) (LOWORD(wParam))
+#endif
+#define TOUCH_POINTER_TYPE 2
+typedef BOOL(WINAPI* get_pointer_type_fn)(UINT32 id, DWORD* out_type);
+// turns touchscreen pointer messages into touch points 1 and up.
+// Returns false for anything that isn't a touch, like a pen, so it
+// goes on to become mouse messages as usual
+static bool handle_touch(const MSG& msg) {
+    // not there before Windows 8
+    static get_pointer_type_fn get_pointer_type =
+        (get_pointer_type_fn)GetProcAddress(GetModuleHandleW(L"user32.dll"), "GetPointerType");
+    const UINT32 pointer_id = GET_POINTERID_WPARAM(msg.wParam);
+    DWORD type;
+    if (get_pointer_type == nullptr || !get_pointer_type(pointer_id, &type) || type != TOUCH_POINTER_TYPE) {
+        return false;
+    }
+    POINT pt = {(int16_t)LOWORD(msg.lParam), (int16_t)HIWORD(msg.lParam)};
+    ScreenToClient(msg.hwnd, &pt);
+    int id = 0;
+    for (int i = 1; i < WINDUINO_TOUCH_POINTS; ++i) {
+        if ((touch_current.pressed & (1u << i)) && touch_pointer_ids[i] == pointer_id) {
+            id = i;
+            break;
+        }
+    }
+    if (msg.message == WM_POINTERDOWN) {
+        if (id != 0 || pt.x < 0 || pt.y < 0 || pt.x >= winduino_screen_size.width || pt.y >= winduino_screen_size.height) {
+            return true;
+        }
+        for (int i = 1; i < WINDUINO_TOUCH_POINTS; ++i) {
+            if (!(touch_current.pressed & (1u << i))) {
+                id = i;
+                break;
+            }
+        }
+        if (id == 0) {
+            // more fingers than we track
+            return true;
         }
-        ReleaseMutex(app_mutex);
-        SetWindowTextW(hwnd, wsztitle);
+        touch_pointer_ids[id] = pointer_id;
+        touch_post((uint8_t)id, TOUCH_EVENT_PRESS, pt.x, pt.y);
+    } else if (id != 0) {
+        touch_post((uint8_t)id, msg.message == WM_POINTERUP ? TOUCH_EVENT_RELEASE : TOUCH_EVENT_MOVE, pt.x, pt.y);
     }
+    return true;
 }
+#endif
 const char* pathToFileName(const char* path) {
     size_t i = 0;
     size_t pos = 0;
@@ -274,27 +548,388 @@ const char* pathToFileName(const char* path) {
     }
     return path + pos;
 }
-// this handles our main application loop
-// plus rendering
+// the virtual clock. When enabled, time only moves when the
+// app delays (or finishes a loop() iteration without delaying)
+// so sleeping sketches run as fast as the host allows
+typedef struct timer_event {
+    uint64_t when;
+    uint64_t seq;
+    void (*callback)(void* state);
+    void* state;
+    bool operator>(const timer_event& rhs) const {
+        return when > rhs.when || (when == rhs.when && seq > rhs.seq);
+    }
+} timer_event_t;
+static bool virtual_clock = false;
+static uint32_t virtual_idle_step_us = 1000;
+static std::atomic<uint64_t> virtual_time_us(0);
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "the tick source must be lock free");
+// added to what the app sees, so the 32-bit counters
+// can be made to wrap shortly after startup
+static uint64_t clock_offset_us = 0;
+static uint64_t timer_seq = 0;
+static std::mutex timer_mutex;
+static std::priority_queue<timer_event_t, std::vector<timer_event_t>, std::greater<timer_event_t>> timer_queue;
+static std::thread::id app_thread_id;
+static bool configuring = false;
+// queues edges from any thread and runs the ISRs in their own
+// context: a dedicated thread on the wall clock, or the app
+// thread between steps of the virtual clock, for determinism
+static interrupt_controller irq;
+static uint64_t wall_ns();
+static void hardware_unload_all();
+static void os_sleep_ns(uint64_t ns);
+// the microseconds since startup on whichever clock is in use.
+// this is the tick source all of the time functions derive from
+static uint64_t clock_us() {
+    if (virtual_clock) {
+        return virtual_time_us;
+    }
+    return wall_ns() / 1000;
+}
+// devices that update on a schedule wait in the wheel. The rest are
+// updated before every loop() iteration
+static timer_wheel<hardware_dev_t> update_wheel;
+static std::vector<hardware_dev_t*> update_every;
+// the devices being updated this iteration, and the ones among them
+// that run on the pool
+static std::vector<hardware_dev_t*> update_due;
+static std::vector<hardware_dev_t*> update_parallel;
+static work_pool update_pool;
+// sorts the loaded devices into those that update every iteration
+// and those that are scheduled. Called once configuration is done
+static void begin_hardware() {
+    const uint64_t now = micros64();
+    size_t parallel = 0;
+    for (hardware_dev_t* hw = hardware_head; hw != nullptr; hw = hw->next) {
+        if (hw->caps & HARDWARE_CAP_UPDATE_SCHEDULED) {
+            // it says when it needs to run after its first update,
+            // so a period set from the sketch doesn't apply
+            hw->update_period_us = 0;
+            update_every.push_back(hw);
+        } else if (hw->caps & HARDWARE_CAP_UPDATE) {
+            if (hw->update_period_us != 0) {
+                update_wheel.insert(hw, now);
+            } else {
+                update_every.push_back(hw);
+            }
+        } else {
+            continue;
+        }
+        if (hw->parallel) {
+            ++parallel;
+        }
+    }
+    if (parallel != 0) {
+        // the app thread takes a share too
+        size_t threads = std::thread::hardware_concurrency();
+        threads = threads > 1 ? threads - 1 : 0;
+        update_pool.begin(parallel < threads ? parallel : threads, "update pool");
+    }
+}
+// updates a device and works out when it's next due, leaving it
+// in update_next. Safe to call from the pool for different devices
+static void update_device(hardware_dev_t* hw, uint64_t now) {
+    TRACE_SCOPE("hardware", "update");
+    const uint64_t start = wall_ns();
+    if (hw->caps & HARDWARE_CAP_UPDATE_SCHEDULED) {
+        hw->update_next = 0;
+        ((hardware_interface_v3*)hw->hardware)->UpdateScheduled(now, &hw->update_next);
+    } else {
+        hw->hardware->Update();
+        if (hw->update_period_us == 0) {
+            hw->update_next = 0;
+        } else {
+            // keep to the period, but don't try to catch up after a stall
+            hw->update_next = hw->wheel_deadline + hw->update_period_us;
+            if (hw->update_next <= now) {
+                hw->update_next = now + hw->update_period_us;
+            }
+        }
+    }
+    uint64_t elapsed = wall_ns() - start;
+    update_metric->record(elapsed);
+    uint32_t ns = elapsed > UINT32_MAX ? UINT32_MAX : (uint32_t)elapsed;
+    ++hw->update_count;
+    hw->update_last_ns = ns;
+    hw->update_total_ns += ns;
+    if (ns > hw->update_max_ns) {
+        hw->update_max_ns = ns;
+    }
+}
+static void update_parallel_proc(void* state, size_t index) {
+    // the pool's threads only ever do the app's work
+    app_context = true;
+    update_device(update_parallel[index], *(const uint64_t*)state);
+}
+static void update_hardware() {
+    // on the micros64() clock, which is the one devices are told about
+    const uint64_t now = micros64();
+    update_due.clear();
+    update_parallel.clear();
+    for (hardware_dev_t* hw : update_every) {
+        hw->wheel_deadline = now;
+        update_due.push_back(hw);
+    }
+    update_every.clear();
+    update_wheel.advance(now, [](hardware_dev_t* hw) {
+        update_due.push_back(hw);
+    });
+    for (hardware_dev_t* hw : update_due) {
+        if (hw->parallel) {
+            update_parallel.push_back(hw);
+        }
+    }
+    // the independent devices run on the pool while the rest run
+    // here in order, and everything is done before loop() runs
+    update_pool.start(update_parallel.size(), update_parallel_proc, (void*)&now);
+    for (hardware_dev_t* hw : update_due) {
+        if (!hw->parallel) {
+            update_device(hw, now);
+        }
+    }
+    update_pool.wait();
+    for (hardware_dev_t* hw : update_due) {
+        if (hw->update_next != 0) {
+            update_wheel.insert(hw, hw->update_next);
+        } else {
+            update_every.push_back(hw);
+        }
+    }
+}
+static void schedule_at(uint64_t when, void (*callback)(void*), void* state) {
+    std::lock_guard<std::mutex> lock(timer_mutex);
+    timer_queue.push({when, timer_seq++, callback, state});
+}
+// the time the next timer is due, or UINT64_MAX if there isn't one
+static uint64_t next_timer_us() {
+    std::lock_guard<std::mutex> lock(timer_mutex);
+    if (timer_queue.empty()) {
+        return UINT64_MAX;
+    }
+    return timer_queue.top().when;
+}
+// runs everything that is due by the specified time, in timestamp
+// order. Under the virtual clock, time steps to each event as it runs
+static void run_timers(uint64_t until) {
+    if (virtual_clock) {
+        irq.dispatch();
+    }
+    while (true) {
+        timer_event_t ev;
+        {
+            std::lock_guard<std::mutex> lock(timer_mutex);
+            if (timer_queue.empty() || timer_queue.top().when > until) {
+                break;
+            }
+            ev = timer_queue.top();
+            timer_queue.pop();
+        }
+        if (virtual_clock && ev.when > virtual_time_us) {
+            virtual_time_us = ev.when;
+        }
+        ev.callback(ev.state);
+    }
+}
+// moves virtual time forward, running anything due on the way
+static void advance_virtual_clock(uint64_t us) {
+    uint64_t target = virtual_time_us + us;
+    run_timers(target);
+    virtual_time_us = target;
+}
+static void run_isr(uint8_t pin) {
+    TRACE_SCOPE_VALUE("irq", "isr", pin);
+    irq_metric->add(1);
+    void (*cb)(void) = gpios[pin].interrupt_cb;
+    if (cb != nullptr) {
+        cb();
+    }
+}
+void gpio::fire_interrupt() {
+    irq.raise(id, wall_ns());
+    if (virtual_clock && std::this_thread::get_id() == app_thread_id) {
+        irq.dispatch();
+    }
+    // edges from other threads wait for the next timer check
+}
+// makes the runtime's metrics. The serial ports make their own
+static void metrics_begin() {
+    loop_metric = metrics.histogram("loop.duration_ns");
+    update_metric = metrics.histogram("hardware.update_ns");
+    flush_calls_metric = metrics.counter("flush.calls");
+    flush_pixels_metric = metrics.counter("flush.pixels");
+    flush_frame_metric = metrics.histogram("flush.calls_per_frame");
+    irq_metric = metrics.counter("irq.count");
+    char name[METRIC_NAME_MAX];
+    for (int i = 0; i < SPI_PORT_MAX; ++i) {
+        snprintf(name, sizeof(name), "spi.%d.bits", i);
+        spi_ports[i].bits = metrics.counter(name);
+    }
+    for (int i = 0; i < I2C_PORT_MAX; ++i) {
+        snprintf(name, sizeof(name), "i2c.%d.transactions", i);
+        i2c_ports[i].transactions = metrics.counter(name);
+    }
+}
+static bool metrics_dump(const char* path) {
+    std::vector<char> json;
+    metrics.write_json(json, wall_ns() / 1000 - metrics_start_us);
+    if (path == nullptr || path[0] == 0) {
+        log_output.write(json.data(), json.size());
+        return true;
+    }
+    FILE* file = fopen(path, "wb");
+    if (file == nullptr) {
+        return false;
+    }
+    bool result = json.size() == fwrite(json.data(), 1, json.size(), file);
+    fclose(file);
+    return result;
+}
+// has the app shut down after the iteration in progress
+static void request_quit() {
+#ifdef _WIN32
+    SetEvent(quit_event);
+#endif
+    should_quit = true;
+}
+// runs one iteration of the application
+static void app_iteration() {
+    if (inputs.mode() != JOURNAL_OFF && !inputs.apply(app_iterations, apply_input)) {
+        // the replay is over. Stop where the recording did
+        request_quit();
+        return;
+    }
+    ++app_iterations;
+    update_hardware();
+    uint64_t start = virtual_time_us;
+    const uint64_t loop_start = wall_ns();
+    {
+        TRACE_SCOPE("app", "loop");
+        loop();
+    }
+    loop_metric->record(wall_ns() - loop_start);
+    if (flush_frame_calls != 0) {
+        flush_frame_metric->record(flush_frame_calls);
+        flush_frame_calls = 0;
+    }
+    if (virtual_clock) {
+        if (virtual_time_us == start) {
+            // loop() didn't wait, so charge it some time,
+            // otherwise sketches that poll millis() never progress
+            advance_virtual_clock(virtual_idle_step_us);
+        } else {
+            run_timers(virtual_time_us);
+        }
+    } else {
+        run_timers(wall_ns() / 1000);
+    }
+}
+
+// the wall clock delay engine. It sleeps through most of the wait
+// with the OS timer and only spins for the tail, which is sized
+// from how late the OS has been waking us up
+#define DELAY_SPIN_MIN_NS 20000
+#define DELAY_SPIN_MAX_NS 4000000
+static uint64_t delay_spin_ns = 50000;
+static hardware_delay_stats_t delay_stats = {};
+static uint64_t delay_overshoot_total_ns = 0;
+static void wait_until_ns(uint64_t deadline) {
+    uint64_t now = wall_ns();
+    if (deadline > now + delay_spin_ns) {
+        uint64_t target = deadline - delay_spin_ns;
+        os_sleep_ns(target - now);
+        now = wall_ns();
+        uint64_t late = now > target ? now - target : 0;
+        // grow quickly when the OS is late, shrink slowly when it isn't
+        uint64_t want = late + late / 4;
+        if (want > delay_spin_ns) {
+            delay_spin_ns = want;
+        } else {
+            delay_spin_ns -= (delay_spin_ns - want) / 16;
+        }
+        if (delay_spin_ns < DELAY_SPIN_MIN_NS) {
+            delay_spin_ns = DELAY_SPIN_MIN_NS;
+        } else if (delay_spin_ns > DELAY_SPIN_MAX_NS) {
+            delay_spin_ns = DELAY_SPIN_MAX_NS;
+        }
+    }
+    while (now < deadline) {
+        now = wall_ns();
+    }
+}
+static void record_overshoot(uint64_t deadline) {
+    uint64_t over = wall_ns() - deadline;
+    if (over > UINT32_MAX) {
+        over = UINT32_MAX;
+    }
+    ++delay_stats.count;
+    delay_stats.last_overshoot_ns = (uint32_t)over;
+    if (over > delay_stats.max_overshoot_ns) {
+        delay_stats.max_overshoot_ns = (uint32_t)over;
+    }
+    delay_overshoot_total_ns += over;
+    delay_stats.avg_overshoot_ns = (uint32_t)(delay_overshoot_total_ns / delay_stats.count);
+    delay_stats.spin_ns = (uint32_t)delay_spin_ns;
+}
+#ifdef _WIN32
+// this handles our main application loop. Rendering happens
+// on the presenter thread so EndDraw() waiting for vsync
+// doesn't throttle loop()
 static DWORD render_thread_proc(void* state) {
+    app_thread_id = std::this_thread::get_id();
+    app_context = true;
+    TRACE_THREAD_NAME("app");
+    begin_hardware();
     // run setup() to initialize user code
-    setup();
+    {
+        TRACE_SCOPE("app", "setup");
+        setup();
+    }
 
     bool quit = false;
     while (!quit) {
-        hardware_dev_t* hw = hardware_head;
-        while (hw != nullptr) {
-            if (hw->hardware->CanUpdate()) {
-                hw->hardware->Update();
-            }
-            hw = hw->next;
+        app_iteration();
+        InterlockedIncrement(&loops);
+        frame_capture.add(framebuffer, damage, micros64());
+        if (!damage.empty()) {
+            present_frames.publish(framebuffer, damage);
+            damage.clear();
+            SetEvent(present_event);
         }
-        loop();
-        if (render_target && render_bitmap) {
+        if (WAIT_OBJECT_0 == WaitForSingleObject(quit_event, 0)) {
+            quit = true;
+        }
+    }
+    return 0;
+}
+// picks up the latest completed frame and presents it
+static DWORD present_thread_proc(void* state) {
+    TRACE_THREAD_NAME("present");
+    HANDLE handles[] = {quit_event, present_event};
+    while (WAIT_OBJECT_0 != WaitForMultipleObjects(2, handles, FALSE, INFINITE)) {
+        const uint32_t* pixels;
+        const damage_region* frame = present_frames.acquire(&pixels);
+        // only present when something changed
+        if (render_target && render_bitmap && (frame != nullptr || repaint)) {
             if (WAIT_OBJECT_0 == WaitForSingleObject(
                                      app_mutex,    // handle to mutex
                                      INFINITE)) {  // no time-out interval)
-
+                TRACE_SCOPE("display", "present");
+                repaint = false;
+                if (frame != nullptr) {
+                    // upload just the dirty areas
+                    for (size_t i = 0; i < frame->size(); ++i) {
+                        const damage_rect_t& r = (*frame)[i];
+                        D2D1_RECT_U b;
+                        b.top = r.y1;
+                        b.left = r.x1;
+                        b.bottom = r.y2;
+                        b.right = r.x2;
+                        render_bitmap->CopyFromMemory(&b,
+                                                      pixels + r.y1 * present_frames.stride() + r.x1,
+                                                      present_frames.stride() * 4);
+                    }
+                }
                 render_target->BeginDraw();
                 D2D1_RECT_F rect_dest = {
                     0,
@@ -308,9 +943,6 @@ static DWORD render_thread_proc(void* state) {
                 InterlockedIncrement(&frames);
             }
         }
-        if (WAIT_OBJECT_0 == WaitForSingleObject(quit_event, 0)) {
-            quit = true;
-        }
     }
     return 0;
 }
@@ -368,9 +1000,13 @@ static LRESULT CALLBACK WindowProcGpio(HWND hWnd, UINT uMsg, WPARAM wParam, LPAR
             GetWindowTextW((HWND)lParam, sz, sizeof(sz) / sizeof(wchar_t));
             sz[63] = 0;
             if (0 == wcsicmp(sz, L"LOW")) {
-                g.value(LOW);
+                if (!pin_input(gpio, LOW)) {
+                    g.value(LOW);
+                }
             } else if (0 == wcsicmp(sz, L"HIGH")) {
-                g.value(HIGH);
+                if (!pin_input(gpio, HIGH)) {
+                    g.value(HIGH);
+                }
             } else {
                 size_t l = wcslen(sz);
                 bool isnum = true;
@@ -382,7 +1018,9 @@ static LRESULT CALLBACK WindowProcGpio(HWND hWnd, UINT uMsg, WPARAM wParam, LPAR
                 }
                 if (isnum) {
                     int v = _wtoi(sz);
-                    g.value(v);
+                    if (!pin_input(gpio, v)) {
+                        g.value(v);
+                    }
                 }
             }
         }
@@ -401,6 +1039,12 @@ static LRESULT CALLBACK WindowProcDX(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM
             D2D1_SIZE_U size = D2D1::SizeU(LOWORD(lParam), HIWORD(lParam));
             render_target->Resize(size);
         }
+        repaint = true;
+        SetEvent(present_event);
+    }
+    if (uMsg == WM_PAINT) {
+        repaint = true;
+        SetEvent(present_event);
     }
     // in case we receive the close event
     if (uMsg == WM_CLOSE) {
@@ -409,199 +1053,573 @@ static LRESULT CALLBACK WindowProcDX(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM
     }
     return DefWindowProc(hWnd, uMsg, wParam, lParam);
 }
+#else
+// this handles our main application loop. There is
+// nothing to present, since the framebuffer is the display,
+// so the damage is simply discarded
+static void render_thread_proc() {
+    app_thread_id = std::this_thread::get_id();
+    app_context = true;
+    TRACE_THREAD_NAME("app");
+    begin_hardware();
+    // run setup() to initialize user code
+    {
+        TRACE_SCOPE("app", "setup");
+        setup();
+    }
 
-bool read_mouse(int* out_x, int* out_y) {
-    if (WAIT_OBJECT_0 == WaitForSingleObject(
-                             app_mutex,    // handle to mutex
-                             INFINITE)) {  // no time-out interval)
-
-        if (mouse_state) {
-            *out_x = mouse_loc.x;
-            *out_y = mouse_loc.y;
-        }
-        mouse_req = 0;
-        ReleaseMutex(app_mutex);
-        return mouse_state;
+    while (!should_quit) {
+        app_iteration();
+        frame_capture.add(framebuffer, damage, micros64());
+        damage.clear();
     }
-    return false;
 }
-void flush_bitmap(int x1, int y1, int w, int h, const void* bmp) {
-    if (render_bitmap != NULL) {
-        D2D1_RECT_U b;
-        b.top = y1;
-        b.left = x1;
-        b.bottom = y1 + h;
-        b.right = x1 + w;
-        render_bitmap->CopyFromMemory(&b, bmp, w * 4);
-    }
+static void quit_signal_handler(int) {
+    should_quit = true;
 }
-uint32_t millis() {
-    LARGE_INTEGER counter_freq;
+#endif
+
+#ifdef _WIN32
+static uint64_t wall_ns() {
     LARGE_INTEGER end_time;
-    QueryPerformanceFrequency(&counter_freq);
     QueryPerformanceCounter(&end_time);
-    return uint32_t(((double)(end_time.QuadPart - start_time.QuadPart) / counter_freq.QuadPart) * 1000);
+    uint64_t ticks = end_time.QuadPart - start_time.QuadPart;
+    uint64_t freq = counter_freq.QuadPart;
+    // split so the multiply can't overflow
+    return (ticks / freq) * 1000000000 + (ticks % freq) * 1000000000 / freq;
 }
-uint32_t micros() {
-    LARGE_INTEGER counter_freq;
-    LARGE_INTEGER end_time;
-    QueryPerformanceFrequency(&counter_freq);
-    QueryPerformanceCounter(&end_time);
-    return uint32_t(((double)(end_time.QuadPart - start_time.QuadPart) / counter_freq.QuadPart) * 1000000.0);
+#ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION 0x00000002
+#endif
+static void os_sleep_ns(uint64_t ns) {
+    // one per thread, since a waitable timer can't be shared
+    // between concurrent waits
+    static thread_local HANDLE timer = NULL;
+    if (timer == NULL) {
+        timer = CreateWaitableTimerExW(NULL, NULL, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+        if (timer == NULL) {
+            // older than Windows 10 1803
+            timer = CreateWaitableTimerExW(NULL, NULL, 0, TIMER_ALL_ACCESS);
+        }
+        if (timer == NULL) {
+            Sleep((DWORD)(ns / 1000000));
+            return;
+        }
+    }
+    LARGE_INTEGER due;
+    // negative means relative, in 100ns units
+    due.QuadPart = -(LONGLONG)(ns / 100);
+    if (SetWaitableTimer(timer, &due, 0, NULL, NULL, FALSE)) {
+        WaitForSingleObject(timer, INFINITE);
+    }
 }
-void delay(uint32_t ms) {
-    if (is_isr) return;
-    uint32_t end = ms + millis();
-    while (millis() < end)
-        ;
+#else
+static uint64_t monotonic_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
 }
-void delayMicroseconds(uint32_t us) {
-    uint32_t end = us + micros();
-    while (micros() < end)
+static uint64_t wall_ns() {
+    return monotonic_ns() - start_time;
+}
+static void os_sleep_ns(uint64_t ns) {
+    struct timespec ts;
+    ts.tv_sec = ns / 1000000000;
+    ts.tv_nsec = ns % 1000000000;
+    while (0 != nanosleep(&ts, &ts))
         ;
 }
-
-// write to the log window
-void log_print(const char* text) {
-    static wchar_t sz[65536];
-    if(text==nullptr || text[0]==0) {
+#endif
+void flush_bitmap(int x1, int y1, int w, int h, const void* bmp) {
+    flush_bitmap_ex(x1, y1, w, h, bmp, FLUSH_FORMAT_NATIVE, 0);
+}
+void flush_bitmap_ex(int x1, int y1, int w, int h, const void* bmp, flush_format_t format, size_t stride) {
+    if (framebuffer == nullptr || bmp == nullptr) {
         return;
     }
-    if(hwnd_log==nullptr) {
-        if(pre_log==nullptr) {
-            pre_log = (char*)malloc(strlen(text)+1);
-            if(pre_log!=nullptr) {
-                memcpy(pre_log,text,strlen(text)+1);
-            }
-            return;
-        } else {
-            size_t len_log = strlen(pre_log);
-            size_t len_txt = strlen(text);
-            size_t len = len_log+len_txt;
-            pre_log = (char*)realloc(pre_log, len+1);
-            if(pre_log==nullptr) {
-                return;
-            }
-            memcpy(pre_log+len_log,text,len_txt+1);
-        }
+    pixel_convert_fn convert = pixel_converter(format);
+    if (convert == nullptr) {
         return;
     }
-    int index = GetWindowTextLength(hwnd_log);
-    LRESULT len = SendMessageW(hwnd_log,EM_GETLIMITTEXT,0,0);
-    while(index+strlen(text)>=len) {
-        GetWindowTextW(hwnd_log,sz,sizeof(sz));
-        wchar_t* l = wcschr(sz,'\n');
-        if(l==nullptr) {
-            SetWindowTextW(hwnd_log,L"");
-            break;
-        }
-        SetWindowTextW(hwnd_log,l+1);
-        index = wcslen(l+1);
+    const size_t pixel_size = pixel_format_size(format);
+    if (stride == 0) {
+        stride = w * pixel_size;
     }
-    // SetFocus (hwnd_log); // set focus
-    SendMessageA(hwnd_log, EM_SETSEL, (WPARAM)index, (LPARAM)index);  // set selection - end of text
-    SendMessageA(hwnd_log, EM_REPLACESEL, 0, (LPARAM)text);           // append!
-}
-static void update_gpios() {
-    updating_gpios = true;
-    while (GetMenuItemCount(gpio_menu)) {
-        RemoveMenu(gpio_menu, 0, MF_BYPOSITION);
+    // clip to the screen
+    const uint8_t* src = (const uint8_t*)bmp;
+    if (x1 < 0) {
+        src -= x1 * (int)pixel_size;
+        w += x1;
+        x1 = 0;
     }
-    wchar_t name[256];
-    for (size_t i = 0; i < 256; ++i) {
-        gpio_t& g = gpios[i];
-        if (g.mode != 0) {
-            wcscpy(name, L"GPIO ");
-            _itow((int)i, name + wcslen(name), 10);
-            switch (g.mode) {
-                case INPUT:
-                case INPUT_PULLDOWN:
-                case INPUT_PULLUP:
-                    wcscat(name, L" <");
-                    break;
-                case OUTPUT:
-                case OUTPUT_OPEN_DRAIN:
-                    wcscat(name, L" >");
-            }
-            MENUITEMINFOW mif;
-            mif.cbSize = sizeof(MENUITEMINFOW);
-            mif.cch = wcslen(name);
-            mif.dwTypeData = name;
-            mif.fMask = MIIM_STRING | MIIM_ID | MIIM_STATE;
-            mif.wID = (~i);
-            mif.fState = g.value() == 0 ? MFS_UNCHECKED : MFS_CHECKED;
-            InsertMenuItemW(gpio_menu, GetMenuItemCount(gpio_menu), TRUE, &mif);
-        }
-        if (g.hwnd_text != NULL) {
-            // update the visible text box
-            wchar_t val[64];
-            if (!g.is_input()) {
-                if (g.value() == HIGH) {
-                    wcscpy(val, L"HIGH");
-                } else if (g.value() == LOW) {
-                    wcscpy(val, L"LOW");
-                } else {
-                    _itow(g.value(), val, 10);
-                }
-                if (GetFocus() != g.hwnd_text) {
-                    SetWindowTextW(g.hwnd_text, val);
-                }
-            }
-            EnableWindow(g.hwnd_text, g.is_input() ? TRUE : FALSE);
-        }
+    if (y1 < 0) {
+        src -= y1 * (ptrdiff_t)stride;
+        h += y1;
+        y1 = 0;
     }
-    updating_gpios = false;
-}
-void ensure_gpio_window(size_t gpio) {
-    if (gpio > 255) {
-        return;
+    if (x1 + w > winduino_screen_size.width) {
+        w = winduino_screen_size.width - x1;
     }
-    if (gpios[gpio].hwnd_text) {
+    if (y1 + h > winduino_screen_size.height) {
+        h = winduino_screen_size.height - y1;
+    }
+    if (w <= 0 || h <= 0) {
         return;
     }
-    wchar_t name[64];
-    wcscpy(name, L"GPIO ");
-    _itow(gpio, name + wcslen(name), 10);
-    HWND hwnd = CreateWindowExW(
-        WS_EX_TOOLWINDOW, L"Winduino_GPIO", name,
-        WS_CAPTION | WS_SYSMENU,
-        CW_USEDEFAULT, CW_USEDEFAULT,
-        200,
-        100,
-        NULL, NULL, GetModuleHandle(NULL), &gpios[gpio]);
-    if (hwnd == NULL) {
+    TRACE_SCOPE_VALUE("display", "flush", (uint64_t)w * h);
+    uint32_t* dst = framebuffer + y1 * winduino_screen_size.width + x1;
+    for (int y = 0; y < h; ++y) {
+        convert(dst, src, w, palette);
+        dst += winduino_screen_size.width;
+        src += stride;
+    }
+    damage.add(x1, y1, x1 + w, y1 + h);
+    frame_hashes.invalidate(x1, y1, x1 + w, y1 + h);
+    ++flush_frame_calls;
+    flush_calls_metric->add(1);
+    flush_pixels_metric->add((uint64_t)w * h);
+}
+void flush_palette(const uint32_t* colors, size_t count) {
+    if (colors == nullptr) {
         return;
     }
-    ShowWindow(hwnd, SW_SHOW);
-    UpdateWindow(hwnd);
-    SetForegroundWindow(hwnd);
-    SetActiveWindow(hwnd);
+    if (count > 256) {
+        count = 256;
+    }
+    memcpy(palette, colors, count * sizeof(uint32_t));
 }
-// entry point
-int main(int argc, char* argv[]) {
-    // Initialize COM
-    CoInitialize(0);
-    HRESULT hr = S_OK;
-    // get our uptime start
-    QueryPerformanceCounter(&start_time);
-    // init GPIOs
-    for (size_t i = 0; i < 256; ++i) {
-        gpios[i].id = i;
-        gpios[i].mode = 0;  // not set yet
-        gpios[i].interrupt_mode = -1;
-        gpios[i].interrupt_cb = nullptr;
-        gpios[i].hwnd_text = nullptr;
-        gpios[i].value(0);
+uint64_t micros64() {
+    return clock_us() + clock_offset_us;
+}
+static void touch_update(touch_state_t& state, uint8_t id, uint8_t type, int16_t x, int16_t y) {
+    state.x[id] = x;
+    state.y[id] = y;
+    if (type == TOUCH_EVENT_PRESS) {
+        state.pressed |= 1u << id;
+    } else if (type == TOUCH_EVENT_RELEASE) {
+        state.pressed &= ~(1u << id);
     }
-    // register the window classes
-    // we'll need:
-    WNDCLASSW wc;
-    HINSTANCE hInstance = GetModuleHandle(NULL);
-    wc.style = CS_HREDRAW | CS_VREDRAW;
-    wc.lpfnWndProc = WindowProcMain;
-    wc.cbClsExtra = 0;
-    wc.cbWndExtra = 0;
-    wc.hInstance = hInstance;
+}
+// queues a pointer event and publishes the new state. This is the
+// input thread, unless the journal is on, in which case it's the app
+// thread at the start of an iteration
+static void touch_apply(const touch_event_t& e) {
+    touch_update(touch_applied, e.id, e.type, e.x, e.y);
+    touch_latest.publish(touch_applied);
+    // if the sketch isn't reading events, the newest are the ones lost
+    touch_events.push(e);
+}
+#ifdef _WIN32
+// tracks a pointer event and hands it on. Only the input thread calls this
+static void touch_post(uint8_t id, uint8_t type, int x, int y) {
+    touch_event_t e;
+    e.timestamp = micros64();
+    e.id = id;
+    e.type = type;
+    e.x = (int16_t)x;
+    e.y = (int16_t)y;
+    touch_update(touch_current, id, type, e.x, e.y);
+    input_event_t in;
+    in.timestamp = e.timestamp;
+    in.kind = INPUT_KIND_TOUCH;
+    in.channel = id;
+    in.type = type;
+    in.x = e.x;
+    in.y = e.y;
+    in.value = 0;
+    in.size = 0;
+    if (!inputs.capture(in, nullptr)) {
+        touch_apply(e);
+    }
+}
+#endif
+// drives a pin from outside the sketch. Returns true if the journal took it
+static bool pin_input(uint8_t pin, uint32_t value) {
+    input_event_t in;
+    in.timestamp = micros64();
+    in.kind = INPUT_KIND_PIN;
+    in.channel = pin;
+    in.type = 0;
+    in.x = 0;
+    in.y = 0;
+    in.value = value;
+    in.size = 0;
+    return inputs.capture(in, nullptr);
+}
+// applies an input the journal let through to the sketch
+static void apply_input(const input_event_t& in, const uint8_t* data) {
+    switch (in.kind) {
+        case INPUT_KIND_TOUCH: {
+            if (in.channel >= WINDUINO_TOUCH_POINTS) {
+                break;
+            }
+            touch_event_t e;
+            e.timestamp = in.timestamp;
+            e.id = in.channel;
+            e.type = in.type;
+            e.x = in.x;
+            e.y = in.y;
+            touch_apply(e);
+        } break;
+        case INPUT_KIND_PIN:
+            gpios[in.channel].value(in.value);
+            break;
+        case INPUT_KIND_SERIAL:
+            switch (in.channel) {
+#if SOC_UART_NUM > 0
+                case 0:
+                    Serial.receive(data, in.size);
+                    break;
+#endif
+#if SOC_UART_NUM > 1
+                case 1:
+                    Serial1.receive(data, in.size);
+                    break;
+#endif
+#if SOC_UART_NUM > 2
+                case 2:
+                    Serial2.receive(data, in.size);
+                    break;
+#endif
+#if SOC_UART_NUM > 3
+                case 3:
+                    Serial3.receive(data, in.size);
+                    break;
+#endif
+            }
+            break;
+    }
+}
+bool read_mouse(int* out_x, int* out_y) {
+    const touch_state_t state = touch_latest.read();
+    if (state.pressed == 0) {
+        return false;
+    }
+    // the mouse takes precedence over touches
+    int id = __builtin_ctz(state.pressed);
+    *out_x = state.x[id];
+    *out_y = state.y[id];
+    return true;
+}
+size_t read_touch_events(touch_event_t* out_events, size_t max_events) {
+    if (out_events == nullptr) {
+        return 0;
+    }
+    return touch_events.pop(out_events, max_events);
+}
+uint64_t millis64() {
+    return micros64() / 1000;
+}
+uint32_t millis() {
+    return (uint32_t)millis64();
+}
+uint32_t micros() {
+    return (uint32_t)micros64();
+}
+int64_t esp_timer_get_time() {
+    return (int64_t)micros64();
+}
+void delay(uint32_t ms) {
+    if (interrupt_controller::in_isr()) return;
+    if (virtual_clock) {
+        advance_virtual_clock((uint64_t)ms * 1000);
+        return;
+    }
+    TRACE_SCOPE_VALUE("app", "delay", ms);
+    uint64_t deadline = wall_ns() + (uint64_t)ms * 1000000;
+    while (true) {
+        uint64_t now = wall_ns();
+        run_timers(now / 1000);
+        if (now >= deadline) {
+            break;
+        }
+        // wake up early if a timer comes due first
+        uint64_t next = next_timer_us();
+        if (next != UINT64_MAX && next * 1000 < deadline) {
+            wait_until_ns(next * 1000);
+        } else {
+            wait_until_ns(deadline);
+        }
+    }
+    record_overshoot(deadline);
+}
+void delayMicroseconds(uint32_t us) {
+    if (virtual_clock) {
+        advance_virtual_clock(us);
+        return;
+    }
+    uint64_t deadline = wall_ns() + (uint64_t)us * 1000;
+    wait_until_ns(deadline);
+    record_overshoot(deadline);
+}
+
+void log_print(const char* text) {
+    if (text == nullptr) {
+        return;
+    }
+    log_output.write(text, strlen(text));
+}
+void log_site_refresh(log_site_t* site) {
+    const uint32_t generation = log_filter_generation.load(std::memory_order_acquire);
+    site->allowed.store(log_filters.get(site->tag != nullptr ? site->tag : pathToFileName(site->file)),
+                        std::memory_order_relaxed);
+    site->generation.store(generation, std::memory_order_release);
+}
+// gives a site its id, writing it to the binary log the first time
+static uint32_t log_site_register(log_site_t* site) {
+    std::lock_guard<std::mutex> lock(log_site_mutex);
+    uint32_t id = site->id.load(std::memory_order_relaxed);
+    if (id != 0) {
+        return id;
+    }
+    std::vector<uint8_t> record;
+    log_encode_site(record, log_site_count + 1, site->level, site->line, site->tag, site->file, site->function, site->format);
+    if (!log_binary_output.write((const char*)record.data(), record.size())) {
+        // try again next time, since its entries are useless without it
+        return 0;
+    }
+    id = ++log_site_count;
+    site->id.store(id, std::memory_order_release);
+    return id;
+}
+void log_site_write(log_site_t* site, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    if (log_binary.load(std::memory_order_acquire)) {
+        const uint32_t id = site->id.load(std::memory_order_acquire) != 0 ? site->id.load(std::memory_order_relaxed) : log_site_register(site);
+        if (id != 0) {
+            static thread_local std::vector<uint8_t> record;
+            record.clear();
+            log_encode_entry(record, id, micros64(), format, args);
+            log_binary_output.write((const char*)record.data(), record.size());
+        }
+        va_end(args);
+        return;
+    }
+    char buf[256];
+    size_t size = log_format_prefix(buf, sizeof(buf), micros64(), site->level, site->tag, site->file, site->line, site->function);
+    va_list copy;
+    va_copy(copy, args);
+    int length = vsnprintf(buf + size, sizeof(buf) - size, format, copy);
+    va_end(copy);
+    if (length >= 0 && size + length + 2 < sizeof(buf)) {
+        size += length;
+        buf[size++] = '\r';
+        buf[size++] = '\n';
+        log_output.write(buf, size);
+    } else if (length >= 0) {
+        static thread_local std::vector<char> text;
+        text.resize(size + length + 3);
+        memcpy(text.data(), buf, size);
+        vsnprintf(text.data() + size, length + 1, format, args);
+        size += length;
+        text[size++] = '\r';
+        text[size++] = '\n';
+        log_output.write(text.data(), size);
+    }
+    va_end(args);
+}
+void esp_log_level_set(const char* tag, esp_log_level_t level) {
+    log_filters.set(tag, (uint8_t)level);
+    log_filter_generation.fetch_add(1, std::memory_order_release);
+}
+esp_log_level_t esp_log_level_get(const char* tag) {
+    return (esp_log_level_t)log_filters.get(tag);
+}
+#ifdef _WIN32
+// runs on the log thread, and hands the text to the message pump
+static void log_window_sink(const char* text, size_t size, void* state) {
+    {
+        std::lock_guard<std::mutex> lock(log_window_mutex);
+        if (size >= LOG_WINDOW_PENDING_MAX) {
+            log_window_pending.clear();
+            text += size - LOG_WINDOW_PENDING_MAX;
+            size = LOG_WINDOW_PENDING_MAX;
+        } else if (log_window_pending.size() + size > LOG_WINDOW_PENDING_MAX) {
+            size_t excess = log_window_pending.size() + size - LOG_WINDOW_PENDING_MAX;
+            log_window_pending.erase(log_window_pending.begin(), log_window_pending.begin() + excess);
+        }
+        log_window_pending.insert(log_window_pending.end(), text, text + size);
+    }
+    // one message covers everything pending until the pump gets to it
+    if (hwnd_main != NULL && !log_window_posted.exchange(true)) {
+        PostMessage(hwnd_main, WM_LOG, 0, 0);
+    }
+}
+// appends the pending text to the log window. Only the message pump calls this
+static void log_window_flush() {
+    static std::vector<char> text;
+    log_window_posted = false;
+    {
+        std::lock_guard<std::mutex> lock(log_window_mutex);
+        text.swap(log_window_pending);
+        log_window_pending.clear();
+    }
+    if (text.empty() || hwnd_log == NULL) {
+        return;
+    }
+    text.push_back(0);
+    const size_t size = text.size() - 1;
+    const size_t limit = (size_t)SendMessageW(hwnd_log, EM_GETLIMITTEXT, 0, 0);
+    const char* append = text.data();
+    if (size >= limit) {
+        append += size - limit / 2;
+        SetWindowTextW(hwnd_log, L"");
+    }
+    size_t index = (size_t)GetWindowTextLengthW(hwnd_log);
+    const size_t append_size = strlen(append);
+    if (index + append_size >= limit) {
+        // cut whole lines off the top in one go, with room to spare
+        // so this doesn't happen again on the next append
+        size_t excess = index + append_size - limit + limit / 4;
+        LRESULT line = SendMessageW(hwnd_log, EM_LINEFROMCHAR, excess < index ? excess : index, 0);
+        LRESULT cut = SendMessageW(hwnd_log, EM_LINEINDEX, line + 1, 0);
+        if (cut < 0 || (size_t)cut > index) {
+            cut = (LRESULT)index;
+        }
+        SendMessageW(hwnd_log, EM_SETSEL, 0, cut);
+        SendMessageW(hwnd_log, EM_REPLACESEL, 0, (LPARAM)L"");
+        index -= (size_t)cut;
+    }
+    SendMessageA(hwnd_log, EM_SETSEL, (WPARAM)index, (LPARAM)index);  // set selection - end of text
+    SendMessageA(hwnd_log, EM_REPLACESEL, 0, (LPARAM)append);         // append!
+    text.clear();
+}
+// finds the menu position for a pin, and whether it's already there
+static int gpio_menu_position(uint8_t pin, bool* out_found) {
+    int count = GetMenuItemCount(gpio_menu);
+    for (int i = 0; i < count; ++i) {
+        uint8_t item_pin = (uint8_t)~GetMenuItemID(gpio_menu, i);
+        if (item_pin >= pin) {
+            *out_found = item_pin == pin;
+            return i;
+        }
+    }
+    *out_found = false;
+    return count;
+}
+static void refresh_gpio(uint8_t pin) {
+    gpio_t& g = gpios[pin];
+    bool found;
+    int pos = gpio_menu_position(pin, &found);
+    if (g.mode == 0) {
+        if (found) {
+            RemoveMenu(gpio_menu, pos, MF_BYPOSITION);
+        }
+    } else {
+        wchar_t name[256];
+        wcscpy(name, L"GPIO ");
+        _itow((int)pin, name + wcslen(name), 10);
+        switch (g.mode) {
+            case INPUT:
+            case INPUT_PULLDOWN:
+            case INPUT_PULLUP:
+                wcscat(name, L" <");
+                break;
+            case OUTPUT:
+            case OUTPUT_OPEN_DRAIN:
+                wcscat(name, L" >");
+        }
+        MENUITEMINFOW mif;
+        mif.cbSize = sizeof(MENUITEMINFOW);
+        mif.cch = wcslen(name);
+        mif.dwTypeData = name;
+        mif.fMask = MIIM_STRING | MIIM_ID | MIIM_STATE;
+        mif.wID = (~(UINT)pin);
+        mif.fState = g.value() == 0 ? MFS_UNCHECKED : MFS_CHECKED;
+        if (found) {
+            SetMenuItemInfoW(gpio_menu, pos, TRUE, &mif);
+        } else {
+            InsertMenuItemW(gpio_menu, pos, TRUE, &mif);
+        }
+    }
+    if (g.hwnd_text != NULL) {
+        // update the visible text box
+        wchar_t val[64];
+        if (!g.is_input()) {
+            if (g.value() == HIGH) {
+                wcscpy(val, L"HIGH");
+            } else if (g.value() == LOW) {
+                wcscpy(val, L"LOW");
+            } else {
+                _itow(g.value(), val, 10);
+            }
+            if (GetFocus() != g.hwnd_text) {
+                SetWindowTextW(g.hwnd_text, val);
+            }
+        }
+        EnableWindow(g.hwnd_text, g.is_input() ? TRUE : FALSE);
+    }
+}
+// runs on the UI thread from a timer, so the GPIO menu and windows
+// only get touched for the pins that changed, and at most
+// GPIO_REFRESH_HZ times a second however fast they're being written
+static void refresh_gpios() {
+    updating_gpios = true;
+    for (int i = 0; i < 8; ++i) {
+        uint32_t dirty = gpio_dirty[i].exchange(0, std::memory_order_acquire);
+        while (dirty) {
+            int bit = __builtin_ctz(dirty);
+            dirty &= dirty - 1;
+            refresh_gpio((uint8_t)(i * 32 + bit));
+        }
+    }
+    updating_gpios = false;
+}
+void ensure_gpio_window(size_t gpio) {
+    if (gpio > 255) {
+        return;
+    }
+    if (gpios[gpio].hwnd_text) {
+        return;
+    }
+    wchar_t name[64];
+    wcscpy(name, L"GPIO ");
+    _itow(gpio, name + wcslen(name), 10);
+    HWND hwnd = CreateWindowExW(
+        WS_EX_TOOLWINDOW, L"Winduino_GPIO", name,
+        WS_CAPTION | WS_SYSMENU,
+        CW_USEDEFAULT, CW_USEDEFAULT,
+        200,
+        100,
+        NULL, NULL, GetModuleHandle(NULL), &gpios[gpio]);
+    if (hwnd == NULL) {
+        return;
+    }
+    ShowWindow(hwnd, SW_SHOW);
+    UpdateWindow(hwnd);
+    SetForegroundWindow(hwnd);
+    SetActiveWindow(hwnd);
+}
+// entry point
+int main(int argc, char* argv[]) {
+    // Initialize COM
+    CoInitialize(0);
+    HRESULT hr = S_OK;
+    log_output.add_sink(log_window_sink, nullptr);
+    log_output.begin();
+    metrics_begin();
+    // get our uptime start
+    QueryPerformanceFrequency(&counter_freq);
+    QueryPerformanceCounter(&start_time);
+    // init GPIOs
+    for (size_t i = 0; i < 256; ++i) {
+        gpios[i].id = i;
+        gpios[i].mode = 0;  // not set yet (the bitsets start clear)
+        gpios[i].interrupt_mode = -1;
+        gpios[i].interrupt_cb = nullptr;
+        gpios[i].hwnd_text = nullptr;
+        gpios[i].value(0);
+    }
+    // register the window classes
+    // we'll need:
+    WNDCLASSW wc;
+    HINSTANCE hInstance = GetModuleHandle(NULL);
+    wc.style = CS_HREDRAW | CS_VREDRAW;
+    wc.lpfnWndProc = WindowProcMain;
+    wc.cbClsExtra = 0;
+    wc.cbWndExtra = 0;
+    wc.hInstance = hInstance;
     wc.hbrBackground = NULL;
     wc.lpszMenuName = NULL;
     wc.hIcon = NULL;
@@ -617,7 +1635,9 @@ int main(int argc, char* argv[]) {
     RegisterClassW(&wc);
     HWND hwnd_dx;
     // run winduino init code if present
+    configuring = true;
     winduino();
+    configuring = false;
 
     RECT r = {0, 0, winduino_screen_size.width * 2, winduino_screen_size.height - 1};
     // adjust the size of the window so
@@ -682,6 +1702,11 @@ int main(int argc, char* argv[]) {
     if (quit_event == NULL) {
         goto exit;
     }
+    // for waking the presenter
+    present_event = CreateEvent(NULL, FALSE, FALSE, NULL);
+    if (present_event == NULL) {
+        goto exit;
+    }
     // for handling our render
     app_mutex = CreateMutex(NULL, FALSE, NULL);
     if (app_mutex == NULL) {
@@ -729,18 +1754,38 @@ int main(int argc, char* argv[]) {
         assert(hr == S_OK);
         if (hr != S_OK) goto exit;
     }
+    // and the copy of the display we flush to
+    framebuffer = (uint32_t*)calloc(
+        (size_t)winduino_screen_size.width * winduino_screen_size.height,
+        sizeof(uint32_t));
+    if (framebuffer == nullptr) {
+        goto exit;
+    }
+    if (!frame_hashes.begin(winduino_screen_size.width, winduino_screen_size.height)) {
+        goto exit;
+    }
+    if (!present_frames.begin(winduino_screen_size.width, winduino_screen_size.height)) {
+        goto exit;
+    }
     // show the main window
     ShowWindow(hwnd_main, SW_SHOWNORMAL);
     UpdateWindow(hwnd_main);
     // for the frame counter
     SetTimer(hwnd_main, 0, 1000, NULL);
-    if(pre_log) {
-        log_print(pre_log);
-        free(pre_log);
-        pre_log=nullptr;
-    }
+    // for the GPIO menu and windows
+    SetTimer(hwnd_main, GPIO_REFRESH_TIMER, 1000 / GPIO_REFRESH_HZ, NULL);
+    // anything logged before the window was there
+    log_window_flush();
     // this is the thread where the actual rendering
-    // takes place and where loop() is run
+    // takes place
+    present_thread = CreateThread(NULL, 8000 * 4, present_thread_proc, NULL, 0, NULL);
+    if (present_thread == NULL) {
+        goto exit;
+    }
+    if (!irq.begin(run_isr, wall_ns, !virtual_clock)) {
+        goto exit;
+    }
+    // this is the thread where loop() is run
     app_thread = CreateThread(NULL, 8000 * 4, render_thread_proc, NULL, 0, NULL);
     if (app_thread == NULL) {
         goto exit;
@@ -755,59 +1800,46 @@ int main(int argc, char* argv[]) {
                 should_quit = true;
                 break;
             }
-            if (msg.message == WM_TIMER) {
+            if (msg.message == WM_TIMER && msg.wParam == GPIO_REFRESH_TIMER) {
+                refresh_gpios();
+            } else if (msg.message == WM_TIMER) {
                 update_title(hwnd_main);
                 InterlockedExchange(&frames, 0);
+                InterlockedExchange(&loops, 0);
             }
             // handle our out of band messages
             if (msg.message == WM_LBUTTONDOWN && msg.hwnd == hwnd_dx) {
                 if (LOWORD(msg.lParam) < winduino_screen_size.width &&
                     HIWORD(msg.lParam) < winduino_screen_size.height) {
                     SetCapture(hwnd_dx);
-
-                    if (WAIT_OBJECT_0 == WaitForSingleObject(
-                                             app_mutex,    // handle to mutex
-                                             INFINITE)) {  // no time-out interval)
-                        old_mouse_state = mouse_state;
-                        mouse_state = 1;
-                        mouse_loc.x = LOWORD(msg.lParam);
-                        mouse_loc.y = HIWORD(msg.lParam);
-                        mouse_req = 1;
-                        ReleaseMutex(app_mutex);
-                    }
+                    touch_post(0, TOUCH_EVENT_PRESS, LOWORD(msg.lParam), HIWORD(msg.lParam));
                     update_title(hwnd_main);
                 }
             }
             if (msg.message == WM_MOUSEMOVE &&
                 msg.hwnd == hwnd_dx) {
-                if (WAIT_OBJECT_0 == WaitForSingleObject(
-                                         app_mutex,    // handle to mutex
-                                         INFINITE)) {  // no time-out interval)
-                    if (mouse_state == 1 && MK_LBUTTON == msg.wParam) {
-                        mouse_req = 1;
-                        mouse_loc.x = (int16_t)LOWORD(msg.lParam);
-                        mouse_loc.y = (int16_t)HIWORD(msg.lParam);
-                    }
-                    ReleaseMutex(app_mutex);
+                if ((touch_current.pressed & 1) && MK_LBUTTON == msg.wParam) {
+                    touch_post(0, TOUCH_EVENT_MOVE, (int16_t)LOWORD(msg.lParam), (int16_t)HIWORD(msg.lParam));
+                    update_title(hwnd_main);
                 }
-                update_title(hwnd_main);
             }
             if (msg.message == WM_LBUTTONUP &&
                 msg.hwnd == hwnd_dx) {
                 ReleaseCapture();
-                if (WAIT_OBJECT_0 == WaitForSingleObject(
-                                         app_mutex,    // handle to mutex
-                                         INFINITE)) {  // no time-out interval)
-
-                    old_mouse_state = mouse_state;
-                    mouse_req = 1;
-                    mouse_state = 0;
-                    mouse_loc.x = (int16_t)LOWORD(msg.lParam);
-                    mouse_loc.y = (int16_t)HIWORD(msg.lParam);
-                    ReleaseMutex(app_mutex);
+                if (touch_current.pressed & 1) {
+                    touch_post(0, TOUCH_EVENT_RELEASE, (int16_t)LOWORD(msg.lParam), (int16_t)HIWORD(msg.lParam));
                 }
                 update_title(hwnd_main);
             }
+            if ((msg.message == WM_POINTERDOWN || msg.message == WM_POINTERUPDATE || msg.message == WM_POINTERUP) &&
+                msg.hwnd == hwnd_dx && handle_touch(msg)) {
+                // handled here so it isn't turned into mouse messages too
+                continue;
+            }
+            if (msg.message == WM_LOG && msg.hwnd == hwnd_main) {
+                log_window_flush();
+                continue;
+            }
             if (msg.message == WM_COMMAND && msg.hwnd == hwnd_main) {
                 ensure_gpio_window((uint8_t)~msg.wParam);
                 // Serial.printf("selected %d\r\n",~msg.wParam);
@@ -843,7 +1875,29 @@ exit:
         DestroyWindow(hwnd_main);
     }
     if (app_thread != NULL) {
-        CloseHandle(app_thread);
+        // give loop() a chance to finish so the capture can be closed
+        SetEvent(quit_event);
+        if (WAIT_OBJECT_0 == WaitForSingleObject(app_thread, 250)) {
+            CloseHandle(app_thread);
+            app_thread = NULL;
+        }
+    }
+    if (app_thread == NULL) {
+        // otherwise loop() may still be using them
+        frame_capture.end();
+        inputs.end(app_iterations);
+        irq.end();
+        update_pool.end();
+        hardware_unload_all();
+    }
+    if (present_thread != NULL) {
+        // don't release DirectX out from under it
+        SetEvent(quit_event);
+        WaitForSingleObject(present_thread, INFINITE);
+        CloseHandle(present_thread);
+    }
+    if (present_event != NULL) {
+        CloseHandle(present_event);
     }
     if (quit_event != NULL) {
         CloseHandle(quit_event);
@@ -854,28 +1908,111 @@ exit:
     render_target->Release();
     render_bitmap->Release();
     d2d_factory->Release();
+    if (app_thread == NULL) {
+        free(framebuffer);
+        framebuffer = nullptr;
+    }
+    traces.end();
+    if (metrics_on_exit) {
+        metrics_dump(metrics_exit_path.data());
+    }
+    log_output.end();
+    log_file_output.end();
+    log_binary_output.end();
+    log_binary_file.end();
     CoUninitialize();
     
 }
+#else
+// there is no GPIO UI when headless
+// entry point
+int main(int argc, char* argv[]) {
+    // there is no log window, so log to stdout
+    hardware_log_to_stdout(true);
+    log_output.begin();
+    metrics_begin();
+    // get our uptime start
+    start_time = monotonic_ns();
+    // init GPIOs
+    for (size_t i = 0; i < 256; ++i) {
+        gpios[i].id = i;
+        gpios[i].mode = 0;  // not set yet (the bitsets start clear)
+        gpios[i].interrupt_mode = -1;
+        gpios[i].interrupt_cb = nullptr;
+        gpios[i].value(0);
+    }
+    // run winduino init code if present
+    configuring = true;
+    winduino();
+    configuring = false;
+    // allocate the display
+    framebuffer = (uint32_t*)calloc(
+        (size_t)winduino_screen_size.width * winduino_screen_size.height,
+        sizeof(uint32_t));
+    if (framebuffer == nullptr) {
+        return 1;
+    }
+    if (!frame_hashes.begin(winduino_screen_size.width, winduino_screen_size.height)) {
+        return 1;
+    }
+    // Ctrl+C or a kill from the build farm ends the run
+    signal(SIGINT, quit_signal_handler);
+    signal(SIGTERM, quit_signal_handler);
+    if (!irq.begin(run_isr, wall_ns, !virtual_clock)) {
+        return 1;
+    }
+    {
+        // this is the thread where loop() is run
+        std::thread app_thread(render_thread_proc);
+        app_thread.join();
+    }
+    frame_capture.end();
+    inputs.end(app_iterations);
+    irq.end();
+    update_pool.end();
+    hardware_unload_all();
+#if SOC_UART_NUM > 0
+    Serial.end();
+#endif
+#if SOC_UART_NUM > 1
+    Serial1.end();
+#endif
+#if SOC_UART_NUM > 2
+    Serial2.end();
+#endif
+#if SOC_UART_NUM > 3
+    Serial3.end();
+#endif
+    traces.end();
+    if (metrics_on_exit) {
+        metrics_dump(metrics_exit_path.data());
+    }
+    log_output.end();
+    log_file_output.end();
+    log_binary_output.end();
+    log_binary_file.end();
+    fflush(stdout);
+    free(framebuffer);
+    framebuffer = nullptr;
+    return 0;
+}
+#endif
 
 void pinMode(uint8_t pin, uint8_t mode) {
-    gpios[pin].mode = mode;
-    update_gpios();
+    gpios[pin].set_mode(mode);
 }
 void digitalWrite(uint8_t pin, uint8_t val) {
-    gpio_t& g = gpios[pin];
-    if (g.mode == OUTPUT || g.mode == OUTPUT_OPEN_DRAIN) {
-        g.value(val == LOW ? LOW : HIGH);
-        update_gpios();
+    const uint32_t bit = 1u << (pin & 31);
+    if (gpio_output[pin >> 5].load(std::memory_order_acquire) & bit) {
+        gpios[pin].value(val == LOW ? LOW : HIGH);
     }
 }
 int digitalRead(uint8_t pin) {
-    gpio_t& g = gpios[pin];
+    const uint32_t bit = 1u << (pin & 31);
     // can check state on output pins too
-    if (g.mode==OUTPUT || g.mode == OUTPUT_OPEN_DRAIN || g.mode == INPUT || g.mode == INPUT_PULLUP || g.mode == INPUT_PULLDOWN) {
-        return g.value() == LOW ? LOW : HIGH;
-    }
-    return LOW;
+    const uint32_t valid = gpio_output[pin >> 5].load(std::memory_order_acquire) |
+                           gpio_input[pin >> 5].load(std::memory_order_acquire);
+    return (gpio_level[pin >> 5].load(std::memory_order_acquire) & valid & bit) ? HIGH : LOW;
 }
 void analogWrite(uint8_t pin, int value) {
     if (value < 0) {
@@ -883,10 +2020,8 @@ void analogWrite(uint8_t pin, int value) {
     } else if (value > 255) {
         value = 255;
     }
-    gpio_t& g = gpios[pin];
-    if (g.mode == OUTPUT || g.mode == OUTPUT_OPEN_DRAIN) {
-        g.value((uint32_t)value);
-        update_gpios();
+    if (gpio_output[pin >> 5].load(std::memory_order_acquire) & (1u << (pin & 31))) {
+        gpios[pin].value((uint32_t)value);
     }
 }
 uint16_t analogRead(uint8_t pin) {
@@ -906,43 +2041,353 @@ void attachInterrupt(uint8_t pin, void (*cb)(void), int mode) {
     gpios[pin].interrupt_cb = cb;
 }
 void detachInterrupt(uint8_t pin) {
-    gpios[pin].mode = 0;
     gpios[pin].interrupt_mode = -1;
     gpios[pin].interrupt_cb = nullptr;
-    update_gpios();
+    gpios[pin].set_mode(0);
+}
+void noInterrupts() {
+    irq.mask();
+}
+void interrupts() {
+    irq.unmask();
+    if (virtual_clock && std::this_thread::get_id() == app_thread_id) {
+        irq.dispatch();
+    }
+}
+gpio_dev_t GPIO;
+uint32_t gpio_register_read(uint8_t port, gpio_register_id_t reg) {
+    if (port > 7) {
+        return 0;
+    }
+    switch (reg) {
+        case GPIO_REG_OUT:
+            return gpio_level[port].load(std::memory_order_acquire) &
+                   gpio_output[port].load(std::memory_order_acquire);
+        case GPIO_REG_ENABLE:
+            return gpio_output[port].load(std::memory_order_acquire);
+        case GPIO_REG_IN:
+            return gpio_level[port].load(std::memory_order_acquire);
+        default:
+            return 0;
+    }
+}
+// the pins of one device changed by a port write
+typedef struct pins_changed {
+    hardware_interface* hardware;
+    hardware_pins_changed_fn pins_changed;
+    uint64_t mask;
+    uint64_t values;
+} pins_changed_t;
+// drives the output pins in set high and those in clear low
+static void gpio_write_port(uint8_t port, uint32_t set, uint32_t clear) {
+    const uint32_t outputs = gpio_output[port].load(std::memory_order_acquire);
+    set &= outputs;
+    clear &= outputs & ~set;
+    // set and clear in one exchange, so other threads see the
+    // whole port change at once
+    uint32_t old = gpio_level[port].load(std::memory_order_relaxed);
+    while (!gpio_level[port].compare_exchange_weak(old, (old | set) & ~clear, std::memory_order_acq_rel,
+                                                   std::memory_order_relaxed)) {
+    }
+    // only the pins that actually changed need their
+    // plugins notified and interrupts fired
+    const uint32_t changed = (set & ~old) | (clear & old);
+    // devices that take batches get one call for the whole write
+    pins_changed_t batches[8];
+    size_t batch_count = 0;
+    for (uint32_t pending = changed; pending;) {
+        int bit = __builtin_ctz(pending);
+        pending &= pending - 1;
+        gpio_t& g = gpios[port * 32 + bit];
+        g.value((set >> bit) & 1 ? HIGH : LOW, true);
+        for (size_t i = 0; i < g.subscriber_count(); ++i) {
+            const hardware_subscriber_t& sub = g.subscriber(i);
+            if (sub.pins_changed == nullptr) {
+                sub.pin_change(sub.hardware, sub.pin, g.value());
+                continue;
+            }
+            size_t j = 0;
+            while (j < batch_count && batches[j].hardware != sub.hardware) {
+                ++j;
+            }
+            if (j == batch_count) {
+                if (batch_count == sizeof(batches) / sizeof(batches[0])) {
+                    // too many devices on one port to batch. Send this one now
+                    sub.pin_change(sub.hardware, sub.pin, g.value());
+                    continue;
+                }
+                batches[j].hardware = sub.hardware;
+                batches[j].pins_changed = sub.pins_changed;
+                batches[j].mask = 0;
+                batches[j].values = 0;
+                ++batch_count;
+            }
+            batches[j].mask |= 1ull << sub.pin;
+            if (g.value()) {
+                batches[j].values |= 1ull << sub.pin;
+            }
+        }
+    }
+    for (size_t i = 0; i < batch_count; ++i) {
+        batches[i].pins_changed(batches[i].hardware, batches[i].mask, batches[i].values);
+    }
+}
+void gpio_register_write(uint8_t port, gpio_register_id_t reg, uint32_t value) {
+    if (port > 7) {
+        return;
+    }
+    switch (reg) {
+        case GPIO_REG_OUT:
+            gpio_write_port(port, value, ~value);
+            break;
+        case GPIO_REG_OUT_W1TS:
+            gpio_write_port(port, value, 0);
+            break;
+        case GPIO_REG_OUT_W1TC:
+            gpio_write_port(port, 0, value);
+            break;
+        case GPIO_REG_ENABLE:
+        case GPIO_REG_ENABLE_W1TS:
+        case GPIO_REG_ENABLE_W1TC: {
+            uint32_t enable = gpio_output[port].load(std::memory_order_acquire);
+            if (reg == GPIO_REG_ENABLE) {
+                enable = value;
+            } else if (reg == GPIO_REG_ENABLE_W1TS) {
+                enable |= value;
+            } else {
+                enable &= ~value;
+            }
+            // enabling the output driver makes a pin an output,
+            // and disabling it leaves an input
+            uint32_t changed = enable ^ gpio_output[port].load(std::memory_order_acquire);
+            while (changed) {
+                int bit = __builtin_ctz(changed);
+                changed &= changed - 1;
+                gpios[port * 32 + bit].set_mode((enable >> bit) & 1 ? OUTPUT : INPUT);
+            }
+        } break;
+        default:
+            break;
+    }
+}
+// fills in the rest of a newly created device and adds it to the list.
+// dispatch is null for plugins, whose methods are looked up instead
+static void hardware_add(hardware_dev_t* dev, const hardware_dispatch_t* dispatch) {
+    hardware_interface* hw = dev->hardware;
+    uint32_t caps = 0;
+    if (hw->CanConfigure()) caps |= HARDWARE_CAP_CONFIGURE;
+    if (hw->CanConnect()) caps |= HARDWARE_CAP_CONNECT;
+    if (hw->CanUpdate()) caps |= HARDWARE_CAP_UPDATE;
+    if (hw->CanPinChange()) caps |= HARDWARE_CAP_PIN_CHANGE;
+    if (hw->CanTransferBitsSPI()) caps |= HARDWARE_CAP_SPI;
+    if (hw->CanTransferBytesI2C()) caps |= HARDWARE_CAP_I2C;
+    if (hw->CanAttachLog()) caps |= HARDWARE_CAP_LOG;
+    if (dev->version >= 2 && ((hardware_interface_v2*)hw)->CanPinsChanged()) {
+        caps |= HARDWARE_CAP_PINS_CHANGED;
+    }
+    if (dev->version >= 3 && ((hardware_interface_v3*)hw)->CanUpdateScheduled()) {
+        caps |= HARDWARE_CAP_UPDATE_SCHEDULED;
+    }
+    if (dev->version >= 4) {
+        if (((hardware_interface_v4*)hw)->CanTransferSegmentsSPI()) {
+            caps |= HARDWARE_CAP_SPI_SEGMENTS;
+        }
+        if (((hardware_interface_v4*)hw)->CanTransferSegmentsI2C()) {
+            caps |= HARDWARE_CAP_I2C_SEGMENTS;
+        }
+    }
+    dev->caps = caps;
+    hardware_dispatch_t& d = dev->dispatch;
+    if (dispatch != nullptr) {
+        // compiled in devices have every entry. The rest of
+        // the runtime only checks for null
+        d = *dispatch;
+        if (!(caps & HARDWARE_CAP_PIN_CHANGE)) d.pin_change = nullptr;
+        if (!(caps & HARDWARE_CAP_PINS_CHANGED)) d.pins_changed = nullptr;
+        if (!(caps & HARDWARE_CAP_SPI)) d.transfer_bits_spi = nullptr;
+        if (!(caps & HARDWARE_CAP_I2C)) d.transfer_bytes_i2c = nullptr;
+        if (!(caps & HARDWARE_CAP_SPI_SEGMENTS)) d.transfer_segments_spi = nullptr;
+        if (!(caps & HARDWARE_CAP_I2C_SEGMENTS)) d.transfer_segments_i2c = nullptr;
+    } else {
+        // only look up what the plugin's version and capabilities
+        // say are there, so we never read past the end of its vtable
+        d.pin_change = (caps & HARDWARE_CAP_PIN_CHANGE) ? 
+            (hardware_pin_change_fn)hardware_method(hw, HARDWARE_SLOT_PIN_CHANGE) : nullptr;
+        d.pins_changed = (caps & HARDWARE_CAP_PINS_CHANGED) ? 
+            (hardware_pins_changed_fn)hardware_method(hw, HARDWARE_SLOT_PINS_CHANGED) : nullptr;
+        d.transfer_bits_spi = (caps & HARDWARE_CAP_SPI) ? 
+            (hardware_spi_transfer_fn)hardware_method(hw, HARDWARE_SLOT_TRANSFER_BITS_SPI) : nullptr;
+        d.transfer_bytes_i2c = (caps & HARDWARE_CAP_I2C) ? 
+            (hardware_i2c_transfer_fn)hardware_method(hw, HARDWARE_SLOT_TRANSFER_BYTES_I2C) : nullptr;
+        d.transfer_segments_spi = (caps & HARDWARE_CAP_SPI_SEGMENTS) ? 
+            (hardware_segments_fn)hardware_method(hw, HARDWARE_SLOT_TRANSFER_SEGMENTS_SPI) : nullptr;
+        d.transfer_segments_i2c = (caps & HARDWARE_CAP_I2C_SEGMENTS) ? 
+            (hardware_segments_fn)hardware_method(hw, HARDWARE_SLOT_TRANSFER_SEGMENTS_I2C) : nullptr;
+    }
+    dev->update_period_us = 0;
+    dev->parallel = false;
+    dev->wheel_next = nullptr;
+    dev->wheel_deadline = 0;
+    dev->update_next = 0;
+    dev->update_count = 0;
+    dev->update_last_ns = 0;
+    dev->update_max_ns = 0;
+    dev->update_total_ns = 0;
+    dev->next = nullptr;
+    if (hardware_tail == nullptr) {
+        hardware_head = dev;
+    } else {
+        hardware_tail->next = dev;
+    }
+    hardware_tail = dev;
+}
+#ifdef _WIN32
+static HMODULE hardware_module_open(const char* name) {
+    return LoadLibraryA(name);
+}
+static void* hardware_module_symbol(HMODULE module, const char* symbol) {
+    return (void*)GetProcAddress(module, symbol);
+}
+static void hardware_module_close(HMODULE module) {
+    FreeLibrary(module);
+}
+#else
+static void* hardware_module_open(const char* name) {
+    void* result = dlopen(name, RTLD_NOW | RTLD_LOCAL);
+    if (result == nullptr && strchr(name, '/') == nullptr) {
+        // LoadLibrary looks next to the app first, and dlopen
+        // doesn't look in the working directory at all
+        char path[1024];
+        snprintf(path, sizeof(path), "./%s", name);
+        result = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    }
+    return result;
+}
+static void* hardware_module_symbol(void* module, const char* symbol) {
+    return dlsym(module, symbol);
+}
+static void hardware_module_close(void* module) {
+    dlclose(module);
+}
+#endif
+// plugins export the same entry points on every platform: a DLL on
+// Windows, or a shared object on POSIX
+// devices compiled into the app. Filled in by static constructors,
+// so this has to be constant initialized
+static hardware_registration_t* hardware_registry = nullptr;
+hardware_registration::hardware_registration(const char* name, hardware_interface* (*create)(), const hardware_dispatch_t* dispatch)
+    : name(name), create(create), dispatch(dispatch), next(hardware_registry) {
+    hardware_registry = this;
 }
-// note that this effective "leaks" since there's no way to free
-// it doesn't matter, because hardware cannot be reloaded or
-// unloaded for the life of the process
 void* hardware_load(const char* name) {
-    HMODULE h = LoadLibraryA(name);
-    if (h == NULL) {
+    if (name == nullptr) {
         return nullptr;
     }
-    hardware_dev_t* result = new hardware_dev_t();
-    if (result == nullptr) {
+    for (hardware_registration_t* reg = hardware_registry; reg != nullptr; reg = reg->next) {
+        if (0 == strcmp(reg->name, name)) {
+            hardware_dev_t* result = new hardware_dev_t();
+            result->hmodule = nullptr;
+            result->hardware = reg->create();
+            if (result->hardware == nullptr) {
+                delete result;
+                return nullptr;
+            }
+            result->version = HARDWARE_INTERFACE_VERSION;
+            hardware_add(result, reg->dispatch);
+            return result;
+        }
+    }
+    auto h = hardware_module_open(name);
+    if (h == NULL) {
         return nullptr;
     }
+    hardware_dev_t* result = new hardware_dev_t();
     result->next = nullptr;
     result->hmodule = h;
-    
-    hardware_create_fn create= (hardware_create_fn)GetProcAddress(h, "CreateHardware");
-    if(create==NULL || 0!=create(&result->hardware) || result->hardware==NULL) {
-        return nullptr;
-    }
-    if (hardware_head == nullptr) {
-        hardware_head = result;
+    result->hardware = nullptr;
+    hardware_create_ex_fn create_ex = (hardware_create_ex_fn)hardware_module_symbol(h, "CreateHardwareEx");
+    if (create_ex != NULL) {
+        result->version = 0;
+        if (0 != create_ex(HARDWARE_INTERFACE_VERSION, &result->version, &result->hardware) || result->hardware == NULL ||
+            result->version < 1 || result->version > HARDWARE_INTERFACE_VERSION) {
+            goto error;
+        }
     } else {
-        hardware_dev_t* p = hardware_head;
-        while (p != nullptr) {
-            if (p->next == nullptr) {
-                p->next = result;
-                break;
-            }
-            p = p->next;
+        // plugins from before versioning implement version 1
+        hardware_create_fn create= (hardware_create_fn)hardware_module_symbol(h, "CreateHardware");
+        if(create==NULL || 0!=create(&result->hardware) || result->hardware==NULL) {
+            goto error;
         }
+        result->version = 1;
     }
+    hardware_add(result, nullptr);
     return result;
+error:
+    if (result->hardware != nullptr) {
+        result->hardware->Destroy();
+    }
+    hardware_module_close(h);
+    delete result;
+    return nullptr;
+}
+// takes a device off everything it's attached to, destroys it and
+// releases its module
+static void hardware_remove(hardware_dev_t* dev) {
+    for (int i = 0; i < 256; ++i) {
+        gpios[i].disconnect(dev);
+    }
+    for (int i = 0; i < SPI_PORT_MAX; ++i) {
+        hardware_spi_port_t& p = spi_ports[i];
+        size_t count = 0;
+        for (size_t j = 0; j < p.count; ++j) {
+            if (p.targets[j].hardware != dev->hardware) {
+                p.targets[count++] = p.targets[j];
+            }
+        }
+        p.count = count;
+    }
+    for (int i = 0; i < I2C_PORT_MAX; ++i) {
+        hardware_i2c_port_t& p = i2c_ports[i];
+        size_t count = 0;
+        for (size_t j = 0; j < p.count; ++j) {
+            if (p.targets[j].hardware != dev->hardware) {
+                p.targets[count++] = p.targets[j];
+            }
+        }
+        p.count = count;
+    }
+    hardware_dev_t* prev = nullptr;
+    for (hardware_dev_t* hw = hardware_head; hw != nullptr; prev = hw, hw = hw->next) {
+        if (hw == dev) {
+            if (prev == nullptr) {
+                hardware_head = hw->next;
+            } else {
+                prev->next = hw->next;
+            }
+            if (hardware_tail == hw) {
+                hardware_tail = prev;
+            }
+            break;
+        }
+    }
+    dev->hardware->Destroy();
+    if (dev->hmodule != nullptr) {
+        hardware_module_close(dev->hmodule);
+    }
+    delete dev;
+}
+// called on the way out, once loop() can no longer run
+static void hardware_unload_all() {
+    while (hardware_head != nullptr) {
+        hardware_remove(hardware_head);
+    }
+}
+bool hardware_unload(hw_handle_t hw) {
+    if (!configuring || hw == nullptr) {
+        return false;
+    }
+    hardware_remove((hardware_dev_t*)hw);
+    return true;
 }
 bool hardware_set_pin(hw_handle_t hw, uint8_t mcu_pin, uint8_t hw_pin) {
     if (hw == nullptr) {
@@ -957,7 +2402,7 @@ bool hardware_configure(hw_handle_t hw, int prop, void* data, size_t size) {
     }
     hardware_dev_t* h = (hardware_dev_t*)hw;
 
-    if (!h->hardware->CanConfigure()) { 
+    if (!(h->caps & HARDWARE_CAP_CONFIGURE)) { 
         return false;
     }
     return 0 == h->hardware->Configure(prop, data, size);
@@ -966,26 +2411,182 @@ bool hardware_transfer_bits_spi(uint8_t port,uint8_t* data, size_t size_bits) {
     if(port>=SPI_PORT_MAX) {
         return false;
     }
-    hardware_spi_list_t* current = spi_devices[port];
-    while(current!=nullptr) {
-        if(current->handle->hardware->CanTransferBitsSPI()) {
-            current->handle->hardware->TransferBitsSPI(data,size_bits);
-        }
-        current=current->next;
+    TRACE_SCOPE_VALUE("bus", "spi", size_bits);
+    const hardware_spi_port_t& p = spi_ports[port];
+    p.bits->add(size_bits);
+    for (size_t i = 0; i < p.count; ++i) {
+        p.targets[i].transfer(p.targets[i].hardware, data, size_bits);
     }
-    
     return true;
 }
 bool hardware_transfer_bytes_i2c(uint8_t port,const uint8_t* in, size_t in_size, uint8_t* out, size_t* in_out_out_size) {
     if(port>=I2C_PORT_MAX) {
         return false;
     }
-    hardware_i2c_list_t* current = i2c_devices[port];
-    while(current!=nullptr) {
-        if(current->handle->hardware->CanTransferBytesI2C()) {
-            current->handle->hardware->TransferBytesI2C(in,in_size,out,in_out_out_size);
+    TRACE_SCOPE_VALUE("bus", "i2c", in_size);
+    const hardware_i2c_port_t& p = i2c_ports[port];
+    p.transactions->add(1);
+    for (size_t i = 0; i < p.count; ++i) {
+        p.targets[i].transfer(p.targets[i].hardware, in, in_size, out, in_out_out_size);
+    }
+    return true;
+}
+// where a segment's data goes for devices that only transfer in
+// place. Send-only segments are copied so the caller's data survives
+static uint8_t* segment_buffer(const hardware_transfer_segment_t& seg, std::vector<uint8_t>& scratch) {
+    const size_t size = (seg.size_bits + 7) / 8;
+    if (seg.rx != nullptr) {
+        if (seg.data != nullptr && (seg.flags & HARDWARE_SEGMENT_TX)) {
+            memcpy(seg.rx, seg.data, size);
+        } else {
+            memset(seg.rx, 0, size);
+        }
+        return seg.rx;
+    }
+    if ((seg.flags & HARDWARE_SEGMENT_RX) && seg.data != nullptr) {
+        return seg.data;
+    }
+    scratch.resize(size);
+    if (seg.data != nullptr && (seg.flags & HARDWARE_SEGMENT_TX)) {
+        memcpy(scratch.data(), seg.data, size);
+    } else {
+        memset(scratch.data(), 0, size);
+    }
+    return scratch.data();
+}
+bool hardware_transfer_segments_spi(uint8_t port, hardware_transfer_segment_t* segments, size_t count, int16_t cs_pin, int16_t dc_pin) {
+    if (port >= SPI_PORT_MAX || (segments == nullptr && count != 0)) {
+        return false;
+    }
+    const hardware_spi_port_t& p = spi_ports[port];
+    size_t bits = 0;
+    for (size_t i = 0; i < count; ++i) {
+        bits += segments[i].size_bits;
+    }
+    p.bits->add(bits);
+    TRACE_SCOPE_VALUE("bus", "spi", bits);
+    size_t legacy = 0;
+    for (size_t i = 0; i < p.count; ++i) {
+        if (p.targets[i].transfer_segments == nullptr) {
+            ++legacy;
+        }
+    }
+    // the transaction starts here for every device, whichever way it gets the data
+    if (cs_pin > -1 && count != 0) {
+        digitalWrite(cs_pin, LOW);
+    }
+    if (dc_pin > -1 && count != 0) {
+        digitalWrite(dc_pin, (segments[0].flags & HARDWARE_SEGMENT_DC) ? HIGH : LOW);
+    }
+    // on a mixed bus, the older devices must see what was sent rather than
+    // what the newer ones received in its place, so keep a copy
+    const bool mixed = legacy != 0 && legacy != p.count;
+    static thread_local std::vector<uint8_t> sent;
+    if (mixed) {
+        sent.clear();
+        for (size_t i = 0; i < count; ++i) {
+            const hardware_transfer_segment_t& seg = segments[i];
+            const size_t size = (seg.size_bits + 7) / 8;
+            if (seg.data != nullptr && (seg.flags & HARDWARE_SEGMENT_TX)) {
+                sent.insert(sent.end(), seg.data, seg.data + size);
+            } else {
+                sent.insert(sent.end(), size, 0);
+            }
+        }
+    }
+    for (size_t i = 0; i < p.count; ++i) {
+        if (p.targets[i].transfer_segments != nullptr) {
+            p.targets[i].transfer_segments(p.targets[i].hardware, segments, count);
+        }
+    }
+    if (legacy != 0) {
+        // older devices see the lines move between segments
+        static thread_local std::vector<uint8_t> scratch;
+        size_t offset = 0;
+        for (size_t i = 0; i < count; ++i) {
+            const hardware_transfer_segment_t& seg = segments[i];
+            const size_t size = (seg.size_bits + 7) / 8;
+            if (cs_pin > -1) {
+                digitalWrite(cs_pin, (seg.flags & HARDWARE_SEGMENT_CS) ? LOW : HIGH);
+            }
+            if (dc_pin > -1) {
+                digitalWrite(dc_pin, (seg.flags & HARDWARE_SEGMENT_DC) ? HIGH : LOW);
+            }
+            uint8_t* buffer;
+            if (mixed) {
+                scratch.assign(sent.begin() + offset, sent.begin() + offset + size);
+                buffer = scratch.data();
+            } else {
+                buffer = segment_buffer(seg, scratch);
+            }
+            for (size_t j = 0; j < p.count; ++j) {
+                if (p.targets[j].transfer_segments == nullptr) {
+                    p.targets[j].transfer(p.targets[j].hardware, buffer, seg.size_bits);
+                }
+            }
+            uint8_t* rx = seg.rx;
+            if (rx == nullptr && (seg.flags & HARDWARE_SEGMENT_RX)) {
+                rx = seg.data;
+            }
+            if (mixed && rx != nullptr) {
+                // the newer devices have filled rx in already. Add in
+                // whatever the older ones drove, as a shared MISO line would
+                for (size_t k = 0; k < size; ++k) {
+                    if (buffer[k] != sent[offset + k]) {
+                        rx[k] |= buffer[k];
+                    }
+                }
+            }
+            offset += size;
+        }
+    } else if (dc_pin > -1 && count != 0) {
+        digitalWrite(dc_pin, (segments[count - 1].flags & HARDWARE_SEGMENT_DC) ? HIGH : LOW);
+    }
+    if (cs_pin > -1) {
+        digitalWrite(cs_pin, HIGH);
+    }
+    return true;
+}
+bool hardware_transfer_segments_i2c(uint8_t port, hardware_transfer_segment_t* segments, size_t count) {
+    if (port >= I2C_PORT_MAX || (segments == nullptr && count != 0)) {
+        return false;
+    }
+    TRACE_SCOPE_VALUE("bus", "i2c", count);
+    const hardware_i2c_port_t& p = i2c_ports[port];
+    p.transactions->add(1);
+    static thread_local std::vector<uint8_t> scratch;
+    for (size_t i = 0; i < p.count; ++i) {
+        const hardware_i2c_target_t& t = p.targets[i];
+        if (t.transfer_segments != nullptr) {
+            t.transfer_segments(t.hardware, segments, count);
+            continue;
+        }
+        // older devices take a write, optionally followed by a read, per call
+        for (size_t j = 0; j < count; ++j) {
+            const hardware_transfer_segment_t& seg = segments[j];
+            const uint8_t* in = nullptr;
+            size_t in_size = 0;
+            if (seg.flags & HARDWARE_SEGMENT_TX) {
+                in = seg.data;
+                in_size = seg.size_bits / 8;
+                if (j + 1 == count || !(segments[j + 1].flags & HARDWARE_SEGMENT_RX) || 
+                    (segments[j + 1].flags & HARDWARE_SEGMENT_TX)) {
+                    uint8_t dummy;
+                    size_t out_size = 0;
+                    t.transfer(t.hardware, in, in_size, &dummy, &out_size);
+                    continue;
+                }
+                ++j;
+            }
+            const hardware_transfer_segment_t& read = segments[j];
+            uint8_t* out = read.rx != nullptr ? read.rx : read.data;
+            size_t out_size = read.size_bits / 8;
+            if (out == nullptr) {
+                scratch.resize(out_size);
+                out = scratch.data();
+            }
+            t.transfer(t.hardware, in, in_size, out, &out_size);
         }
-        current=current->next;
     }
     return true;
 }
@@ -998,7 +2599,7 @@ bool hardware_attach_log(void* hw,const char* prefix, uint8_t level) {
         return false;
     }
     hardware_dev_t* h = (hardware_dev_t*)hw;
-    if(h->hardware->CanAttachLog()) {
+    if(h->caps & HARDWARE_CAP_LOG) {
         h->hardware->AttachLog(logger_log,prefix,level);
     }
     return true;
@@ -1009,24 +2610,20 @@ bool hardware_attach_spi(hw_handle_t hw, uint8_t port) {
         return false;
     }
     hardware_dev_t* h = (hardware_dev_t*)hw;
-    if(!h->hardware->CanTransferBitsSPI()) {
+    if(!(h->caps & HARDWARE_CAP_SPI)) {
         return false;
     }
-    hardware_spi_list_t* result = new hardware_spi_list_t();
-    result->handle = h;
-    result->next = nullptr;
-    if (spi_devices[port] == nullptr) {
-        spi_devices[port] = result;
-    } else {
-        hardware_spi_list_t* p = spi_devices[port];
-        while (p != nullptr) {
-            if (p->next == nullptr) {
-                p->next = result;
-                break;
-            }
-            p = p->next;
-        }
+    hardware_spi_port_t& p = spi_ports[port];
+    hardware_spi_target_t* targets = (hardware_spi_target_t*)realloc(
+        p.targets, (p.count + 1) * sizeof(hardware_spi_target_t));
+    if (targets == nullptr) {
+        return false;
     }
+    targets[p.count].hardware = h->hardware;
+    targets[p.count].transfer = h->dispatch.transfer_bits_spi;
+    targets[p.count].transfer_segments = h->dispatch.transfer_segments_spi;
+    p.targets = targets;
+    ++p.count;
     return true;
 }
 bool hardware_attach_i2c(hw_handle_t hw, uint8_t port) {
@@ -1035,24 +2632,20 @@ bool hardware_attach_i2c(hw_handle_t hw, uint8_t port) {
         return false;
     }
     hardware_dev_t* h = (hardware_dev_t*)hw;
-    if(!h->hardware->CanTransferBytesI2C()) {
+    if(!(h->caps & HARDWARE_CAP_I2C)) {
         return false;
     }
-    hardware_i2c_list_t* result = new hardware_i2c_list_t();
-    result->handle = h;
-    result->next = nullptr;
-    if (i2c_devices[port] == nullptr) {
-        i2c_devices[port] = result;
-    } else {
-        hardware_i2c_list_t* p = i2c_devices[port];
-        while (p != nullptr) {
-            if (p->next == nullptr) {
-                p->next = result;
-                break;
-            }
-            p = p->next;
-        }
+    hardware_i2c_port_t& p = i2c_ports[port];
+    hardware_i2c_target_t* targets = (hardware_i2c_target_t*)realloc(
+        p.targets, (p.count + 1) * sizeof(hardware_i2c_target_t));
+    if (targets == nullptr) {
+        return false;
     }
+    targets[p.count].hardware = h->hardware;
+    targets[p.count].transfer = h->dispatch.transfer_bytes_i2c;
+    targets[p.count].transfer_segments = h->dispatch.transfer_segments_i2c;
+    p.targets = targets;
+    ++p.count;
     return true;
 }
 bool hardware_attach_serial(uint8_t uart_no,uint16_t com_port_no) {
@@ -1079,8 +2672,273 @@ bool hardware_get_attached_serial(uint8_t uart_no,uint16_t* out_com_port_no) {
     *out_com_port_no = uart_com_ports[uart_no];
     return true;
 }
+bool hardware_set_virtual_clock(bool enabled, uint32_t idle_step_us) {
+    if (!configuring) {
+        return false;
+    }
+    virtual_clock = enabled;
+    virtual_idle_step_us = idle_step_us;
+    return true;
+}
+bool hardware_set_clock_offset(uint64_t offset_us) {
+    if (!configuring) {
+        return false;
+    }
+    clock_offset_us = offset_us;
+    return true;
+}
+bool hardware_get_delay_stats(hardware_delay_stats_t* out_stats) {
+    if (out_stats == nullptr) {
+        return false;
+    }
+    *out_stats = delay_stats;
+    return true;
+}
+bool hardware_schedule(uint32_t delay_us, void (*callback)(void* state), void* state) {
+    if (callback == nullptr) {
+        return false;
+    }
+    schedule_at(clock_us() + delay_us, callback, state);
+    return true;
+}
+uint64_t hardware_hash_region(int x, int y, int w, int h) {
+    if (w == 0 && h == 0) {
+        w = winduino_screen_size.width;
+        h = winduino_screen_size.height;
+    }
+    return frame_hashes.hash(framebuffer, x, y, w, h);
+}
+bool hardware_load_hash_manifest(const char* path, bool record) {
+    return frame_manifest.load(path, record);
+}
+bool hardware_save_hash_manifest(const char* path) {
+    return frame_manifest.save(path);
+}
+bool hardware_assert_hash(const char* name, int x, int y, int w, int h) {
+    if (name == nullptr || framebuffer == nullptr) {
+        return false;
+    }
+    if (w == 0 && h == 0) {
+        w = winduino_screen_size.width;
+        h = winduino_screen_size.height;
+    }
+    uint64_t hash = frame_hashes.hash(framebuffer, x, y, w, h);
+    uint64_t expected;
+    if (!frame_manifest.check(name, x, y, w, h, hash, &expected)) {
+        char msg[256];
+        snprintf(msg, sizeof(msg), "hash mismatch for %s (%d, %d, %d, %d): expected %016llx, got %016llx\r\n",
+                 name, x, y, w, h, (unsigned long long)expected, (unsigned long long)hash);
+        log_print(msg);
+        return false;
+    }
+    return true;
+}
+bool hardware_start_capture(const char* path) {
+    if (framebuffer == nullptr) {
+        return false;
+    }
+    return frame_capture.begin(path, winduino_screen_size.width, winduino_screen_size.height);
+}
+bool hardware_stop_capture() {
+    if (!frame_capture.running()) {
+        return false;
+    }
+    frame_capture.end();
+    return true;
+}
+bool hardware_log_to_stdout(bool enabled) {
+    if (enabled == log_to_stdout) {
+        return true;
+    }
+    if (enabled ? !log_output.add_sink(log_stdout_sink, nullptr) : !log_output.remove_sink(log_stdout_sink, nullptr)) {
+        return false;
+    }
+    log_to_stdout = enabled;
+    return true;
+}
+bool hardware_log_to_file(const char* path, uint32_t max_size, uint8_t max_files) {
+    if (log_file_output.running()) {
+        log_output.remove_sink(log_file::sink, &log_file_output);
+        log_file_output.end();
+    }
+    if (path == nullptr) {
+        return true;
+    }
+    if (!log_file_output.begin(path, max_size, max_files)) {
+        return false;
+    }
+    return log_output.add_sink(log_file::sink, &log_file_output);
+}
+bool hardware_add_log_sink(hardware_log_sink_fn sink, void* state) {
+    return log_output.add_sink(sink, state);
+}
+bool hardware_remove_log_sink(hardware_log_sink_fn sink, void* state) {
+    return log_output.remove_sink(sink, state);
+}
+bool hardware_log_binary(const char* path) {
+    if (!configuring || log_binary) {
+        return false;
+    }
+    if (!log_binary_file.begin(path, SIZE_MAX, 0)) {
+        return false;
+    }
+    std::vector<uint8_t> header;
+    log_encode_header(header);
+    log_binary_output.write((const char*)header.data(), header.size());
+    log_binary_output.add_sink(log_file::sink, &log_binary_file);
+    log_binary_output.begin();
+    log_binary = true;
+    return true;
+}
+hw_counter_t hardware_counter(const char* name) {
+    return (hw_counter_t)metrics.counter(name);
+}
+void hardware_counter_add(hw_counter_t counter, uint64_t value) {
+    if (counter != nullptr) {
+        ((metric_counter*)counter)->add(value);
+    }
+}
+hw_histogram_t hardware_histogram(const char* name) {
+    return (hw_histogram_t)metrics.histogram(name);
+}
+void hardware_histogram_record(hw_histogram_t histogram, uint64_t value) {
+    if (histogram != nullptr) {
+        ((metric_histogram*)histogram)->record(value);
+    }
+}
+bool hardware_get_metric(const char* name, hardware_metric_t* out_metric) {
+    if (name == nullptr || out_metric == nullptr) {
+        return false;
+    }
+    void* found;
+    const int kind = metrics.find(name, &found);
+    if (kind == METRIC_COUNTER) {
+        const uint64_t value = ((metric_counter*)found)->value();
+        out_metric->kind = HARDWARE_METRIC_COUNTER;
+        out_metric->count = value;
+        out_metric->sum = value;
+        out_metric->min = out_metric->max = 0;
+        out_metric->p50 = out_metric->p90 = out_metric->p99 = out_metric->p999 = 0;
+        return true;
+    }
+    if (kind == METRIC_HISTOGRAM) {
+        const metric_histogram& h = *(metric_histogram*)found;
+        out_metric->kind = HARDWARE_METRIC_HISTOGRAM;
+        out_metric->count = h.count();
+        out_metric->sum = h.sum();
+        out_metric->min = h.min();
+        out_metric->max = h.max();
+        out_metric->p50 = h.percentile(.5);
+        out_metric->p90 = h.percentile(.9);
+        out_metric->p99 = h.percentile(.99);
+        out_metric->p999 = h.percentile(.999);
+        return true;
+    }
+    return false;
+}
+bool hardware_dump_metrics(const char* path) {
+    return metrics_dump(path);
+}
+bool hardware_dump_metrics_on_exit(const char* path) {
+    metrics_exit_path.clear();
+    if (path != nullptr) {
+        metrics_exit_path.insert(metrics_exit_path.end(), path, path + strlen(path));
+    }
+    metrics_exit_path.push_back(0);
+    metrics_on_exit = true;
+    return true;
+}
+bool hardware_start_trace(const char* path) {
+#if WINDUINO_TRACE
+    return traces.begin(path, wall_ns);
+#else
+    return false;
+#endif
+}
+bool hardware_stop_trace() {
+    return traces.end();
+}
+void hardware_reset_metrics() {
+    metrics.reset();
+    metrics_start_us = wall_ns() / 1000;
+}
+bool hardware_get_log_stats(hardware_log_stats_t* out_stats) {
+    if (out_stats == nullptr) {
+        return false;
+    }
+    log_output.stats(&out_stats->written, &out_stats->dropped, &out_stats->dropped_writes);
+    return true;
+}
+bool hardware_record_inputs(const char* path, uint32_t seed) {
+    if (!configuring) {
+        return false;
+    }
+    if (!inputs.record(path, seed)) {
+        return false;
+    }
+    srand(seed);
+    return true;
+}
+bool hardware_replay_inputs(const char* path) {
+    if (!configuring) {
+        return false;
+    }
+    uint32_t seed;
+    if (!inputs.replay(path, &seed)) {
+        return false;
+    }
+    srand(seed);
+    return true;
+}
+bool hardware_set_interrupt_priority(uint8_t pin, uint8_t priority) {
+    return irq.priority(pin, priority);
+}
+bool hardware_get_interrupt_stats(int16_t pin, hardware_interrupt_stats_t* out_stats) {
+    if (out_stats == nullptr || pin > 255) {
+        return false;
+    }
+    memset(out_stats, 0, sizeof(hardware_interrupt_stats_t));
+    uint64_t total_latency = 0;
+    for (int i = pin < 0 ? 0 : pin; i <= (pin < 0 ? 255 : pin); ++i) {
+        irq.stats((uint8_t)i, &out_stats->count, &out_stats->dropped, &out_stats->max_latency_ns, &total_latency, out_stats->histogram);
+    }
+    if (out_stats->count) {
+        out_stats->avg_latency_ns = (uint32_t)(total_latency / out_stats->count);
+    }
+    return true;
+}
+bool hardware_set_update_period(hw_handle_t hw, uint32_t period_us) {
+    if (!configuring || hw == nullptr) {
+        return false;
+    }
+    ((hardware_dev_t*)hw)->update_period_us = period_us;
+    return true;
+}
+bool hardware_set_parallel_update(hw_handle_t hw, bool parallel) {
+    if (!configuring || hw == nullptr) {
+        return false;
+    }
+    ((hardware_dev_t*)hw)->parallel = parallel;
+    return true;
+}
+bool hardware_get_update_stats(hw_handle_t hw, hardware_update_stats_t* out_stats) {
+    if (hw == nullptr || out_stats == nullptr) {
+        return false;
+    }
+    const hardware_dev_t* h = (const hardware_dev_t*)hw;
+    out_stats->count = h->update_count;
+    out_stats->last_ns = h->update_last_ns;
+    out_stats->max_ns = h->update_max_ns;
+    out_stats->avg_ns = h->update_count ? (uint32_t)(h->update_total_ns / h->update_count) : 0;
+    out_stats->total_ns = h->update_total_ns;
+    return true;
+}
 bool hardware_set_screen_size(uint16_t width, uint16_t height) {
+#ifdef _WIN32
     if(hwnd_main==NULL && width!=0 && height!=0) {
+#else
+    if(framebuffer==nullptr && width!=0 && height!=0) {
+#endif
         winduino_screen_size.width = width;
         winduino_screen_size.height = height;
         return true;
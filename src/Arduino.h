@@ -11,6 +11,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <inttypes.h>
+#include "esp32-hal-log.h"
 #ifndef I2C_PORT_MAX
 #define I2C_PORT_MAX 4
 #endif
@@ -69,8 +70,10 @@
 #define degrees(rad) ((rad)*RAD_TO_DEG)
 #define sq(x) ((x)*(x))
 
-#define interrupts() 
-#define noInterrupts() 
+/// @brief Lets pending and new interrupts run again
+void interrupts();
+/// @brief Holds back interrupts until interrupts() is called. If an ISR is running, this waits for it to finish
+void noInterrupts();
 
 #define digitalPinToGPIONumber(digitalPin) (digitalPin)
 #define gpioNumberToDigitalPin(gpioNumber) (gpioNumber)
@@ -140,10 +143,106 @@ static const uint8_t D8 = 9;
 static const uint8_t D9 = 10;
 static const uint8_t D10 = 11;
 typedef void* hw_handle_t;
+#ifndef _WIN32
+// the plugin calling convention only means something on Windows
+#ifndef __cdecl
+#define __cdecl
+#endif
+#endif
 // useful for libs like LVGL that can't use DirectX native format
 // #define USE_RGB
 
 typedef __cdecl void(*hardware_log_callback)(const char* text);
+typedef struct {
+    // the number of ISRs run
+    uint32_t count;
+    // edges lost because too many were waiting
+    uint32_t dropped;
+    // from the edge to the start of its ISR
+    uint32_t max_latency_ns;
+    uint32_t avg_latency_ns;
+    // histogram[i] counts latencies from 2^i ns up to 2^(i+1) ns
+    uint32_t histogram[32];
+} hardware_interrupt_stats_t;
+typedef struct {
+    // the number of updates
+    uint32_t count;
+    // the time spent in each update
+    uint32_t last_ns;
+    uint32_t max_ns;
+    uint32_t avg_ns;
+    uint64_t total_ns;
+} hardware_update_stats_t;
+typedef struct {
+    // the bytes accepted for logging
+    uint64_t written;
+    // the bytes lost because the log thread fell behind
+    uint64_t dropped;
+    // the writes those bytes came from
+    uint64_t dropped_writes;
+} hardware_log_stats_t;
+// hardware_metric_t kinds
+#define HARDWARE_METRIC_COUNTER 0
+#define HARDWARE_METRIC_HISTOGRAM 1
+typedef struct hw_counter* hw_counter_t;
+typedef struct hw_histogram* hw_histogram_t;
+typedef struct {
+    // HARDWARE_METRIC_XXXX
+    uint8_t kind;
+    // the values recorded, or a counter's value
+    uint64_t count;
+    // the total of the values, or a counter's value
+    uint64_t sum;
+    // the rest are for histograms. Percentiles are within about 6%
+    uint64_t min;
+    uint64_t max;
+    uint64_t p50;
+    uint64_t p90;
+    uint64_t p99;
+    uint64_t p999;
+} hardware_metric_t;
+// receives log output on the log thread, in batches that don't necessarily end on a line
+typedef void (*hardware_log_sink_fn)(const char* text, size_t size, void* state);
+// hardware_transfer_segment_t flags
+#define HARDWARE_SEGMENT_TX 1
+#define HARDWARE_SEGMENT_RX 2
+// chip select is asserted (low) for the segment
+#define HARDWARE_SEGMENT_CS 4
+// the data/command line is high (data) for the segment
+#define HARDWARE_SEGMENT_DC 8
+// one piece of a bus transfer, such as a command, its parameters, or a pixel burst
+typedef struct {
+    // HARDWARE_SEGMENT_XXXX flags
+    uint32_t flags;
+    // the data to send. If it's also receiving and rx is null, the received data replaces it. Otherwise it isn't modified
+    uint8_t* data;
+    // optional separate buffer for received data
+    uint8_t* rx;
+    // the length in bits. Whole bytes for I2C
+    size_t size_bits;
+} hardware_transfer_segment_t;
+// touch_event_t types
+#define TOUCH_EVENT_PRESS 0
+#define TOUCH_EVENT_MOVE 1
+#define TOUCH_EVENT_RELEASE 2
+typedef struct {
+    // when it happened, on the same clock as micros64()
+    uint64_t timestamp;
+    // which touch point. The mouse is 0
+    uint8_t id;
+    // TOUCH_EVENT_XXXX
+    uint8_t type;
+    int16_t x;
+    int16_t y;
+} touch_event_t;
+typedef struct {
+    uint32_t count;
+    uint32_t last_overshoot_ns;
+    uint32_t max_overshoot_ns;
+    uint32_t avg_overshoot_ns;
+    // how long the delay engine currently spins after sleeping
+    uint32_t spin_ns;
+} hardware_delay_stats_t;
 /// @brief Reports the milliseconds since the app started
 /// @return The number of milliseconds elapsed
 uint32_t millis();
@@ -152,6 +251,14 @@ uint32_t millis();
 /// @return The number of microseconds elapsed
 uint32_t micros();
 
+/// @brief Reports the milliseconds since the app started, without wrapping
+/// @return The number of milliseconds elapsed
+uint64_t millis64();
+
+/// @brief Reports the microseconds since the app started, without wrapping
+/// @return The number of microseconds elapsed
+uint64_t micros64();
+
 /// @brief Delays for the number of milliseconds
 /// @return The number of milliseconds to delay
 void delay(uint32_t ms);
@@ -183,14 +290,49 @@ void loop();
 /// @param h The height
 /// @param bmp The bitmap in DirectX pixel format
 void flush_bitmap(int x1, int y1, int w, int h, const void* bmp );
-/// @brief Reads the mouse information
+/// @brief The pixel formats flush_bitmap_ex() accepts
+typedef enum flush_format {
+    /// @brief 32-bit, in DirectX pixel format (BGRA, or RGBA with USE_RGB)
+    FLUSH_FORMAT_NATIVE = 0,
+    /// @brief 16-bit 5-6-5, little endian
+    FLUSH_FORMAT_RGB565,
+    /// @brief 16-bit 5-6-5, big endian as sent over SPI
+    FLUSH_FORMAT_RGB565_BE,
+    /// @brief 24-bit, as R, G, B bytes
+    FLUSH_FORMAT_RGB888,
+    /// @brief 8-bit indices into the palette set with flush_palette()
+    FLUSH_FORMAT_INDEXED8
+} flush_format_t;
+/// @brief Flushes a bitmap in another pixel format to the display, converting it
+/// @param x1 The left x coordinate
+/// @param y1 The top y coordinate
+/// @param w The width
+/// @param h The height
+/// @param bmp The bitmap
+/// @param format The pixel format of the bitmap
+/// @param stride The number of bytes between the start of each row, or 0 if the rows are packed
+void flush_bitmap_ex(int x1, int y1, int w, int h, const void* bmp, flush_format_t format, size_t stride = 0);
+/// @brief Sets the palette for FLUSH_FORMAT_INDEXED8 bitmaps
+/// @param colors The colors, in DirectX pixel format
+/// @param count The number of colors, up to 256
+void flush_palette(const uint32_t* colors, size_t count);
+/// @brief Reads the mouse information. When the mouse isn't pressed this reports the first touch point that is
 /// @param out_location The location
 /// @return True if the button is pressed
 bool read_mouse(int* out_x, int* out_y);
-/// @brief Loads a DLL that emulates hardware 
-/// @param name The DLL file to load
+/// @brief Takes pointer events off the input queue, oldest first. Unlike read_mouse(), this sees every press, move and release, even several between loop() iterations. Must be called from setup() or loop()
+/// @param out_events The events
+/// @param max_events The most events to take
+/// @return The number of events taken
+size_t read_touch_events(touch_event_t* out_events, size_t max_events);
+/// @brief Loads a plugin that emulates hardware. This is a DLL on Windows, or a shared object elsewhere
+/// @param name The plugin file to load
 /// @return a handle to the loaded hardware
 hw_handle_t hardware_load(const char* name);
+/// @brief Destroys hardware and unloads its plugin. Loaded hardware is unloaded automatically on exit. Must be called from the winduino() function
+/// @param hw A handle to the hardware
+/// @return True if successful, otherwise false
+bool hardware_unload(hw_handle_t hw);
 /// @brief Attaches a pin to the hardware
 /// @param hw A handle to the hardware
 /// @param mcu_pin The pin on the virtual MCU
@@ -216,6 +358,20 @@ bool hardware_transfer_bits_spi(uint8_t port,uint8_t* data, size_t size_bits);
 /// @param in_out_out_size The size of the input buffer. On return the size of the data actually read
 /// @return True if successful, otherwise false
 bool hardware_transfer_bytes_i2c(uint8_t port,const uint8_t*in, size_t in_size, uint8_t* out,size_t* in_out_out_size);
+/// @brief Transmits several segments over the virtual SPI subsystem in one call. Devices that don't take segments get them one at a time, with the CS and DC pins driven in between
+/// @param port The SPI port
+/// @param segments The segments
+/// @param count The number of segments
+/// @param cs_pin The chip select pin, or -1. It's released after the last segment
+/// @param dc_pin The data/command pin, or -1
+/// @return True if successful, otherwise false
+bool hardware_transfer_segments_spi(uint8_t port, hardware_transfer_segment_t* segments, size_t count, int16_t cs_pin = -1, int16_t dc_pin = -1);
+/// @brief Transmits several segments over the virtual I2C subsystem in one call, such as a register address write followed by a read. The first byte sent is the address, as with hardware_transfer_bytes_i2c()
+/// @param port The I2C port
+/// @param segments The segments
+/// @param count The number of segments
+/// @return True if successful, otherwise false
+bool hardware_transfer_segments_i2c(uint8_t port, hardware_transfer_segment_t* segments, size_t count);
 /// @brief Attaches the logging system to the hardware so that it can log to the console
 /// @param hw A handle to the hardware
 /// @return True if successful, otherwise false
@@ -245,6 +401,156 @@ bool hardware_get_attached_serial(uint8_t uart_no,uint16_t* out_com_port_no);
 /// @param height the height
 /// @return True if successful, otherwise false
 bool hardware_set_screen_size(uint16_t width, uint16_t height);
+/// @brief Switches between the wall clock and a simulated clock. Must be called from the winduino() function
+/// @param enabled True to use the virtual clock, where delay() advances time instantly, otherwise false
+/// @param idle_step_us The microseconds of virtual time charged to a loop() iteration that doesn't delay
+/// @return True if successful, otherwise false
+bool hardware_set_virtual_clock(bool enabled, uint32_t idle_step_us = 1000);
+/// @brief Starts the clock at the specified time instead of zero. Must be called from the winduino() function
+/// @param offset_us The microseconds to add to the clock. Use 0x100000000 minus a few seconds worth to make micros() wrap soon after startup
+/// @return True if successful, otherwise false
+bool hardware_set_clock_offset(uint64_t offset_us);
+/// @brief Reports how accurately the wall clock delay() and delayMicroseconds() have been waking up
+/// @param out_stats The overshoot statistics, in nanoseconds past the requested time
+/// @return True if successful, otherwise false
+bool hardware_get_delay_stats(hardware_delay_stats_t* out_stats);
+/// @brief Schedules a callback to run on the app thread after the specified time has passed. Callbacks run in timestamp order
+/// @param delay_us The number of microseconds from now
+/// @param callback The function to call
+/// @param state User defined state to pass to the callback
+/// @return True if successful, otherwise false
+bool hardware_schedule(uint32_t delay_us, void (*callback)(void* state), void* state);
+/// @brief Hashes the pixels in an area of the display. Hashes are kept per tile and only recomputed where the display was flushed, so this is cheap to call every frame
+/// @param x The x coordinate
+/// @param y The y coordinate
+/// @param w The width, or 0 along with h for the whole display
+/// @param h The height, or 0 along with w for the whole display
+/// @return The 64-bit hash
+uint64_t hardware_hash_region(int x = 0, int y = 0, int w = 0, int h = 0);
+/// @brief Loads a manifest of named display areas and their expected hashes
+/// @param path The manifest file. Each line holds a name, x, y, width, height and hexadecimal hash
+/// @param record True to store the hashes from hardware_assert_hash() instead of checking them. Use hardware_save_hash_manifest() to write them out
+/// @return True if successful, otherwise false
+bool hardware_load_hash_manifest(const char* path, bool record = false);
+/// @brief Writes the current manifest, including any recorded hashes
+/// @param path The manifest file
+/// @return True if successful, otherwise false
+bool hardware_save_hash_manifest(const char* path);
+/// @brief Checks an area of the display against its hash in the manifest. Mismatches are logged
+/// @param name The name of the entry in the manifest
+/// @param x The x coordinate
+/// @param y The y coordinate
+/// @param w The width, or 0 along with h for the whole display
+/// @param h The height, or 0 along with w for the whole display
+/// @return True if the area matches, or when recording, otherwise false
+bool hardware_assert_hash(const char* name, int x = 0, int y = 0, int w = 0, int h = 0);
+/// @brief Updates a device at a fixed rate instead of before every loop() iteration. Devices that schedule their own updates ignore this. Must be called from the winduino() function
+/// @param hw The device
+/// @param period_us The microseconds between updates, or 0 to update every iteration
+/// @return True if successful, otherwise false
+bool hardware_set_update_period(hw_handle_t hw, uint32_t period_us);
+/// @brief Lets a device update on a worker thread alongside the others. Only use it for devices that don't share pins or state with other devices. All updates still finish before loop() runs. Must be called from the winduino() function
+/// @param hw The device
+/// @param parallel True to update on a worker thread, false to update on the app thread
+/// @return True if successful, otherwise false
+bool hardware_set_parallel_update(hw_handle_t hw, bool parallel);
+/// @brief Reports how long a device spends updating, to find slow device models
+/// @param hw The device
+/// @param out_stats The statistics
+/// @return True if successful, otherwise false
+bool hardware_get_update_stats(hw_handle_t hw, hardware_update_stats_t* out_stats);
+/// @brief Starts recording the display to a compact capture file. Only the changed areas of each frame are stored, along with a timestamp. Must be called from setup() or loop()
+/// @param path The capture file
+/// @return True if successful, otherwise false
+bool hardware_start_capture(const char* path);
+/// @brief Stops recording the display and closes the capture file. This happens automatically on exit
+/// @return True if a capture was running, otherwise false
+bool hardware_stop_capture();
+/// @brief Records everything that reaches the sketch from outside it, so the run can be replayed exactly. Touches, GPIO edits, pins driven from plugin threads and serial data are held until the next loop() iteration and logged against it. Use with the virtual clock for fully repeatable runs. Must be called from winduino()
+/// @param path The journal file
+/// @param seed The seed for random(), which is stored with the journal
+/// @return True if successful, otherwise false
+bool hardware_record_inputs(const char* path, uint32_t seed = 0);
+/// @brief Replays a journal from hardware_record_inputs(), applying each input at the loop() iteration it was recorded at. Live input is ignored, and the app exits at the iteration the recording ended on. Must be called from winduino()
+/// @param path The journal file
+/// @return True if successful, otherwise false
+bool hardware_replay_inputs(const char* path);
+/// @brief Sets the priority of a pin's interrupt. When several are waiting, higher priorities run first
+/// @param pin The pin
+/// @param priority 0 to 7. The default is 1
+/// @return True if successful, otherwise false
+bool hardware_set_interrupt_priority(uint8_t pin, uint8_t priority);
+/// @brief Reports how many interrupts have run and how long after their edge they started
+/// @param pin The pin, or -1 for all pins
+/// @param out_stats The statistics
+/// @return True if successful, otherwise false
+bool hardware_get_interrupt_stats(int16_t pin, hardware_interrupt_stats_t* out_stats);
+/// @brief Sends log output to stdout as well. This is on by default when there is no log window
+/// @param enabled True to write to stdout, otherwise false
+/// @return True if successful, otherwise false
+bool hardware_log_to_stdout(bool enabled);
+/// @brief Sends log output to a file. When it reaches the maximum size, it is renamed to path.1, the older files move up, and a new one is started
+/// @param path The log file, or NULL to stop logging to a file
+/// @param max_size The size at which the file is rotated
+/// @param max_files The number of older files to keep
+/// @return True if successful, otherwise false
+bool hardware_log_to_file(const char* path, uint32_t max_size = 1024 * 1024, uint8_t max_files = 3);
+/// @brief Adds a destination for log output. Sinks run on the log thread, never the thread that logged
+/// @param sink The function that receives the output
+/// @param state The state passed to the sink
+/// @return True if successful, otherwise false
+bool hardware_add_log_sink(hardware_log_sink_fn sink, void* state);
+/// @brief Removes a destination added with hardware_add_log_sink()
+/// @param sink The function that receives the output
+/// @param state The state passed to the sink
+/// @return True if successful, otherwise false
+bool hardware_remove_log_sink(hardware_log_sink_fn sink, void* state);
+/// @brief Writes log_x() and ESP_LOGx() output to a compact binary file instead of the log. The arguments are stored as they are and formatted later by the wdlog tool, so logging costs far less. Must be called from winduino()
+/// @param path The binary log file
+/// @return True if successful, otherwise false
+bool hardware_log_binary(const char* path);
+/// @brief Reports how much has been logged, and how much was dropped because logging outran the log thread
+/// @param out_stats The statistics
+/// @return True if successful, otherwise false
+bool hardware_get_log_stats(hardware_log_stats_t* out_stats);
+/// @brief Finds or makes a counter. The runtime keeps its own metrics the same way, such as "spi.0.bits" and "serial.0.tx_bytes"
+/// @param name The name of the counter
+/// @return The counter, or NULL if the name is taken by a histogram or there's no room
+hw_counter_t hardware_counter(const char* name);
+/// @brief Adds to a counter. This is lock free and can be called from any thread
+/// @param counter The counter
+/// @param value The amount to add
+void hardware_counter_add(hw_counter_t counter, uint64_t value);
+/// @brief Finds or makes a histogram. The runtime keeps its own metrics the same way, such as "loop.duration_ns"
+/// @param name The name of the histogram
+/// @return The histogram, or NULL if the name is taken by a counter or there's no room
+hw_histogram_t hardware_histogram(const char* name);
+/// @brief Records a value in a histogram. This is lock free and can be called from any thread
+/// @param histogram The histogram
+/// @param value The value
+void hardware_histogram_record(hw_histogram_t histogram, uint64_t value);
+/// @brief Reports a counter or histogram by name
+/// @param name The name of the metric
+/// @param out_metric The metric
+/// @return True if the metric exists, otherwise false
+bool hardware_get_metric(const char* name, hardware_metric_t* out_metric);
+/// @brief Writes every metric that has seen something as JSON
+/// @param path The file to write, or NULL to write to the log
+/// @return True if successful, otherwise false
+bool hardware_dump_metrics(const char* path);
+/// @brief Writes the metrics as JSON when the app exits
+/// @param path The file to write, or NULL to write to the log
+/// @return True if successful, otherwise false
+bool hardware_dump_metrics_on_exit(const char* path);
+/// @brief Zeroes every metric and restarts the clock their rates are based on
+void hardware_reset_metrics();
+/// @brief Records a timeline of setup(), each loop(), device updates, bus transfers, flushes, presents, ISRs and serial I/O from every thread. Each thread records to its own buffer, and the trace is written in the Chrome trace event format when it's stopped or the app exits, for chrome://tracing or Perfetto. Build with WINDUINO_TRACE=0 to compile the trace points out
+/// @param path The trace file
+/// @return True if successful, otherwise false
+bool hardware_start_trace(const char* path);
+/// @brief Stops the trace and writes it. This happens automatically on exit
+/// @return True if a trace was running and was written, otherwise false
+bool hardware_stop_trace();
 
 /// @brief indicates the current uart for the logging window
 extern int hardware_log_uart;
@@ -258,5 +564,6 @@ extern int hardware_log_uart;
 #include "Printable.h"
 #include "Print.h"
 #include "HardwareSerial.h"
+#include "soc/gpio_struct.h"
 inline int min(int x,int y) { return x<y?x:y; }
 inline int max(int x,int y) { return x>y?x:y; }
@@ -19,7 +19,7 @@
  */
 
 #include "FS.h"
-#include "FSImpl.h"
+#include "FsImpl.h"
 
 using namespace fs;
 
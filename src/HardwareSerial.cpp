@@ -2,9 +2,22 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#ifdef _WIN32
 #include <windows.h>
+#else
+#include <fcntl.h>
+#include <termios.h>
+#include <unistd.h>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#endif
 
 #include "Arduino.h"
+#include "winduino_journal.h"
+#include "winduino_log.h"
+#include "winduino_metrics.h"
+#include "winduino_trace.h"
 #ifndef ARDUINO_SERIAL_EVENT_TASK_STACK_SIZE
 #define ARDUINO_SERIAL_EVENT_TASK_STACK_SIZE 2048
 #endif
@@ -69,12 +82,42 @@ void serialEventRun(void) {
 #define HSERIAL_MUTEX_UNLOCK()
 #endif
 
+#ifdef _WIN32
+#define RX_MUTEX_LOCK() (WAIT_OBJECT_0 == WaitForSingleObject((HANDLE)_read_mutex, INFINITE))
+#define RX_MUTEX_UNLOCK() ReleaseMutex((HANDLE)_read_mutex)
+
 static DWORD serial_thread_proc(void* state) {
     HardwareSerial& hs = *(HardwareSerial*)state;
+    TRACE_THREAD_NAME("serial reader");
     while(true) {
         hs.update();
     }
 }
+#else
+#define RX_MUTEX_LOCK() (((std::mutex*)_read_mutex)->lock(), true)
+#define RX_MUTEX_UNLOCK() ((std::mutex*)_read_mutex)->unlock()
+
+// _handle holds the file descriptor of the tty
+static int serial_fd(void* handle) {
+    return (int)(intptr_t)handle;
+}
+static const struct {
+    unsigned long baud;
+    speed_t speed;
+} serial_speeds[] = {
+    {300, B300}, {600, B600}, {1200, B1200}, {2400, B2400}, {4800, B4800}, 
+    {9600, B9600}, {19200, B19200}, {38400, B38400}, {57600, B57600}, 
+    {115200, B115200}, {230400, B230400}, {460800, B460800}, 
+    {921600, B921600}};
+static speed_t serial_speed(unsigned long baud) {
+    for (size_t i = 0; i < sizeof(serial_speeds) / sizeof(serial_speeds[0]); ++i) {
+        if (serial_speeds[i].baud == baud) {
+            return serial_speeds[i].speed;
+        }
+    }
+    return B9600;
+}
+#endif
 
 HardwareSerial::HardwareSerial(int uart_nr) : _uart_nr(uart_nr),
                                               _rxBufferSize(256),
@@ -96,6 +139,18 @@ HardwareSerial::HardwareSerial(int uart_nr) : _uart_nr(uart_nr),
                                               _rx_buffer(nullptr),
                                               _rx_size(0),
                                               _rx_cap(0) {
+    char name[METRIC_NAME_MAX];
+    snprintf(name, sizeof(name), "serial.%d.rx_bytes", uart_nr);
+    _rx_bytes = metrics.counter(name);
+    snprintf(name, sizeof(name), "serial.%d.tx_bytes", uart_nr);
+    _tx_bytes = metrics.counter(name);
+    // made up front, since replay, the reader thread and read() can
+    // all reach the buffer before begin() is called, or after end()
+#ifdef _WIN32
+    _read_mutex = CreateMutexW(NULL, FALSE, NULL);
+#else
+    _read_mutex = new std::mutex();
+#endif
     //_quit_event = CreateEvent(NULL, TRUE, FALSE, NULL);
     //_has_quit_event = CreateEvent(NULL, TRUE, FALSE, NULL);
 }
@@ -103,38 +158,74 @@ void HardwareSerial::update() {
     if(_handle==nullptr) return;
     uint8_t buf[1024];
     size_t written = 0;
+#ifdef _WIN32
     DWORD dread = sizeof(buf);
     while (dread != 0) {
         if (!ReadFile((HANDLE)_handle, buf, sizeof(buf), &dread, NULL)) {
             break;
         }
+#else
+    // the tty is configured to time out, so this returns
+    // periodically even when nothing is received
+    ssize_t dread = sizeof(buf);
+    while (dread > 0) {
+        dread = ::read(serial_fd(_handle), buf, sizeof(buf));
+        if (dread < 0) {
+            break;
+        }
+#endif
         // Serial.printf("Read success\r\n");
         if (dread > 0) {
-            if(WAIT_OBJECT_0==WaitForSingleObject((HANDLE)_read_mutex,INFINITE)) {
-                size_t ns = _rx_cap;
-                while (dread + _rx_size > ns) {
-                    ns *= 2;
-                }
-                if (ns > _rx_cap) {
-                    uint8_t *p = (uint8_t *)realloc(_rx_buffer, ns);
-                    if (p == nullptr) {
-                        dread = 0;
-                        ReleaseMutex((HANDLE)_read_mutex);
-                        continue;
-                    }
-                    _rx_buffer = p;
-                    _rx_cap = ns;
-                }
-                memcpy(_rx_buffer + _rx_size, buf, dread);
-                _rx_size += dread;
-                ReleaseMutex((HANDLE)_read_mutex);
+            TRACE_INSTANT("serial", "rx", dread);
+            input_event_t in;
+            in.timestamp = micros64();
+            in.kind = INPUT_KIND_SERIAL;
+            in.channel = (uint8_t)_uart_nr;
+            in.type = 0;
+            in.x = 0;
+            in.y = 0;
+            in.value = 0;
+            in.size = (uint32_t)dread;
+            if (!inputs.capture(in, buf)) {
+                receive(buf, dread);
+            }
+        }
+    }
+}
+void HardwareSerial::receive(const uint8_t* data, size_t size) {
+    // a replay can feed a port that has no device behind it, so the
+    // buffer may not be there yet
+    if (_read_mutex != nullptr && RX_MUTEX_LOCK()) {
+        size_t ns = _rx_cap == 0 ? 1024 : _rx_cap;
+        while (size + _rx_size > ns) {
+            ns *= 2;
+        }
+        if (ns > _rx_cap) {
+            uint8_t *p = (uint8_t *)realloc(_rx_buffer, ns);
+            if (p == nullptr) {
+                RX_MUTEX_UNLOCK();
+                return;
             }
+            _rx_buffer = p;
+            _rx_cap = ns;
         }
+        memcpy(_rx_buffer + _rx_size, data, size);
+        _rx_size += size;
+        RX_MUTEX_UNLOCK();
+        _rx_bytes->add(size);
     }
 }
 
 HardwareSerial::~HardwareSerial() {
     end();
+    if (_read_mutex != nullptr) {
+#ifdef _WIN32
+        CloseHandle((HANDLE)_read_mutex);
+#else
+        delete (std::mutex *)_read_mutex;
+#endif
+        _read_mutex = nullptr;
+    }
 }
 
 void HardwareSerial::onReceiveError(OnReceiveErrorCb function) {
@@ -191,6 +282,7 @@ void HardwareSerial::begin(unsigned long baud, uint32_t config, int8_t rxPin, in
         return;
     }
     bool isopen = _handle != nullptr;
+#ifdef _WIN32
     wchar_t comstr[64];
     wcscpy(comstr, L"\\\\.\\COM");
     _itow(comp, comstr + wcslen(comstr), 10);
@@ -207,11 +299,12 @@ void HardwareSerial::begin(unsigned long baud, uint32_t config, int8_t rxPin, in
            return;
         }
     }
-    _read_mutex = CreateMutexW(NULL,FALSE,NULL);
-    _rx_cap = 1024;
-    _rx_buffer = (uint8_t *)malloc(_rx_cap);
     if (_rx_buffer == nullptr) {
-        return;
+        _rx_cap = 1024;
+        _rx_buffer = (uint8_t *)malloc(_rx_cap);
+        if (_rx_buffer == nullptr) {
+            return;
+        }
     }
     _rx_size = 0;
 
@@ -230,6 +323,72 @@ void HardwareSerial::begin(unsigned long baud, uint32_t config, int8_t rxPin, in
     _thread=CreateThread(NULL,4000,serial_thread_proc,this,0,NULL);
     // ResetEvent((HANDLE)_quit_event);
     // ResetEvent((HANDLE)_has_quit_event);
+#else
+    // COM1 is /dev/ttyS0, COM2 is /dev/ttyS1, etc
+    char comstr[64];
+    snprintf(comstr, sizeof(comstr), "/dev/ttyS%d", (int)comp - 1);
+    if (!isopen) {
+        int fd = open(comstr, O_RDWR | O_NOCTTY);
+        if (fd < 0) {
+            return;
+        }
+        _handle = (void*)(intptr_t)fd;
+    }
+    if (_rx_buffer == nullptr) {
+        _rx_cap = 1024;
+        _rx_buffer = (uint8_t *)malloc(_rx_cap);
+        if (_rx_buffer == nullptr) {
+            return;
+        }
+    }
+    _rx_size = 0;
+
+    struct termios tio;
+    tcgetattr(serial_fd(_handle), &tio);
+    cfmakeraw(&tio);
+    tio.c_cflag |= CLOCAL | CREAD;
+    tio.c_cflag &= ~(CSIZE | PARENB | PARODD | CSTOPB);
+    switch ((config & 0xc) >> 2) {
+        case 0:
+            tio.c_cflag |= CS5;
+            break;
+        case 1:
+            tio.c_cflag |= CS6;
+            break;
+        case 2:
+            tio.c_cflag |= CS7;
+            break;
+        default:
+            tio.c_cflag |= CS8;
+            break;
+    }
+    if (config & 0x2) {
+        tio.c_cflag |= PARENB;
+        if (config & 0x1) {
+            tio.c_cflag |= PARODD;
+        }
+    }
+    if (((config & 0x30) >> 4) > 1) {
+        tio.c_cflag |= CSTOPB;
+    }
+    // return from read() after 100ms with no data
+    tio.c_cc[VMIN] = 0;
+    tio.c_cc[VTIME] = 1;
+    cfsetispeed(&tio, serial_speed(baud));
+    cfsetospeed(&tio, serial_speed(baud));
+    tcsetattr(serial_fd(_handle), TCSANOW, &tio);
+    _rxPin = rxPin;
+    _txPin = txPin;
+    if (_thread == nullptr) {
+        _quit_event = new std::atomic<bool>(false);
+        _thread = new std::thread([this]() {
+            TRACE_THREAD_NAME("serial reader");
+            while (!((std::atomic<bool> *)_quit_event)->load()) {
+                update();
+            }
+        });
+    }
+#endif
 
 }
 
@@ -237,6 +396,7 @@ void HardwareSerial::updateBaudRate(unsigned long baud) {
 }
 
 void HardwareSerial::end(bool fullyTerminate) {
+#ifdef _WIN32
     if(_thread!=nullptr) {
         CloseHandle((HANDLE)_thread);
     }
@@ -245,13 +405,26 @@ void HardwareSerial::end(bool fullyTerminate) {
         CloseHandle((HANDLE)_handle);
         _handle = NULL;
     }
-    if(_read_mutex!=nullptr) {
-        CloseHandle((HANDLE)_read_mutex);
-        _read_mutex = nullptr;
+#else
+    if (_thread != nullptr) {
+        ((std::atomic<bool> *)_quit_event)->store(true);
+        ((std::thread *)_thread)->join();
+        delete (std::thread *)_thread;
+        delete (std::atomic<bool> *)_quit_event;
+        _thread = nullptr;
+        _quit_event = nullptr;
+    }
+    if (_handle != nullptr) {
+        close(serial_fd(_handle));
+        _handle = nullptr;
     }
-    if (_rx_buffer != nullptr) {
+#endif
+    if (_read_mutex != nullptr && RX_MUTEX_LOCK()) {
         free(_rx_buffer);
         _rx_buffer = nullptr;
+        _rx_cap = 0;
+        _rx_size = 0;
+        RX_MUTEX_UNLOCK();
     }
     // default Serial.end() will completely disable HardwareSerial,
     // including any tasks or debug message channel (log_x()) - but not for IDF log messages!
@@ -272,9 +445,9 @@ int HardwareSerial::available(void) {
         return 0;
     }
     int result = 0;
-    if(WAIT_OBJECT_0==WaitForSingleObject((HANDLE)_read_mutex,INFINITE)) {
+    if(RX_MUTEX_LOCK()) {
         result = _rx_size;
-        ReleaseMutex((HANDLE)_read_mutex);
+        RX_MUTEX_UNLOCK();
     }
     return result;
 }
@@ -287,11 +460,11 @@ int HardwareSerial::peek(void) {
     if(_read_mutex==nullptr) {
         return result;
     }
-    if (WAIT_OBJECT_0 == WaitForSingleObject(_read_mutex, INFINITE)) {
+    if (RX_MUTEX_LOCK()) {
         if (_rx_size > 0) {
             result = *_rx_buffer;
         }
-        ReleaseMutex(_read_mutex);
+        RX_MUTEX_UNLOCK();
     }
     return result;
 }
@@ -301,12 +474,12 @@ int HardwareSerial::read(void) {
     if(_read_mutex==nullptr) {
         return result;
     }
-    if (WAIT_OBJECT_0 == WaitForSingleObject(_read_mutex, INFINITE)) {
+    if (RX_MUTEX_LOCK()) {
         if (_rx_size > 0) {
             result = *_rx_buffer;
             memmove(_rx_buffer, _rx_buffer + 1, --_rx_size);
         }
-        ReleaseMutex(_read_mutex);
+        RX_MUTEX_UNLOCK();
     }
     return result;
 }
@@ -320,11 +493,15 @@ size_t HardwareSerial::read(uint8_t *buffer, size_t size) {
     if(_read_mutex==nullptr) {
         return 0;
     }
-    if (WAIT_OBJECT_0 == WaitForSingleObject(_read_mutex, INFINITE)) {
+    if (RX_MUTEX_LOCK()) {
         if (result >= _rx_size) {
             result = _rx_size;
-            memcpy(buffer, _rx_buffer, result);
+            if (result != 0) {
+                // before begin() there's no buffer
+                memcpy(buffer, _rx_buffer, result);
+            }
             _rx_size = 0;
+            RX_MUTEX_UNLOCK();
             return result;
         }
         if (_rx_size > 0) {
@@ -333,7 +510,7 @@ size_t HardwareSerial::read(uint8_t *buffer, size_t size) {
             memmove(_rx_buffer, _rx_buffer + result, ns);
             _rx_size = ns;
         }
-        ReleaseMutex(_read_mutex);
+        RX_MUTEX_UNLOCK();
     }
     return result;
 }
@@ -344,31 +521,26 @@ size_t HardwareSerial::readBytes(uint8_t *buffer, size_t length) {
 }
 
 void HardwareSerial::flush(void) {
+    flush(false);
 }
 
 void HardwareSerial::flush(bool txOnly) {
+    if (_uart_nr == hardware_log_uart) {
+        log_output.flush();
+    }
 }
 
 size_t HardwareSerial::write(uint8_t c) {
-    if (_uart_nr == hardware_log_uart) {
-        char sz[2];
-        sz[1] = 0;
-        sz[0] = (char)c;
-        log_print(sz);
-    }
     return write(&c, 1);
 }
 
 size_t HardwareSerial::write(const uint8_t *buffer, size_t size) {
+    TRACE_SCOPE_VALUE("serial", "tx", size);
     if (_uart_nr == hardware_log_uart) {
-        char *buf = (char *)malloc(size + 1);
-        if (buf == NULL) return 0;
-        memcpy(buf, buffer, size);
-        buf[size] = 0;
-        log_print(buf);
-        free(buf);
+        log_output.write((const char *)buffer, size);
     }
     if (_handle != nullptr) {
+#ifdef _WIN32
         DWORD cb = (DWORD)size;
         WriteFile((HANDLE)_handle,  // Handle to the Serial port
                   buffer,           // Data to be written to the port
@@ -376,17 +548,39 @@ size_t HardwareSerial::write(const uint8_t *buffer, size_t size) {
                   &cb,              // Bytes written
                   NULL);
         size = (size_t)cb;
+#else
+        ssize_t cb = ::write(serial_fd(_handle), buffer, size);
+        size = cb < 0 ? 0 : (size_t)cb;
+#endif
     }
+    _tx_bytes->add(size);
     return size;
 }
 uint32_t HardwareSerial::baudRate()
 
 {
+#ifdef _WIN32
     DCB dcb;
     dcb.DCBlength = sizeof(DCB);
     GetCommState((HANDLE)_handle, &dcb);
 
     return dcb.BaudRate;
+#else
+    if (_handle == nullptr) {
+        return 0;
+    }
+    struct termios tio;
+    if (0 != tcgetattr(serial_fd(_handle), &tio)) {
+        return 0;
+    }
+    speed_t speed = cfgetospeed(&tio);
+    for (size_t i = 0; i < sizeof(serial_speeds) / sizeof(serial_speeds[0]); ++i) {
+        if (serial_speeds[i].speed == speed) {
+            return serial_speeds[i].baud;
+        }
+    }
+    return 0;
+#endif
 }
 HardwareSerial::operator bool() const {
     return true;
@@ -86,6 +86,7 @@ typedef enum {
 typedef std::function<void(void)> OnReceiveCb;
 typedef std::function<void(hardwareSerial_error_t)> OnReceiveErrorCb;
 
+class metric_counter;
 class HardwareSerial: public Stream
 {
 public:
@@ -186,6 +187,8 @@ public:
     size_t setRxBufferSize(size_t new_size);
     size_t setTxBufferSize(size_t new_size);
     void update();
+    // appends received bytes to the RX buffer
+    void receive(const uint8_t* data, size_t size);
 protected:
     int _uart_nr;
     size_t _rxBufferSize;
@@ -201,6 +204,8 @@ protected:
     uint8_t* _rx_buffer;
     size_t _rx_size;
     size_t _rx_cap;
+    metric_counter* _rx_bytes;
+    metric_counter* _tx_bytes;
 };
 
 extern void serialEventRun(void) __attribute__((weak));
@@ -12,8 +12,12 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#ifdef _WIN32
 #include <Windows.h>
 #include <fileapi.h>
+#else
+#include <sys/statvfs.h>
+#endif
 #include "StdioFSImpl.h"
 #include "FS.h"
 #include "SD.h"
@@ -53,6 +57,7 @@ uint64_t SDFS::cardSize()
     if(_pdrv == 0xFF) {
         return 0;
     }
+#ifdef _WIN32
     ULARGE_INTEGER FreeBytesAvailable = { 0 };
     ULARGE_INTEGER TotalNumberOfBytes={ 0 };
     ULARGE_INTEGER TotalNumberOfFreeBytes={ 0 };
@@ -68,6 +73,13 @@ uint64_t SDFS::cardSize()
         return 0;
     }
     return TotalNumberOfBytes.QuadPart;
+#else
+    struct statvfs st;
+    if(0!=statvfs(".",&st)) {
+        return 0;
+    }
+    return (uint64_t)st.f_blocks*st.f_frsize;
+#endif
     
 }
 
@@ -76,6 +88,7 @@ size_t SDFS::numSectors()
     if(_pdrv == 0xFF) {
         return 0;
     }
+#ifdef _WIN32
     DWORD sectorsPerCluster;
     DWORD bytesPerSector;
     DWORD numberOfFreeClusters;
@@ -85,6 +98,13 @@ size_t SDFS::numSectors()
         return 0;
     }
     return (size_t)(totalNumberOfClusters*sectorsPerCluster);
+#else
+    struct statvfs st;
+    if(0!=statvfs(".",&st)) {
+        return 0;
+    }
+    return (size_t)st.f_blocks;
+#endif
 }
 
 size_t SDFS::sectorSize()
@@ -92,6 +112,7 @@ size_t SDFS::sectorSize()
     if(_pdrv == 0xFF) {
         return 0;
     }
+#ifdef _WIN32
     DWORD sectorsPerCluster;
     DWORD bytesPerSector;
     DWORD numberOfFreeClusters;
@@ -101,6 +122,13 @@ size_t SDFS::sectorSize()
         return 0;
     }
     return bytesPerSector;
+#else
+    struct statvfs st;
+    if(0!=statvfs(".",&st)) {
+        return 0;
+    }
+    return (size_t)st.f_frsize;
+#endif
 }
 
 uint64_t SDFS::totalBytes()
@@ -110,6 +138,7 @@ uint64_t SDFS::totalBytes()
 
 uint64_t SDFS::usedBytes()
 {
+#ifdef _WIN32
 	ULARGE_INTEGER FreeBytesAvailable = { 0 };
     ULARGE_INTEGER TotalNumberOfBytes={ 0 };
     ULARGE_INTEGER TotalNumberOfFreeBytes={ 0 };
@@ -125,6 +154,13 @@ uint64_t SDFS::usedBytes()
         return 0;
     }
     return TotalNumberOfBytes.QuadPart-TotalNumberOfBytes.QuadPart;
+#else
+    struct statvfs st;
+    if(0!=statvfs(".",&st)) {
+        return 0;
+    }
+    return (uint64_t)(st.f_blocks-st.f_bfree)*st.f_frsize;
+#endif
 }
 
 bool SDFS::readRAW(uint8_t* buffer, uint32_t sector)
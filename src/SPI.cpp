@@ -200,6 +200,22 @@ uint8_t SPIClass::transfer(uint8_t val) {
     }
     return val;
 }
+void SPIClass::transferBytes(const uint8_t* data, uint8_t* out, uint32_t size) {
+    bool reset_cs;
+    if(reset_cs=(!_inTransaction && _use_hw_ss && _ss!=-1)) {
+        digitalWrite(_ss,LOW);
+    }
+    // the data isn't written to since the reply goes to out
+    hardware_transfer_segment_t seg;
+    seg.flags = HARDWARE_SEGMENT_TX | HARDWARE_SEGMENT_CS | (out != nullptr ? HARDWARE_SEGMENT_RX : 0);
+    seg.data = (uint8_t*)data;
+    seg.rx = out;
+    seg.size_bits = size * 8;
+    hardware_transfer_segments_spi(_port, &seg, 1);
+    if(reset_cs) {
+        digitalWrite(_ss,HIGH);
+    }
+}
 uint16_t SPIClass::transfer16(uint16_t data) {
     union {
         uint16_t val;
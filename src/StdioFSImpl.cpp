@@ -13,6 +13,7 @@
 // limitations under the License.
 
 #include "StdioFSImpl.h"
+#include "esp32-hal-log.h"
 
 using namespace fs;
 
@@ -21,18 +22,18 @@ using namespace fs;
 FileImplPtr StdioImpl::open(const char* fpath, const char* mode, const bool create)
 {
     if(!_mountpoint) {
-        // log_e("File system is not mounted");
+        log_e("File system is not mounted");
         return FileImplPtr();
     }
 
     if(!fpath || fpath[0] != '/') {
-        // log_e("%s does not start with /", fpath);
+        log_e("%s does not start with /", fpath);
         return FileImplPtr();
     }
 
     char * temp = (char *)malloc(strlen(fpath)+strlen(_mountpoint)+2);
     if(!temp) {
-        // log_e("malloc failed");
+        log_e("malloc failed");
         return FileImplPtr();
     }
 
@@ -46,7 +47,7 @@ FileImplPtr StdioImpl::open(const char* fpath, const char* mode, const bool crea
         if (S_ISREG(st.st_mode) || S_ISDIR(st.st_mode)) {
             return std::make_shared<StdioFileImpl>(this, fpath, mode);
         }
-        // log_e("%s has wrong mode 0x%08X", fpath, st.st_mode);
+        log_e("%s has wrong mode 0x%08X", fpath, st.st_mode);
         return FileImplPtr();
     }
 
@@ -67,7 +68,7 @@ FileImplPtr StdioImpl::open(const char* fpath, const char* mode, const bool crea
     ////file not found but mode permits file creation and folder creation
     if((mode && mode[0] != 'r') && create){
 
-        char *token;
+        const char *token;
         char *folder = (char *)malloc(strlen(fpath));
 
         int start_index = 0;
@@ -83,7 +84,7 @@ FileImplPtr StdioImpl::open(const char* fpath, const char* mode, const bool crea
             
             if(!StdioImpl::mkdir(folder))
             {
-                // log_e("Creating folder: %s failed!",folder);
+                log_e("Creating folder: %s failed!",folder);
                 return FileImplPtr();
             }
 
@@ -102,7 +103,7 @@ FileImplPtr StdioImpl::open(const char* fpath, const char* mode, const bool crea
 
     }
 
-    // log_e("%s does not exist, no permits for creation", temp);
+    log_e("%s does not exist, no permits for creation", temp);
     free(temp);
     return FileImplPtr();
 }
@@ -110,7 +111,7 @@ FileImplPtr StdioImpl::open(const char* fpath, const char* mode, const bool crea
 bool StdioImpl::exists(const char* fpath)
 {
     if(!_mountpoint) {
-        // log_e("File system is not mounted");
+        log_e("File system is not mounted");
         return false;
     }
 
@@ -125,28 +126,28 @@ bool StdioImpl::exists(const char* fpath)
 bool StdioImpl::rename(const char* pathFrom, const char* pathTo)
 {
     if(!_mountpoint) {
-        // log_e("File system is not mounted");
+        log_e("File system is not mounted");
         return false;
     }
 
     if(!pathFrom || pathFrom[0] != '/' || !pathTo || pathTo[0] != '/') {
-        // log_e("bad arguments");
+        log_e("bad arguments");
         return false;
     }
     if(!exists(pathFrom)) {
-        // log_e("%s does not exists", pathFrom);
+        log_e("%s does not exists", pathFrom);
         return false;
     }
     size_t mountpointLen = strlen(_mountpoint);
     char * temp1 = (char *)malloc(strlen(pathFrom)+mountpointLen+1);
     if(!temp1) {
-        // log_e("malloc failed");
+        log_e("malloc failed");
         return false;
     }
     char * temp2 = (char *)malloc(strlen(pathTo)+mountpointLen+1);
     if(!temp2) {
         free(temp1);
-        // log_e("malloc failed");
+        log_e("malloc failed");
         return false;
     }
 
@@ -165,12 +166,12 @@ bool StdioImpl::rename(const char* pathFrom, const char* pathTo)
 bool StdioImpl::remove(const char* fpath)
 {
     if(!_mountpoint) {
-        // log_e("File system is not mounted");
+        log_e("File system is not mounted");
         return false;
     }
 
     if(!fpath || fpath[0] != '/') {
-        // log_e("bad arguments");
+        log_e("bad arguments");
         return false;
     }
 
@@ -179,14 +180,14 @@ bool StdioImpl::remove(const char* fpath)
         if(f) {
             f.close();
         }
-        // log_e("%s does not exists or is directory", fpath);
+        log_e("%s does not exists or is directory", fpath);
         return false;
     }
     f.close();
 
     char * temp = (char *)malloc(strlen(fpath)+strlen(_mountpoint)+1);
     if(!temp) {
-        // log_e("malloc failed");
+        log_e("malloc failed");
         return false;
     }
 
@@ -201,7 +202,7 @@ bool StdioImpl::remove(const char* fpath)
 bool StdioImpl::mkdir(const char *fpath)
 {
     if(!_mountpoint) {
-        // log_e("File system is not mounted");
+        log_e("File system is not mounted");
         return false;
     }
 
@@ -212,20 +213,24 @@ bool StdioImpl::mkdir(const char *fpath)
         return true;
     } else if(f) {
         f.close();
-        // log_e("%s is a file", fpath);
+        log_e("%s is a file", fpath);
         return false;
     }
 
     char * temp = (char *)malloc(strlen(fpath)+strlen(_mountpoint)+1);
     if(!temp) {
-        // log_e("malloc failed");
+        log_e("malloc failed");
         return false;
     }
 
     strcpy(temp, _mountpoint);
     strcat(temp, fpath);
 
+#ifdef _WIN32
     auto rc = ::mkdir(temp);
+#else
+    auto rc = ::mkdir(temp, 0777);
+#endif
     free(temp);
     return rc == 0;
 }
@@ -233,7 +238,7 @@ bool StdioImpl::mkdir(const char *fpath)
 bool StdioImpl::rmdir(const char *fpath)
 {
     if(!_mountpoint) {
-        // log_e("File system is not mounted");
+        log_e("File system is not mounted");
         return false;
     }
 
@@ -242,14 +247,14 @@ bool StdioImpl::rmdir(const char *fpath)
         if(f) {
             f.close();
         }
-        // log_e("%s does not exists or is a file", fpath);
+        log_e("%s does not exists or is a file", fpath);
         return false;
     }
     f.close();
 
     char * temp = (char *)malloc(strlen(fpath)+strlen(_mountpoint)+1);
     if(!temp) {
-        // log_e("malloc failed");
+        log_e("malloc failed");
         return false;
     }
 
@@ -282,7 +287,7 @@ StdioFileImpl::StdioFileImpl(StdioImpl* fs, const char* fpath, const char* mode)
 
     _path = strdup(fpath);
     if(!_path) {
-        // log_e("strdup(%s) failed", fpath);
+        log_e("strdup(%s) failed", fpath);
         free(temp);
         return;
     }
@@ -292,18 +297,18 @@ StdioFileImpl::StdioFileImpl(StdioImpl* fs, const char* fpath, const char* mode)
         if (S_ISREG(_stat.st_mode)) {
             _isDirectory = false;
             _f = fopen(temp, mode);
-            // if(!_f) {
-                // log_e("fopen(%s) failed", temp);
-            // }
+            if(!_f) {
+                log_e("fopen(%s) failed", temp);
+            }
         } else if(S_ISDIR(_stat.st_mode)) {
             _isDirectory = true;
             _d = opendir(temp);
-            // if(!_d) {
-                // log_e("opendir(%s) failed", temp);
-            // }
-        } // else {
-            // log_e("Unknown type 0x%08X for file %s", ((_stat.st_mode)&_IFMT), temp);
-        // }
+            if(!_d) {
+                log_e("opendir(%s) failed", temp);
+            }
+        } else {
+            log_e("Unknown type 0x%08X for file %s", (unsigned)((_stat.st_mode)&S_IFMT), temp);
+        }
     } else {
         //file not found
         if(!mode || mode[0] == 'r') {
@@ -319,9 +324,9 @@ StdioFileImpl::StdioFileImpl(StdioImpl* fs, const char* fpath, const char* mode)
             //lets create this new file
             _isDirectory = false;
             _f = fopen(temp, mode);
-            // if(!_f) {
-                // log_e("fopen(%s) failed", temp);
-            // } 
+            if(!_f) {
+                log_e("fopen(%s) failed", temp);
+            }
         }
     }
     free(temp);
@@ -16,7 +16,7 @@
 #define vfs_api_h
 
 #include "FS.h"
-#include "FSImpl.h"
+#include "FsImpl.h"
 
 extern "C" {
 #include <sys/unistd.h>
@@ -3,6 +3,7 @@ extern "C" {
 #include <stdlib.h>
 #include <stdint.h>
 }
+#include "esp32-hal-log.h"
 
 // Allows the user to choose between Real Hardware
 // or Software Pseudo random generators for the
@@ -50,7 +51,7 @@ long random(long howsmall, long howbig)
 long map(long x, long in_min, long in_max, long out_min, long out_max) {
     const long run = in_max - in_min;
     if(run == 0){
-        // log_e("map(): Invalid input range, min == max");
+        log_e("map(): Invalid input range, min == max");
         return -1; // AVR returns -1, SAM returns 0
     }
     const long rise = out_max - out_min;
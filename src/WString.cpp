@@ -107,7 +107,7 @@ String::String(float value, unsigned int decimalPlaces) {
         free(buf);
     } else {
         *this = "nan";
-        // log_e("No enought memory for the operation.");
+        log_e("No enought memory for the operation.");
     }
 }
 
@@ -119,7 +119,7 @@ String::String(double value, unsigned int decimalPlaces) {
         free(buf);
     } else {
         *this = "nan";
-        // log_e("No enought memory for the operation.");
+        log_e("No enought memory for the operation.");
     }
 }
 
@@ -761,7 +761,7 @@ void String::replace(const String &find, const String &replace) {
         if(size == len())
             return;
         if(size > capacity() && !changeBuffer(size)) {
-            // log_w("String.Replace() Insufficient space to replace string");
+            log_w("String.Replace() Insufficient space to replace string");
             return;
         }
         int index = len() - 1;
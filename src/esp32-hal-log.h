@@ -0,0 +1,108 @@
+#pragma once
+#include <stdint.h>
+#include <atomic>
+
+#define ARDUHAL_LOG_LEVEL_NONE (0)
+#define ARDUHAL_LOG_LEVEL_ERROR (1)
+#define ARDUHAL_LOG_LEVEL_WARN (2)
+#define ARDUHAL_LOG_LEVEL_INFO (3)
+#define ARDUHAL_LOG_LEVEL_DEBUG (4)
+#define ARDUHAL_LOG_LEVEL_VERBOSE (5)
+
+// the most detailed level compiled in. Calls above it vanish along
+// with their arguments, which are never evaluated
+#ifndef CORE_DEBUG_LEVEL
+#define CORE_DEBUG_LEVEL ARDUHAL_LOG_LEVEL_NONE
+#endif
+#define ARDUHAL_LOG_LEVEL CORE_DEBUG_LEVEL
+
+typedef enum {
+    ESP_LOG_NONE,
+    ESP_LOG_ERROR,
+    ESP_LOG_WARN,
+    ESP_LOG_INFO,
+    ESP_LOG_DEBUG,
+    ESP_LOG_VERBOSE
+} esp_log_level_t;
+
+// one for each logging call, so its tag's runtime level is only looked
+// up again after the filters change
+typedef struct log_site {
+    uint8_t level;
+    uint32_t line;
+    // NULL for log_x(), which are filtered by their file's name
+    const char* tag;
+    const char* file;
+    const char* function;
+    const char* format;
+    std::atomic<uint32_t> generation;
+    std::atomic<uint8_t> allowed;
+    // for the binary format, 0 until it has been written out
+    std::atomic<uint32_t> id;
+} log_site_t;
+// bumped every time a runtime level is set
+extern std::atomic<uint32_t> log_filter_generation;
+void log_site_refresh(log_site_t* site);
+void log_site_write(log_site_t* site, const char* format, ...) __attribute__((format(printf, 2, 3)));
+inline bool log_site_enabled(log_site_t* site) {
+    if (site->generation.load(std::memory_order_acquire) != log_filter_generation.load(std::memory_order_relaxed)) {
+        log_site_refresh(site);
+    }
+    return site->level <= site->allowed.load(std::memory_order_relaxed);
+}
+
+/// @brief Sets the level a tag logs at while running. Only levels compiled in by CORE_DEBUG_LEVEL can be enabled
+/// @param tag The tag, or the file name for log_x() calls, or "*" for everything not otherwise set
+/// @param level The most detailed level to log
+void esp_log_level_set(const char* tag, esp_log_level_t level);
+/// @brief Reports the level a tag logs at while running
+/// @param tag The tag, or the file name for log_x() calls
+/// @return The most detailed level logged
+esp_log_level_t esp_log_level_get(const char* tag);
+
+#define ARDUHAL_LOG_SITE(level, tag, format, ...)                                                        \
+    do {                                                                                                 \
+        static log_site_t arduhal_log_site = {level, __LINE__, tag, __FILE__, __FUNCTION__, format};     \
+        if (log_site_enabled(&arduhal_log_site)) {                                                       \
+            log_site_write(&arduhal_log_site, format, ##__VA_ARGS__);                                    \
+        }                                                                                                \
+    } while (0)
+#define ARDUHAL_LOG_NOTHING() \
+    do {                      \
+    } while (0)
+
+#if ARDUHAL_LOG_LEVEL >= ARDUHAL_LOG_LEVEL_VERBOSE
+#define log_v(format, ...) ARDUHAL_LOG_SITE(ARDUHAL_LOG_LEVEL_VERBOSE, nullptr, format, ##__VA_ARGS__)
+#define ESP_LOGV(tag, format, ...) ARDUHAL_LOG_SITE(ARDUHAL_LOG_LEVEL_VERBOSE, tag, format, ##__VA_ARGS__)
+#else
+#define log_v(format, ...) ARDUHAL_LOG_NOTHING()
+#define ESP_LOGV(tag, format, ...) ARDUHAL_LOG_NOTHING()
+#endif
+#if ARDUHAL_LOG_LEVEL >= ARDUHAL_LOG_LEVEL_DEBUG
+#define log_d(format, ...) ARDUHAL_LOG_SITE(ARDUHAL_LOG_LEVEL_DEBUG, nullptr, format, ##__VA_ARGS__)
+#define ESP_LOGD(tag, format, ...) ARDUHAL_LOG_SITE(ARDUHAL_LOG_LEVEL_DEBUG, tag, format, ##__VA_ARGS__)
+#else
+#define log_d(format, ...) ARDUHAL_LOG_NOTHING()
+#define ESP_LOGD(tag, format, ...) ARDUHAL_LOG_NOTHING()
+#endif
+#if ARDUHAL_LOG_LEVEL >= ARDUHAL_LOG_LEVEL_INFO
+#define log_i(format, ...) ARDUHAL_LOG_SITE(ARDUHAL_LOG_LEVEL_INFO, nullptr, format, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...) ARDUHAL_LOG_SITE(ARDUHAL_LOG_LEVEL_INFO, tag, format, ##__VA_ARGS__)
+#else
+#define log_i(format, ...) ARDUHAL_LOG_NOTHING()
+#define ESP_LOGI(tag, format, ...) ARDUHAL_LOG_NOTHING()
+#endif
+#if ARDUHAL_LOG_LEVEL >= ARDUHAL_LOG_LEVEL_WARN
+#define log_w(format, ...) ARDUHAL_LOG_SITE(ARDUHAL_LOG_LEVEL_WARN, nullptr, format, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) ARDUHAL_LOG_SITE(ARDUHAL_LOG_LEVEL_WARN, tag, format, ##__VA_ARGS__)
+#else
+#define log_w(format, ...) ARDUHAL_LOG_NOTHING()
+#define ESP_LOGW(tag, format, ...) ARDUHAL_LOG_NOTHING()
+#endif
+#if ARDUHAL_LOG_LEVEL >= ARDUHAL_LOG_LEVEL_ERROR
+#define log_e(format, ...) ARDUHAL_LOG_SITE(ARDUHAL_LOG_LEVEL_ERROR, nullptr, format, ##__VA_ARGS__)
+#define ESP_LOGE(tag, format, ...) ARDUHAL_LOG_SITE(ARDUHAL_LOG_LEVEL_ERROR, tag, format, ##__VA_ARGS__)
+#else
+#define log_e(format, ...) ARDUHAL_LOG_NOTHING()
+#define ESP_LOGE(tag, format, ...) ARDUHAL_LOG_NOTHING()
+#endif
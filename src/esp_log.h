@@ -0,0 +1,3 @@
+#pragma once
+// ESP-IDF code includes this for ESP_LOGx()
+#include "esp32-hal-log.h"
@@ -0,0 +1,14 @@
+#pragma once
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/// @brief Reports the microseconds since the app started, as ESP-IDF does
+/// @return The number of microseconds elapsed
+int64_t esp_timer_get_time();
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,83 @@
+#pragma once
+#include <stdint.h>
+
+/// @brief The GPIO registers that can be read and written a port (32 pins) at a time
+typedef enum gpio_register_id {
+    GPIO_REG_OUT = 0,
+    GPIO_REG_OUT_W1TS,
+    GPIO_REG_OUT_W1TC,
+    GPIO_REG_ENABLE,
+    GPIO_REG_ENABLE_W1TS,
+    GPIO_REG_ENABLE_W1TC,
+    GPIO_REG_IN
+} gpio_register_id_t;
+
+/// @brief Reads a GPIO register. This is lock free and safe from any thread
+/// @param port The port. Port 0 is pins 0-31, port 1 is 32-63, and so on up to 7
+/// @param reg The register
+/// @return One bit per pin. The write-one-to-set and write-one-to-clear registers read as 0
+uint32_t gpio_register_read(uint8_t port, gpio_register_id_t reg);
+/// @brief Writes a GPIO register, changing up to 32 pins in a single call. Only output pins are driven
+/// @param port The port. Port 0 is pins 0-31, port 1 is 32-63, and so on up to 7
+/// @param reg The register. GPIO_REG_IN is read only
+/// @param value One bit per pin
+void gpio_register_write(uint8_t port, gpio_register_id_t reg, uint32_t value);
+
+#ifdef __cplusplus
+// stands in for a memory mapped register so ESP32 code like
+// GPIO.out_w1ts = mask; works unchanged
+class gpio_register {
+    uint8_t m_port;
+    gpio_register_id_t m_reg;
+
+   public:
+    constexpr gpio_register(uint8_t port, gpio_register_id_t reg) : m_port(port), m_reg(reg) {
+    }
+    gpio_register(const gpio_register& rhs) = delete;
+    gpio_register& operator=(const gpio_register& rhs) {
+        return *this = (uint32_t)rhs;
+    }
+    gpio_register& operator=(uint32_t value) {
+        gpio_register_write(m_port, m_reg, value);
+        return *this;
+    }
+    operator uint32_t() const {
+        return gpio_register_read(m_port, m_reg);
+    }
+    gpio_register& operator|=(uint32_t value) {
+        return *this = (uint32_t)*this | value;
+    }
+    gpio_register& operator&=(uint32_t value) {
+        return *this = (uint32_t)*this & value;
+    }
+    gpio_register& operator^=(uint32_t value) {
+        return *this = (uint32_t)*this ^ value;
+    }
+};
+// the upper port registers are unions with a val member on the ESP32
+typedef struct gpio_register_val {
+    gpio_register val;
+    constexpr gpio_register_val(uint8_t port, gpio_register_id_t reg) : val(port, reg) {
+    }
+} gpio_register_val_t;
+
+/// @brief The GPIO peripheral as laid out on the ESP32: out, in and enable cover pins 0-31, and the ones ending in 1 cover pins 32-63
+typedef struct gpio_dev {
+    gpio_register out{0, GPIO_REG_OUT};
+    gpio_register out_w1ts{0, GPIO_REG_OUT_W1TS};
+    gpio_register out_w1tc{0, GPIO_REG_OUT_W1TC};
+    gpio_register_val_t out1{1, GPIO_REG_OUT};
+    gpio_register_val_t out1_w1ts{1, GPIO_REG_OUT_W1TS};
+    gpio_register_val_t out1_w1tc{1, GPIO_REG_OUT_W1TC};
+    gpio_register enable{0, GPIO_REG_ENABLE};
+    gpio_register enable_w1ts{0, GPIO_REG_ENABLE_W1TS};
+    gpio_register enable_w1tc{0, GPIO_REG_ENABLE_W1TC};
+    gpio_register_val_t enable1{1, GPIO_REG_ENABLE};
+    gpio_register_val_t enable1_w1ts{1, GPIO_REG_ENABLE_W1TS};
+    gpio_register_val_t enable1_w1tc{1, GPIO_REG_ENABLE_W1TC};
+    gpio_register in{0, GPIO_REG_IN};
+    gpio_register_val_t in1{1, GPIO_REG_IN};
+} gpio_dev_t;
+/// @brief The GPIO peripheral
+extern gpio_dev_t GPIO;
+#endif
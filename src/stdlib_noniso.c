@@ -66,6 +66,13 @@ char* ltoa(long value, char* result, int base) {
     return result;
 }
 
+#ifndef _WIN32
+// the Windows CRT provides this one, glibc doesn't
+char* itoa(int value, char* result, int base) {
+    return ltoa(value, result, base);
+}
+
+#endif
 char* lltoa (long long val, char* result, int base) {
     if(base < 2 || base > 16) {
         *result = 0;
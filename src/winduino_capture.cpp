@@ -0,0 +1,435 @@
+#include "winduino_capture.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static const char capture_magic[8] = {'W', 'D', 'C', 'A', 'P', '1', 0, 0};
+
+static void put_u8(std::vector<uint8_t>& out, uint8_t value) {
+    out.push_back(value);
+}
+static void put_u16(std::vector<uint8_t>& out, uint16_t value) {
+    out.push_back((uint8_t)value);
+    out.push_back((uint8_t)(value >> 8));
+}
+static void put_u32(std::vector<uint8_t>& out, uint32_t value) {
+    for (int i = 0; i < 4; ++i) {
+        out.push_back((uint8_t)(value >> (i * 8)));
+    }
+}
+static void put_u64(std::vector<uint8_t>& out, uint64_t value) {
+    for (int i = 0; i < 8; ++i) {
+        out.push_back((uint8_t)(value >> (i * 8)));
+    }
+}
+static uint32_t get_u32(const uint8_t* in) {
+    return in[0] | (in[1] << 8) | (in[2] << 16) | ((uint32_t)in[3] << 24);
+}
+static uint16_t get_u16(const uint8_t* in) {
+    return (uint16_t)(in[0] | (in[1] << 8));
+}
+static bool read_bytes(FILE* file, void* data, size_t size) {
+    return size == fread(data, 1, size, file);
+}
+
+static void rle_encode(const uint32_t* pixels, size_t count, std::vector<uint8_t>& out) {
+    size_t i = 0;
+    while (i < count) {
+        size_t run = 1;
+        while (i + run < count && run < 128 && pixels[i + run] == pixels[i]) {
+            ++run;
+        }
+        if (run > 1) {
+            put_u8(out, (uint8_t)(128 + run - 1));
+            put_u32(out, pixels[i]);
+            i += run;
+            continue;
+        }
+        // gather literals until the next run of two or more starts
+        size_t start = i;
+        while (i < count && i - start < 128 &&
+               !(i + 1 < count && pixels[i + 1] == pixels[i])) {
+            ++i;
+        }
+        if (i == start) {
+            // a run starts right here after all
+            continue;
+        }
+        put_u8(out, (uint8_t)(i - start - 1));
+        for (size_t j = start; j < i; ++j) {
+            put_u32(out, pixels[j]);
+        }
+    }
+}
+static bool rle_decode(const uint8_t* in, size_t size, uint32_t* pixels, size_t count) {
+    const uint8_t* end = in + size;
+    size_t i = 0;
+    while (i < count) {
+        if (in >= end) {
+            return false;
+        }
+        uint8_t control = *in++;
+        size_t n = (control & 127) + 1;
+        if (i + n > count) {
+            return false;
+        }
+        if (control & 128) {
+            if (end - in < 4) {
+                return false;
+            }
+            uint32_t value = get_u32(in);
+            in += 4;
+            for (size_t j = 0; j < n; ++j) {
+                pixels[i++] = value;
+            }
+        } else {
+            if ((size_t)(end - in) < n * 4) {
+                return false;
+            }
+            for (size_t j = 0; j < n; ++j) {
+                pixels[i++] = get_u32(in);
+                in += 4;
+            }
+        }
+    }
+    return in == end;
+}
+
+frame_recorder::frame_recorder() : m_file(nullptr), m_width(0), m_height(0), m_framebuffer(nullptr), m_timestamp(0), m_quit(false), m_running(false) {
+}
+frame_recorder::~frame_recorder() {
+    end();
+    for (frame_t* f : m_free) {
+        delete f;
+    }
+}
+bool frame_recorder::begin(const char* path, int width, int height) {
+    end();
+    if (path == nullptr || width <= 0 || height <= 0) {
+        return false;
+    }
+    m_file = fopen(path, "wb");
+    if (m_file == nullptr) {
+        return false;
+    }
+    m_width = width;
+    m_height = height;
+    std::vector<uint8_t> header;
+    header.insert(header.end(), capture_magic, capture_magic + sizeof(capture_magic));
+    put_u16(header, (uint16_t)width);
+    put_u16(header, (uint16_t)height);
+#ifdef USE_RGB
+    put_u32(header, CAPTURE_FLAG_RGB);
+#else
+    put_u32(header, 0);
+#endif
+    fwrite(header.data(), 1, header.size(), m_file);
+    // the stream has to start with everything on the display
+    m_pending.clear();
+    m_pending.add(0, 0, width, height);
+    m_framebuffer = nullptr;
+    m_quit = false;
+    m_running = true;
+    m_thread = std::thread(&frame_recorder::write_proc, this);
+    return true;
+}
+void frame_recorder::end() {
+    if (!m_running) {
+        return;
+    }
+    // write out whatever the writer was too far behind to take
+    queue_pending(true);
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_quit = true;
+    }
+    m_cond.notify_one();
+    // the writer drains the queue before it exits
+    m_thread.join();
+    m_running = false;
+    fclose(m_file);
+    m_file = nullptr;
+}
+void frame_recorder::add(const uint32_t* framebuffer, const damage_region& damage, uint64_t timestamp) {
+    if (!m_running) {
+        return;
+    }
+    for (size_t i = 0; i < damage.size(); ++i) {
+        m_pending.add(damage[i]);
+    }
+    m_framebuffer = framebuffer;
+    m_timestamp = timestamp;
+    queue_pending(false);
+}
+void frame_recorder::queue_pending(bool force) {
+    if (m_pending.empty() || m_framebuffer == nullptr) {
+        return;
+    }
+    const uint32_t* framebuffer = m_framebuffer;
+    frame_t* f = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!force && m_queue.size() >= WINDUINO_CAPTURE_QUEUE) {
+            // the writer is behind. Keep the damage for the next
+            // frame rather than blocking the app thread
+            return;
+        }
+        if (!m_free.empty()) {
+            f = m_free.back();
+            m_free.pop_back();
+        }
+    }
+    if (f == nullptr) {
+        f = new frame_t();
+    }
+    f->timestamp = m_timestamp;
+    f->damage = m_pending;
+    size_t total = 0;
+    for (size_t i = 0; i < m_pending.size(); ++i) {
+        total += m_pending[i].area();
+    }
+    f->pixels.resize(total);
+    uint32_t* dst = f->pixels.data();
+    for (size_t i = 0; i < m_pending.size(); ++i) {
+        const damage_rect_t& r = m_pending[i];
+        const uint32_t* src = framebuffer + (size_t)r.y1 * m_width + r.x1;
+        const size_t w = r.x2 - r.x1;
+        for (int y = r.y1; y < r.y2; ++y) {
+            memcpy(dst, src, w * sizeof(uint32_t));
+            dst += w;
+            src += m_width;
+        }
+    }
+    m_pending.clear();
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_queue.push_back(f);
+    }
+    m_cond.notify_one();
+}
+void frame_recorder::write_proc() {
+    // what the stream has shown so far, for the XOR encoding
+    std::vector<uint32_t> shadow((size_t)m_width * m_height, 0);
+    std::vector<uint32_t> delta;
+    std::vector<uint8_t> out;
+    std::vector<uint8_t> plain;
+    std::vector<uint8_t> xored;
+    while (true) {
+        frame_t* f;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_cond.wait(lock, [this] { return m_quit || !m_queue.empty(); });
+            if (m_queue.empty()) {
+                return;
+            }
+            f = m_queue.front();
+            m_queue.pop_front();
+        }
+        out.clear();
+        put_u64(out, f->timestamp);
+        put_u32(out, (uint32_t)f->damage.size());
+        const uint32_t* src = f->pixels.data();
+        for (size_t i = 0; i < f->damage.size(); ++i) {
+            const damage_rect_t& r = f->damage[i];
+            const size_t w = r.x2 - r.x1;
+            const size_t count = r.area();
+            delta.resize(count);
+            for (int y = r.y1; y < r.y2; ++y) {
+                uint32_t* s = shadow.data() + (size_t)y * m_width + r.x1;
+                uint32_t* d = delta.data() + (y - r.y1) * w;
+                const uint32_t* p = src + (y - r.y1) * w;
+                for (size_t x = 0; x < w; ++x) {
+                    d[x] = p[x] ^ s[x];
+                    s[x] = p[x];
+                }
+            }
+            plain.clear();
+            xored.clear();
+            rle_encode(src, count, plain);
+            rle_encode(delta.data(), count, xored);
+            const bool use_xor = xored.size() < plain.size();
+            const std::vector<uint8_t>& data = use_xor ? xored : plain;
+            put_u16(out, (uint16_t)r.x1);
+            put_u16(out, (uint16_t)r.y1);
+            put_u16(out, (uint16_t)r.x2);
+            put_u16(out, (uint16_t)r.y2);
+            put_u8(out, use_xor ? CAPTURE_ENCODING_XOR_RLE : CAPTURE_ENCODING_RLE);
+            put_u32(out, (uint32_t)data.size());
+            out.insert(out.end(), data.begin(), data.end());
+            src += count;
+        }
+        fwrite(out.data(), 1, out.size(), m_file);
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_free.push_back(f);
+    }
+}
+
+frame_player::frame_player() : m_file(nullptr), m_width(0), m_height(0), m_flags(0), m_pixels(nullptr) {
+}
+frame_player::~frame_player() {
+    end();
+}
+bool frame_player::begin(const char* path) {
+    end();
+    if (path == nullptr) {
+        return false;
+    }
+    m_file = fopen(path, "rb");
+    if (m_file == nullptr) {
+        return false;
+    }
+    uint8_t header[16];
+    if (!read_bytes(m_file, header, sizeof(header)) ||
+        0 != memcmp(header, capture_magic, sizeof(capture_magic))) {
+        end();
+        return false;
+    }
+    m_width = get_u16(header + 8);
+    m_height = get_u16(header + 10);
+    m_flags = get_u32(header + 12);
+    m_pixels = (uint32_t*)calloc((size_t)m_width * m_height, sizeof(uint32_t));
+    if (m_pixels == nullptr) {
+        end();
+        return false;
+    }
+    return true;
+}
+void frame_player::end() {
+    if (m_file != nullptr) {
+        fclose(m_file);
+        m_file = nullptr;
+    }
+    if (m_pixels != nullptr) {
+        free(m_pixels);
+        m_pixels = nullptr;
+    }
+}
+bool frame_player::peek(uint64_t* out_timestamp) {
+    if (m_file == nullptr) {
+        return false;
+    }
+    uint8_t data[8];
+    long pos = ftell(m_file);
+    bool result = read_bytes(m_file, data, sizeof(data));
+    fseek(m_file, pos, SEEK_SET);
+    if (result) {
+        *out_timestamp = get_u32(data) | ((uint64_t)get_u32(data + 4) << 32);
+    }
+    return result;
+}
+bool frame_player::next(uint64_t* out_timestamp, damage_region* out_damage) {
+    if (m_file == nullptr) {
+        return false;
+    }
+    uint8_t header[12];
+    if (!read_bytes(m_file, header, sizeof(header))) {
+        return false;
+    }
+    if (out_timestamp != nullptr) {
+        *out_timestamp = get_u32(header) | ((uint64_t)get_u32(header + 4) << 32);
+    }
+    if (out_damage != nullptr) {
+        out_damage->clear();
+    }
+    uint32_t rects = get_u32(header + 8);
+    std::vector<uint32_t> decoded;
+    for (uint32_t i = 0; i < rects; ++i) {
+        uint8_t rh[13];
+        if (!read_bytes(m_file, rh, sizeof(rh))) {
+            return false;
+        }
+        int x1 = get_u16(rh), y1 = get_u16(rh + 2), x2 = get_u16(rh + 4), y2 = get_u16(rh + 6);
+        uint8_t encoding = rh[8];
+        uint32_t size = get_u32(rh + 9);
+        if (x2 > m_width || y2 > m_height || x1 >= x2 || y1 >= y2) {
+            return false;
+        }
+        m_data.resize(size);
+        if (!read_bytes(m_file, m_data.data(), size)) {
+            return false;
+        }
+        const size_t w = x2 - x1;
+        decoded.resize(w * (y2 - y1));
+        if (!rle_decode(m_data.data(), size, decoded.data(), decoded.size())) {
+            return false;
+        }
+        for (int y = y1; y < y2; ++y) {
+            uint32_t* dst = m_pixels + (size_t)y * m_width + x1;
+            const uint32_t* src = decoded.data() + (y - y1) * w;
+            if (encoding == CAPTURE_ENCODING_XOR_RLE) {
+                for (size_t x = 0; x < w; ++x) {
+                    dst[x] ^= src[x];
+                }
+            } else {
+                memcpy(dst, src, w * sizeof(uint32_t));
+            }
+        }
+        if (out_damage != nullptr) {
+            out_damage->add(x1, y1, x2, y2);
+        }
+    }
+    return true;
+}
+
+bool capture_export_y4m(const char* capture_path, const char* y4m_path, int fps) {
+    if (fps <= 0 || y4m_path == nullptr) {
+        return false;
+    }
+    frame_player player;
+    if (!player.begin(capture_path)) {
+        return false;
+    }
+    FILE* file = fopen(y4m_path, "wb");
+    if (file == nullptr) {
+        return false;
+    }
+    const int width = player.width();
+    const int height = player.height();
+    const size_t plane = (size_t)width * height;
+    const bool rgb = 0 != (player.flags() & CAPTURE_FLAG_RGB);
+    fprintf(file, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C444\n", width, height, fps);
+    uint8_t* yuv = (uint8_t*)malloc(plane * 3);
+    if (yuv == nullptr) {
+        fclose(file);
+        return false;
+    }
+    uint64_t timestamp;
+    if (!player.peek(&timestamp)) {
+        // no frames
+        free(yuv);
+        fclose(file);
+        return true;
+    }
+    const uint64_t frame_us = 1000000 / fps;
+    uint64_t frame_time = timestamp;
+    bool more = true;
+    while (more) {
+        // apply every frame due by now
+        while (player.peek(&timestamp) && timestamp <= frame_time) {
+            if (!player.next(nullptr)) {
+                more = false;
+                break;
+            }
+        }
+        const uint32_t* pixels = player.pixels();
+        for (size_t i = 0; i < plane; ++i) {
+            uint32_t p = pixels[i];
+            int r = rgb ? (p & 0xFF) : ((p >> 16) & 0xFF);
+            int g = (p >> 8) & 0xFF;
+            int b = rgb ? ((p >> 16) & 0xFF) : (p & 0xFF);
+            // BT.601 studio swing
+            yuv[i] = (uint8_t)(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+            yuv[plane + i] = (uint8_t)(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+            yuv[plane * 2 + i] = (uint8_t)(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+        }
+        fputs("FRAME\n", file);
+        fwrite(yuv, 1, plane * 3, file);
+        if (!player.peek(&timestamp)) {
+            more = false;
+        }
+        frame_time += frame_us;
+    }
+    free(yuv);
+    fclose(file);
+    return true;
+}
@@ -0,0 +1,109 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "winduino_damage.h"
+// the number of frames the app thread can get ahead of the writer
+// before their damage starts being folded into later frames
+#ifndef WINDUINO_CAPTURE_QUEUE
+#define WINDUINO_CAPTURE_QUEUE 8
+#endif
+// Capture stream layout. Everything is little endian.
+// header: "WDCAP1\0\0", u16 width, u16 height, u32 flags
+// frame: u64 timestamp (us), u32 rect count, then per rect:
+//   u16 x1, y1, x2, y2 (x2 and y2 exclusive), u8 encoding, u32 size, data
+// Rect data is run length encoded pixels, either as they are or
+// XORed with the previous frame, whichever came out smaller.
+// Runs start with a control byte: 0-127 is that many plus one literal
+// pixels, 128-255 repeats the following pixel (control & 127) + 1 times
+#define CAPTURE_FLAG_RGB 1
+#define CAPTURE_ENCODING_RLE 0
+#define CAPTURE_ENCODING_XOR_RLE 1
+
+// records the display to a file. The app thread only copies out the
+// damaged pixels. Encoding and writing happen on a background thread
+class frame_recorder {
+    typedef struct frame {
+        uint64_t timestamp;
+        damage_region damage;
+        // each rect's pixels, one after the other
+        std::vector<uint32_t> pixels;
+    } frame_t;
+    FILE* m_file;
+    int m_width;
+    int m_height;
+    std::thread m_thread;
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    std::deque<frame_t*> m_queue;
+    // spent frames, kept so their buffers don't have to be reallocated
+    std::vector<frame_t*> m_free;
+    // damage that couldn't be queued because the writer fell behind
+    damage_region m_pending;
+    // from the last call to add(), for flushing m_pending at the end
+    const uint32_t* m_framebuffer;
+    uint64_t m_timestamp;
+    bool m_quit;
+    std::atomic<bool> m_running;
+    void queue_pending(bool force);
+    void write_proc();
+
+   public:
+    frame_recorder();
+    ~frame_recorder();
+    // the first frame written covers the whole display
+    bool begin(const char* path, int width, int height);
+    void end();
+    bool running() const {
+        return m_running.load(std::memory_order_relaxed);
+    }
+    // called from the app thread once per iteration
+    void add(const uint32_t* framebuffer, const damage_region& damage, uint64_t timestamp);
+};
+
+// reads a capture back, one frame at a time
+class frame_player {
+    FILE* m_file;
+    int m_width;
+    int m_height;
+    uint32_t m_flags;
+    uint32_t* m_pixels;
+    std::vector<uint8_t> m_data;
+
+   public:
+    frame_player();
+    ~frame_player();
+    bool begin(const char* path);
+    void end();
+    int width() const {
+        return m_width;
+    }
+    int height() const {
+        return m_height;
+    }
+    uint32_t flags() const {
+        return m_flags;
+    }
+    // the display after the last frame read, in the native pixel format
+    const uint32_t* pixels() const {
+        return m_pixels;
+    }
+    // reports the timestamp of the next frame without applying it
+    bool peek(uint64_t* out_timestamp);
+    // applies the next frame. Returns false at the end of the
+    // stream or if it's corrupt. out_damage is optional
+    bool next(uint64_t* out_timestamp, damage_region* out_damage = nullptr);
+};
+
+/// @brief Converts a capture to an uncompressed 4:4:4 YUV4MPEG2 video
+/// @param capture_path The capture to read
+/// @param y4m_path The video to write
+/// @param fps The frame rate of the video. Frames are repeated or skipped according to their timestamps
+/// @return True if successful, otherwise false
+bool capture_export_y4m(const char* capture_path, const char* y4m_path, int fps);
@@ -0,0 +1,93 @@
+#pragma once
+#include <stddef.h>
+#ifndef WINDUINO_DAMAGE_MAX_RECTS
+#define WINDUINO_DAMAGE_MAX_RECTS 16
+#endif
+// a rectangle in screen coordinates. x2 and y2 are exclusive
+typedef struct damage_rect {
+    int x1;
+    int y1;
+    int x2;
+    int y2;
+    int area() const {
+        return (x2 - x1) * (y2 - y1);
+    }
+} damage_rect_t;
+// collects the areas of the screen that have changed since the last
+// present, merging overlapping and adjacent rectangles as they come in
+class damage_region {
+    damage_rect_t m_rects[WINDUINO_DAMAGE_MAX_RECTS];
+    size_t m_count;
+    static bool touches(const damage_rect_t& a, const damage_rect_t& b) {
+        // overlapping, or sharing an edge. Rectangles that only
+        // meet at a corner are kept separate
+        bool overlap_x = a.x1 < b.x2 && b.x1 < a.x2;
+        bool overlap_y = a.y1 < b.y2 && b.y1 < a.y2;
+        bool touch_x = a.x1 <= b.x2 && b.x1 <= a.x2;
+        bool touch_y = a.y1 <= b.y2 && b.y1 <= a.y2;
+        return (overlap_x && touch_y) || (overlap_y && touch_x);
+    }
+    static damage_rect_t unite(const damage_rect_t& a, const damage_rect_t& b) {
+        damage_rect_t result;
+        result.x1 = a.x1 < b.x1 ? a.x1 : b.x1;
+        result.y1 = a.y1 < b.y1 ? a.y1 : b.y1;
+        result.x2 = a.x2 > b.x2 ? a.x2 : b.x2;
+        result.y2 = a.y2 > b.y2 ? a.y2 : b.y2;
+        return result;
+    }
+
+   public:
+    damage_region() : m_count(0) {
+    }
+    void add(const damage_rect_t& rect) {
+        if (rect.x2 <= rect.x1 || rect.y2 <= rect.y1) {
+            return;
+        }
+        damage_rect_t r = rect;
+        // growing r can make it touch rectangles it didn't
+        // before, so start over after every merge
+        size_t i = 0;
+        while (i < m_count) {
+            if (touches(m_rects[i], r)) {
+                r = unite(m_rects[i], r);
+                m_rects[i] = m_rects[--m_count];
+                i = 0;
+            } else {
+                ++i;
+            }
+        }
+        if (m_count == WINDUINO_DAMAGE_MAX_RECTS) {
+            // too fragmented. merge the pair that wastes the least area
+            size_t best = 0;
+            int best_waste = -1;
+            for (i = 0; i < m_count; ++i) {
+                int waste = unite(m_rects[i], r).area() - m_rects[i].area() - r.area();
+                if (best_waste == -1 || waste < best_waste) {
+                    best = i;
+                    best_waste = waste;
+                }
+            }
+            r = unite(m_rects[best], r);
+            m_rects[best] = m_rects[--m_count];
+            add(r);
+            return;
+        }
+        m_rects[m_count++] = r;
+    }
+    void add(int x1, int y1, int x2, int y2) {
+        damage_rect_t r = {x1, y1, x2, y2};
+        add(r);
+    }
+    bool empty() const {
+        return m_count == 0;
+    }
+    size_t size() const {
+        return m_count;
+    }
+    const damage_rect_t& operator[](size_t index) const {
+        return m_rects[index];
+    }
+    void clear() {
+        m_count = 0;
+    }
+};
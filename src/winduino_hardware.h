@@ -0,0 +1,224 @@
+#pragma once
+// The interface between the runtime and the devices it emulates.
+// Devices are usually plugins (DLLs, or shared objects off Windows)
+// that export CreateHardware or CreateHardwareEx, but they can also be
+// compiled into the app and registered with WINDUINO_HARDWARE
+#include "Arduino.h"
+typedef __cdecl void (*gpio_set_callback)(uint32_t value, void* state);
+typedef __cdecl uint8_t (*gpio_get_callback)(void* state);
+// Update() and the bus transfers come from the app thread, or the update
+// pool for parallel devices. PinChange() and PinsChanged() come from
+// whichever thread drove the pin. Off the virtual clock, ISRs run on
+// their own thread alongside loop(), so a device can be told about two
+// pin changes at once and must guard any state they share
+class hardware_interface {
+public:
+    virtual int __cdecl CanConfigure() =0;
+    virtual int __cdecl Configure(int prop, 
+                            void* data, 
+                            size_t size) =0;
+    virtual int __cdecl CanConnect() =0;
+    virtual int __cdecl Connect(uint8_t pin, 
+                            gpio_get_callback getter, 
+                            gpio_set_callback setter, 
+                            void* state) =0;
+    virtual int __cdecl CanUpdate() =0;
+    virtual int __cdecl Update() =0;
+    virtual int __cdecl CanPinChange() =0;
+    virtual int __cdecl PinChange(uint8_t pin, 
+                            uint32_t value) =0;
+    virtual int __cdecl CanTransferBitsSPI() =0;
+    virtual int __cdecl TransferBitsSPI(uint8_t* data, 
+                                    size_t size_bits) =0;
+    virtual int __cdecl CanTransferBytesI2C() =0;
+    virtual int __cdecl TransferBytesI2C(const uint8_t* in, 
+                                    size_t in_size, 
+                                    uint8_t* out, 
+                                    size_t* in_out_out_size) =0;
+    virtual int __cdecl CanAttachLog() =0;
+    virtual int __cdecl AttachLog(hardware_log_callback logger, 
+                            const char* prefix, 
+                            uint8_t level) =0;
+    virtual int __cdecl Destroy() = 0;
+};
+// the newest plugin interface this runtime understands
+#define HARDWARE_INTERFACE_VERSION 4
+// version 2 adds batched pin changes. A pin write that changes several
+// of a device's pins at once is delivered in one call. Bit n of mask
+// and values is the device's pin n. Pins above 63 still use PinChange()
+class hardware_interface_v2 : public hardware_interface {
+public:
+    virtual int __cdecl CanPinsChanged() =0;
+    virtual int __cdecl PinsChanged(uint64_t mask, 
+                            uint64_t values) =0;
+};
+// version 3 lets a device say when it next needs updating, so it isn't
+// called before every loop(). UpdateScheduled() replaces Update() for
+// devices that can. It does the work due at now_us, then sets
+// out_next_us to the time it next needs to run (on the same clock as
+// micros64()), or to 0 to be called every iteration
+class hardware_interface_v3 : public hardware_interface_v2 {
+public:
+    virtual int __cdecl CanUpdateScheduled() =0;
+    virtual int __cdecl UpdateScheduled(uint64_t now_us, 
+                            uint64_t* out_next_us) =0;
+};
+// version 4 takes a whole transfer at once as a list of segments, so a
+// command, its parameters and the data that follows cross in one call.
+// The CS and DC state of each segment is in its flags
+class hardware_interface_v4 : public hardware_interface_v3 {
+public:
+    virtual int __cdecl CanTransferSegmentsSPI() =0;
+    virtual int __cdecl TransferSegmentsSPI(const hardware_transfer_segment_t* segments, 
+                            size_t count) =0;
+    virtual int __cdecl CanTransferSegmentsI2C() =0;
+    virtual int __cdecl TransferSegmentsI2C(const hardware_transfer_segment_t* segments, 
+                            size_t count) =0;
+};
+typedef __cdecl int (*hardware_create_fn)(hardware_interface** out_hw);
+// plugins that export CreateHardwareEx are told the newest version the
+// runtime supports, and report the version they implement
+typedef __cdecl int (*hardware_create_ex_fn)(int host_version, 
+                            int* out_version, 
+                            hardware_interface** out_hw);
+typedef __cdecl int (*hardware_spi_transfer_fn)(hardware_interface* hw, 
+                            uint8_t* data, 
+                            size_t size_bits);
+typedef __cdecl int (*hardware_i2c_transfer_fn)(hardware_interface* hw, 
+                            const uint8_t* in, 
+                            size_t in_size, 
+                            uint8_t* out, 
+                            size_t* in_out_out_size);
+typedef __cdecl int (*hardware_segments_fn)(hardware_interface* hw, 
+                            const hardware_transfer_segment_t* segments, 
+                            size_t count);
+typedef __cdecl int (*hardware_pin_change_fn)(hardware_interface* hw, 
+                            uint8_t pin, 
+                            uint32_t value);
+typedef __cdecl int (*hardware_pins_changed_fn)(hardware_interface* hw, 
+                            uint64_t mask, 
+                            uint64_t values);
+// the calls on the hot paths, resolved once per device. Entries are
+// null where the device's version doesn't have them
+typedef struct hardware_dispatch {
+    hardware_pin_change_fn pin_change;
+    hardware_pins_changed_fn pins_changed;
+    hardware_spi_transfer_fn transfer_bits_spi;
+    hardware_i2c_transfer_fn transfer_bytes_i2c;
+    hardware_segments_fn transfer_segments_spi;
+    hardware_segments_fn transfer_segments_i2c;
+} hardware_dispatch_t;
+// a device compiled into the app. hardware_load() looks for these by
+// name before it tries to load a plugin
+typedef struct hardware_registration {
+    const char* name;
+    hardware_interface* (*create)();
+    const hardware_dispatch_t* dispatch;
+    hardware_registration* next;
+    hardware_registration(const char* name, hardware_interface* (*create)(), const hardware_dispatch_t* dispatch);
+} hardware_registration_t;
+
+// a base for compiled in devices. It supplies the methods a device
+// doesn't have, so a device only needs to define the ones it supports.
+// None of these are virtual. hardware_static_device calls the device's
+// own methods directly
+class hardware_device_base {
+public:
+    int CanConfigure() { return 0; }
+    int Configure(int /*prop*/, void* /*data*/, size_t /*size*/) { return -1; }
+    int CanConnect() { return 0; }
+    int Connect(uint8_t /*pin*/, gpio_get_callback /*getter*/, gpio_set_callback /*setter*/, void* /*state*/) { return -1; }
+    int CanUpdate() { return 0; }
+    int Update() { return -1; }
+    int CanPinChange() { return 0; }
+    int PinChange(uint8_t /*pin*/, uint32_t /*value*/) { return -1; }
+    int CanTransferBitsSPI() { return 0; }
+    int TransferBitsSPI(uint8_t* /*data*/, size_t /*size_bits*/) { return -1; }
+    int CanTransferBytesI2C() { return 0; }
+    int TransferBytesI2C(const uint8_t* /*in*/, size_t /*in_size*/, uint8_t* /*out*/, size_t* /*in_out_out_size*/) { return -1; }
+    int CanAttachLog() { return 0; }
+    int AttachLog(hardware_log_callback /*logger*/, const char* /*prefix*/, uint8_t /*level*/) { return -1; }
+    int CanPinsChanged() { return 0; }
+    int PinsChanged(uint64_t /*mask*/, uint64_t /*values*/) { return -1; }
+    int CanUpdateScheduled() { return 0; }
+    int UpdateScheduled(uint64_t /*now_us*/, uint64_t* /*out_next_us*/) { return -1; }
+    int CanTransferSegmentsSPI() { return 0; }
+    int TransferSegmentsSPI(const hardware_transfer_segment_t* /*segments*/, size_t /*count*/) { return -1; }
+    int CanTransferSegmentsI2C() { return 0; }
+    int TransferSegmentsI2C(const hardware_transfer_segment_t* /*segments*/, size_t /*count*/) { return -1; }
+};
+// wraps a device class in the plugin interface. The dispatch table
+// calls the device's methods without going through the vtable
+template <typename T>
+class hardware_static_device final : public hardware_interface_v4 {
+    T m_device;
+
+    static int __cdecl pin_change(hardware_interface* hw, uint8_t pin, uint32_t value) {
+        return static_cast<hardware_static_device*>(hw)->m_device.PinChange(pin, value);
+    }
+    static int __cdecl pins_changed(hardware_interface* hw, uint64_t mask, uint64_t values) {
+        return static_cast<hardware_static_device*>(hw)->m_device.PinsChanged(mask, values);
+    }
+    static int __cdecl transfer_bits_spi(hardware_interface* hw, uint8_t* data, size_t size_bits) {
+        return static_cast<hardware_static_device*>(hw)->m_device.TransferBitsSPI(data, size_bits);
+    }
+    static int __cdecl transfer_bytes_i2c(hardware_interface* hw, const uint8_t* in, size_t in_size, uint8_t* out, size_t* in_out_out_size) {
+        return static_cast<hardware_static_device*>(hw)->m_device.TransferBytesI2C(in, in_size, out, in_out_out_size);
+    }
+    static int __cdecl transfer_segments_spi(hardware_interface* hw, const hardware_transfer_segment_t* segments, size_t count) {
+        return static_cast<hardware_static_device*>(hw)->m_device.TransferSegmentsSPI(segments, count);
+    }
+    static int __cdecl transfer_segments_i2c(hardware_interface* hw, const hardware_transfer_segment_t* segments, size_t count) {
+        return static_cast<hardware_static_device*>(hw)->m_device.TransferSegmentsI2C(segments, count);
+    }
+
+public:
+    static const hardware_dispatch_t dispatch;
+    static hardware_interface* create() {
+        return new hardware_static_device();
+    }
+    T& device() { return m_device; }
+    int __cdecl CanConfigure() override { return m_device.CanConfigure(); }
+    int __cdecl Configure(int prop, void* data, size_t size) override { return m_device.Configure(prop, data, size); }
+    int __cdecl CanConnect() override { return m_device.CanConnect(); }
+    int __cdecl Connect(uint8_t pin, gpio_get_callback getter, gpio_set_callback setter, void* state) override { return m_device.Connect(pin, getter, setter, state); }
+    int __cdecl CanUpdate() override { return m_device.CanUpdate(); }
+    int __cdecl Update() override { return m_device.Update(); }
+    int __cdecl CanPinChange() override { return m_device.CanPinChange(); }
+    int __cdecl PinChange(uint8_t pin, uint32_t value) override { return m_device.PinChange(pin, value); }
+    int __cdecl CanTransferBitsSPI() override { return m_device.CanTransferBitsSPI(); }
+    int __cdecl TransferBitsSPI(uint8_t* data, size_t size_bits) override { return m_device.TransferBitsSPI(data, size_bits); }
+    int __cdecl CanTransferBytesI2C() override { return m_device.CanTransferBytesI2C(); }
+    int __cdecl TransferBytesI2C(const uint8_t* in, size_t in_size, uint8_t* out, size_t* in_out_out_size) override { return m_device.TransferBytesI2C(in, in_size, out, in_out_out_size); }
+    int __cdecl CanAttachLog() override { return m_device.CanAttachLog(); }
+    int __cdecl AttachLog(hardware_log_callback logger, const char* prefix, uint8_t level) override { return m_device.AttachLog(logger, prefix, level); }
+    int __cdecl Destroy() override {
+        delete this;
+        return 0;
+    }
+    int __cdecl CanPinsChanged() override { return m_device.CanPinsChanged(); }
+    int __cdecl PinsChanged(uint64_t mask, uint64_t values) override { return m_device.PinsChanged(mask, values); }
+    int __cdecl CanUpdateScheduled() override { return m_device.CanUpdateScheduled(); }
+    int __cdecl UpdateScheduled(uint64_t now_us, uint64_t* out_next_us) override { return m_device.UpdateScheduled(now_us, out_next_us); }
+    int __cdecl CanTransferSegmentsSPI() override { return m_device.CanTransferSegmentsSPI(); }
+    int __cdecl TransferSegmentsSPI(const hardware_transfer_segment_t* segments, size_t count) override { return m_device.TransferSegmentsSPI(segments, count); }
+    int __cdecl CanTransferSegmentsI2C() override { return m_device.CanTransferSegmentsI2C(); }
+    int __cdecl TransferSegmentsI2C(const hardware_transfer_segment_t* segments, size_t count) override { return m_device.TransferSegmentsI2C(segments, count); }
+};
+template <typename T>
+const hardware_dispatch_t hardware_static_device<T>::dispatch = {
+    pin_change,
+    pins_changed,
+    transfer_bits_spi,
+    transfer_bytes_i2c,
+    transfer_segments_spi,
+    transfer_segments_i2c};
+
+#define WINDUINO_HARDWARE_CONCAT2(x, y) x##y
+#define WINDUINO_HARDWARE_CONCAT(x, y) WINDUINO_HARDWARE_CONCAT2(x, y)
+/// @brief Compiles a device into the app so hardware_load(name) finds it without loading a plugin. The device class has the same methods as hardware_interface, minus Destroy(), and usually derives from hardware_device_base
+/// @param name The name to load it by
+/// @param type The device class
+#define WINDUINO_HARDWARE(name, type)                                                     \
+    static hardware_registration_t WINDUINO_HARDWARE_CONCAT(winduino_hardware_, __LINE__)( \
+        name, hardware_static_device<type>::create, &hardware_static_device<type>::dispatch)
@@ -0,0 +1,189 @@
+#include "winduino_hash.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define FNV_OFFSET 0xCBF29CE484222325ULL
+#define FNV_PRIME 0x100000001B3ULL
+
+// FNV-1a over whole pixels rather than bytes
+static uint64_t hash_pixels(uint64_t hash, const uint32_t* framebuffer, int stride, int x1, int y1, int x2, int y2) {
+    for (int y = y1; y < y2; ++y) {
+        const uint32_t* p = framebuffer + (size_t)y * stride + x1;
+        for (int x = x1; x < x2; ++x) {
+            hash = (hash ^ *p++) * FNV_PRIME;
+        }
+    }
+    return hash;
+}
+// FNV only carries changes upward, so spread the high bits back
+// down before combining or handing out a hash
+static uint64_t hash_finish(uint64_t hash) {
+    hash ^= hash >> 33;
+    hash *= 0xFF51AFD7ED558CCDULL;
+    hash ^= hash >> 33;
+    hash *= 0xC4CEB9FE1A85EC53ULL;
+    hash ^= hash >> 33;
+    return hash;
+}
+static uint64_t hash_combine(uint64_t hash, uint64_t value) {
+    return (hash ^ hash_finish(value)) * FNV_PRIME;
+}
+
+tile_hasher::tile_hasher() : m_width(0), m_height(0), m_columns(0), m_rows(0), m_hashes(nullptr), m_stale(nullptr) {
+}
+tile_hasher::~tile_hasher() {
+    end();
+}
+bool tile_hasher::begin(int width, int height) {
+    end();
+    m_width = width;
+    m_height = height;
+    m_columns = (width + WINDUINO_HASH_TILE_SIZE - 1) / WINDUINO_HASH_TILE_SIZE;
+    m_rows = (height + WINDUINO_HASH_TILE_SIZE - 1) / WINDUINO_HASH_TILE_SIZE;
+    size_t count = (size_t)m_columns * m_rows;
+    m_hashes = (uint64_t*)malloc(count * sizeof(uint64_t));
+    m_stale = (bool*)malloc(count * sizeof(bool));
+    if (m_hashes == nullptr || m_stale == nullptr) {
+        end();
+        return false;
+    }
+    // nothing has been hashed yet
+    memset(m_stale, 1, count * sizeof(bool));
+    return true;
+}
+void tile_hasher::end() {
+    if (m_hashes != nullptr) {
+        free(m_hashes);
+        m_hashes = nullptr;
+    }
+    if (m_stale != nullptr) {
+        free(m_stale);
+        m_stale = nullptr;
+    }
+}
+void tile_hasher::invalidate(int x1, int y1, int x2, int y2) {
+    if (m_stale == nullptr || x2 <= x1 || y2 <= y1) {
+        return;
+    }
+    int c1 = x1 / WINDUINO_HASH_TILE_SIZE;
+    int c2 = (x2 - 1) / WINDUINO_HASH_TILE_SIZE;
+    int r1 = y1 / WINDUINO_HASH_TILE_SIZE;
+    int r2 = (y2 - 1) / WINDUINO_HASH_TILE_SIZE;
+    for (int r = r1; r <= r2; ++r) {
+        memset(m_stale + (size_t)r * m_columns + c1, 1, (c2 - c1 + 1) * sizeof(bool));
+    }
+}
+uint64_t tile_hasher::hash(const uint32_t* framebuffer, int x, int y, int w, int h) {
+    if (m_hashes == nullptr || framebuffer == nullptr) {
+        return 0;
+    }
+    // clip to the screen
+    int x1 = x < 0 ? 0 : x;
+    int y1 = y < 0 ? 0 : y;
+    int x2 = x + w > m_width ? m_width : x + w;
+    int y2 = y + h > m_height ? m_height : y + h;
+    uint64_t result = FNV_OFFSET;
+    if (x2 <= x1 || y2 <= y1) {
+        return hash_finish(result);
+    }
+    int c1 = x1 / WINDUINO_HASH_TILE_SIZE;
+    int c2 = (x2 - 1) / WINDUINO_HASH_TILE_SIZE;
+    int r1 = y1 / WINDUINO_HASH_TILE_SIZE;
+    int r2 = (y2 - 1) / WINDUINO_HASH_TILE_SIZE;
+    for (int r = r1; r <= r2; ++r) {
+        int ty1 = r * WINDUINO_HASH_TILE_SIZE;
+        int ty2 = ty1 + WINDUINO_HASH_TILE_SIZE > m_height ? m_height : ty1 + WINDUINO_HASH_TILE_SIZE;
+        for (int c = c1; c <= c2; ++c) {
+            int tx1 = c * WINDUINO_HASH_TILE_SIZE;
+            int tx2 = tx1 + WINDUINO_HASH_TILE_SIZE > m_width ? m_width : tx1 + WINDUINO_HASH_TILE_SIZE;
+            uint64_t tile;
+            if (tx1 >= x1 && ty1 >= y1 && tx2 <= x2 && ty2 <= y2) {
+                // whole tile, so use (or refresh) the cached hash
+                size_t i = (size_t)r * m_columns + c;
+                if (m_stale[i]) {
+                    m_hashes[i] = hash_pixels(FNV_OFFSET, framebuffer, m_width, tx1, ty1, tx2, ty2);
+                    m_stale[i] = false;
+                }
+                tile = m_hashes[i];
+            } else {
+                // the area only covers part of this tile
+                tile = hash_pixels(FNV_OFFSET, framebuffer, m_width,
+                                   tx1 > x1 ? tx1 : x1, ty1 > y1 ? ty1 : y1,
+                                   tx2 < x2 ? tx2 : x2, ty2 < y2 ? ty2 : y2);
+            }
+            result = hash_combine(result, tile);
+        }
+    }
+    return hash_finish(result);
+}
+
+hash_manifest::hash_manifest() : m_record(false) {
+}
+bool hash_manifest::load(const char* path, bool record) {
+    m_entries.clear();
+    m_record = record;
+    if (path == nullptr) {
+        return false;
+    }
+    FILE* file = fopen(path, "r");
+    if (file == nullptr) {
+        // when recording, the manifest doesn't have to exist yet
+        return record;
+    }
+    // one area per line: name x y w h hash
+    char line[512];
+    while (fgets(line, sizeof(line), file) != nullptr) {
+        if (line[0] == '#' || line[0] == '\n' || line[0] == '\r') {
+            continue;
+        }
+        char name[256];
+        entry_t e;
+        if (6 == sscanf(line, "%255s %d %d %d %d %" SCNx64, name, &e.x, &e.y, &e.w, &e.h, &e.hash)) {
+            e.name = name;
+            m_entries.push_back(e);
+        }
+    }
+    fclose(file);
+    return true;
+}
+bool hash_manifest::save(const char* path) const {
+    if (path == nullptr) {
+        return false;
+    }
+    FILE* file = fopen(path, "w");
+    if (file == nullptr) {
+        return false;
+    }
+    fputs("# name x y w h hash\n", file);
+    for (const entry_t& e : m_entries) {
+        fprintf(file, "%s %d %d %d %d %016" PRIx64 "\n", e.name.c_str(), e.x, e.y, e.w, e.h, e.hash);
+    }
+    fclose(file);
+    return true;
+}
+bool hash_manifest::check(const char* name, int x, int y, int w, int h, uint64_t hash, uint64_t* out_expected) {
+    for (entry_t& e : m_entries) {
+        if (e.name == name) {
+            if (m_record) {
+                e.x = x;
+                e.y = y;
+                e.w = w;
+                e.h = h;
+                e.hash = hash;
+                return true;
+            }
+            *out_expected = e.hash;
+            return e.x == x && e.y == y && e.w == w && e.h == h && e.hash == hash;
+        }
+    }
+    if (m_record) {
+        m_entries.push_back({name, x, y, w, h, hash});
+        return true;
+    }
+    // not in the manifest
+    *out_expected = 0;
+    return false;
+}
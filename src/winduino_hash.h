@@ -0,0 +1,51 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#ifndef WINDUINO_HASH_TILE_SIZE
+#define WINDUINO_HASH_TILE_SIZE 16
+#endif
+// keeps a hash of each tile of the framebuffer. Flushed areas mark
+// their tiles stale and they are rehashed the next time they're asked
+// for, so checking a frame only touches what changed since the last check
+class tile_hasher {
+    int m_width;
+    int m_height;
+    int m_columns;
+    int m_rows;
+    uint64_t* m_hashes;
+    bool* m_stale;
+
+   public:
+    tile_hasher();
+    ~tile_hasher();
+    bool begin(int width, int height);
+    void end();
+    // marks the tiles under the area as changed. x2 and y2 are exclusive
+    void invalidate(int x1, int y1, int x2, int y2);
+    // hashes an area of the framebuffer. The hash combines the tiles
+    // (or the parts of them) the area covers, in row major order
+    uint64_t hash(const uint32_t* framebuffer, int x, int y, int w, int h);
+};
+// a set of named areas of the display and their expected hashes
+class hash_manifest {
+    typedef struct entry {
+        std::string name;
+        int x;
+        int y;
+        int w;
+        int h;
+        uint64_t hash;
+    } entry_t;
+    std::vector<entry_t> m_entries;
+    bool m_record;
+
+   public:
+    hash_manifest();
+    bool load(const char* path, bool record);
+    bool save(const char* path) const;
+    // in record mode, this always succeeds and stores the hash.
+    // otherwise it compares against the stored hash
+    bool check(const char* name, int x, int y, int w, int h, uint64_t hash, uint64_t* out_expected);
+};
@@ -0,0 +1,90 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+#include <type_traits>
+// a bounded queue from one producer thread to one consumer thread.
+// N must be a power of 2
+template <typename T, size_t N>
+class spsc_ring {
+    static_assert((N & (N - 1)) == 0, "N must be a power of 2");
+    T m_items[N];
+    // on their own cache lines, since each side writes its own
+    alignas(64) std::atomic<size_t> m_head;
+    alignas(64) std::atomic<size_t> m_tail;
+
+   public:
+    spsc_ring() : m_head(0), m_tail(0) {
+    }
+    // producer only. Returns false if it's full
+    bool push(const T& item) {
+        const size_t head = m_head.load(std::memory_order_relaxed);
+        if (head - m_tail.load(std::memory_order_acquire) == N) {
+            return false;
+        }
+        m_items[head & (N - 1)] = item;
+        m_head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+    // consumer only. Returns the number of items taken
+    size_t pop(T* out_items, size_t max_items) {
+        const size_t tail = m_tail.load(std::memory_order_relaxed);
+        size_t count = m_head.load(std::memory_order_acquire) - tail;
+        if (count > max_items) {
+            count = max_items;
+        }
+        for (size_t i = 0; i < count; ++i) {
+            out_items[i] = m_items[(tail + i) & (N - 1)];
+        }
+        m_tail.store(tail + count, std::memory_order_release);
+        return count;
+    }
+    // consumer only
+    void clear() {
+        m_tail.store(m_head.load(std::memory_order_acquire), std::memory_order_release);
+    }
+};
+// publishes a value from one writer to any number of readers without
+// locking. Readers retry if they catch the writer part way through
+template <typename T>
+class seqlock {
+    static_assert(std::is_trivially_copyable<T>::value, "T must be trivially copyable");
+    static constexpr size_t words = (sizeof(T) + 3) / 4;
+    std::atomic<uint32_t> m_seq;
+    // the value is copied word by word through atomics, so a torn
+    // read is caught by the sequence check rather than being a race
+    std::atomic<uint32_t> m_words[words];
+
+   public:
+    seqlock() : m_seq(0) {
+        for (size_t i = 0; i < words; ++i) {
+            m_words[i].store(0, std::memory_order_relaxed);
+        }
+    }
+    // writer only
+    void publish(const T& value) {
+        uint32_t buffer[words] = {0};
+        memcpy(buffer, &value, sizeof(T));
+        const uint32_t seq = m_seq.load(std::memory_order_relaxed);
+        // odd while writing
+        m_seq.store(seq + 1, std::memory_order_relaxed);
+        for (size_t i = 0; i < words; ++i) {
+            m_words[i].store(buffer[i], std::memory_order_release);
+        }
+        m_seq.store(seq + 2, std::memory_order_release);
+    }
+    T read() const {
+        uint32_t buffer[words];
+        uint32_t seq;
+        do {
+            seq = m_seq.load(std::memory_order_acquire);
+            for (size_t i = 0; i < words; ++i) {
+                buffer[i] = m_words[i].load(std::memory_order_acquire);
+            }
+        } while ((seq & 1) || seq != m_seq.load(std::memory_order_relaxed));
+        T result;
+        memcpy(&result, buffer, sizeof(T));
+        return result;
+    }
+};
@@ -0,0 +1,257 @@
+#include "winduino_irq.h"
+#include "winduino_trace.h"
+
+static_assert((WINDUINO_IRQ_QUEUE & (WINDUINO_IRQ_QUEUE - 1)) == 0, "WINDUINO_IRQ_QUEUE must be a power of 2");
+// how long the ISR thread keeps polling after the last edge before it
+// sleeps. Waking it costs far more than an edge at high rates does.
+// The polling yields, so it doesn't starve the threads raising edges
+#define IRQ_SPIN_NS 100000
+#define IRQ_DEFAULT_PRIORITY 1
+
+// set on the thread while it runs an ISR
+static thread_local bool irq_in_isr = false;
+
+interrupt_controller::interrupt_controller()
+    : m_head(0),
+      m_tail(0),
+      m_masked(false),
+      m_running(false),
+      m_done(0),
+      m_handler(nullptr),
+      m_clock(nullptr),
+      m_sleeping(false),
+      m_quit(false),
+      m_threaded(false) {
+    for (uint32_t i = 0; i < WINDUINO_IRQ_QUEUE; ++i) {
+        m_cells[i].seq.store(i, std::memory_order_relaxed);
+    }
+    for (int i = 0; i < IRQ_PRIORITY_LEVELS; ++i) {
+        m_pending_read[i] = 0;
+    }
+    for (int i = 0; i < 256; ++i) {
+        m_priority[i] = IRQ_DEFAULT_PRIORITY;
+        pin_stats_t& s = m_stats[i];
+        s.count = 0;
+        s.dropped = 0;
+        s.max_latency = 0;
+        s.total_latency = 0;
+        for (int j = 0; j < IRQ_HISTOGRAM_BUCKETS; ++j) {
+            s.histogram[j] = 0;
+        }
+    }
+}
+interrupt_controller::~interrupt_controller() {
+    end();
+}
+bool interrupt_controller::begin(irq_handler_fn handler, irq_clock_fn clock, bool threaded) {
+    end();
+    if (handler == nullptr || clock == nullptr) {
+        return false;
+    }
+    m_handler = handler;
+    m_clock = clock;
+    m_threaded = threaded;
+    m_quit = false;
+    if (threaded) {
+        m_thread = std::thread(&interrupt_controller::thread_proc, this);
+    }
+    return true;
+}
+void interrupt_controller::end() {
+    if (!m_thread.joinable()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_quit = true;
+    }
+    m_cond.notify_one();
+    m_thread.join();
+}
+bool interrupt_controller::raise(uint8_t pin, uint64_t timestamp) {
+    uint32_t pos = m_head.load(std::memory_order_relaxed);
+    cell_t* c;
+    while (true) {
+        c = &m_cells[pos & (WINDUINO_IRQ_QUEUE - 1)];
+        uint32_t seq = c->seq.load(std::memory_order_acquire);
+        int32_t diff = (int32_t)(seq - pos);
+        if (diff == 0) {
+            if (m_head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            // full. A real controller would lose the edge too
+            m_stats[pin].dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        } else {
+            pos = m_head.load(std::memory_order_relaxed);
+        }
+    }
+    c->edge.pin = pin;
+    c->edge.timestamp = timestamp;
+    // sequentially consistent, along with the m_sleeping accesses, so
+    // either we see the ISR thread going to sleep or it sees this edge
+    c->seq.store(pos + 1, std::memory_order_seq_cst);
+    if (m_threaded) {
+        if (m_sleeping.load(std::memory_order_seq_cst)) {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_cond.notify_one();
+        }
+    }
+    return true;
+}
+bool interrupt_controller::pop(edge_t* out_edge) {
+    cell_t& c = m_cells[m_tail & (WINDUINO_IRQ_QUEUE - 1)];
+    uint32_t seq = c.seq.load(std::memory_order_acquire);
+    if ((int32_t)(seq - (m_tail + 1)) < 0) {
+        return false;
+    }
+    *out_edge = c.edge;
+    c.seq.store(m_tail + WINDUINO_IRQ_QUEUE, std::memory_order_release);
+    ++m_tail;
+    return true;
+}
+bool interrupt_controller::queue_empty() const {
+    const cell_t& c = m_cells[m_tail & (WINDUINO_IRQ_QUEUE - 1)];
+    return (int32_t)(c.seq.load(std::memory_order_seq_cst) - (m_tail + 1)) < 0;
+}
+bool interrupt_controller::has_pending() const {
+    for (int i = 0; i < IRQ_PRIORITY_LEVELS; ++i) {
+        if (m_pending_read[i] < m_pending[i].size()) {
+            return true;
+        }
+    }
+    return false;
+}
+void interrupt_controller::drain() {
+    edge_t e;
+    while (pop(&e)) {
+        m_pending[m_priority[e.pin].load(std::memory_order_relaxed)].push_back(e);
+    }
+}
+void interrupt_controller::dispatch() {
+    if (irq_in_isr) {
+        // ISRs don't nest
+        return;
+    }
+    while (true) {
+        drain();
+        int level = IRQ_PRIORITY_LEVELS - 1;
+        while (level >= 0 && m_pending_read[level] == m_pending[level].size()) {
+            --level;
+        }
+        if (level < 0) {
+            return;
+        }
+        // claim the ISR context, then make sure nobody masked
+        // in the meantime. mask() does the same in the other order
+        m_running.store(true, std::memory_order_seq_cst);
+        if (m_masked.load(std::memory_order_seq_cst)) {
+            m_running.store(false, std::memory_order_seq_cst);
+            return;
+        }
+        std::vector<edge_t>& pending = m_pending[level];
+        edge_t e = pending[m_pending_read[level]++];
+        if (m_pending_read[level] == pending.size()) {
+            pending.clear();
+            m_pending_read[level] = 0;
+        }
+        uint64_t now = m_clock();
+        uint64_t latency = now > e.timestamp ? now - e.timestamp : 0;
+        pin_stats_t& s = m_stats[e.pin];
+        // only the consumer writes these, so no read-modify-write is needed
+        s.count.store(s.count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        s.total_latency.store(s.total_latency.load(std::memory_order_relaxed) + latency, std::memory_order_relaxed);
+        if (latency > s.max_latency.load(std::memory_order_relaxed)) {
+            s.max_latency.store(latency > UINT32_MAX ? UINT32_MAX : (uint32_t)latency, std::memory_order_relaxed);
+        }
+        int bucket = latency == 0 ? 0 : 63 - __builtin_clzll(latency);
+        if (bucket >= IRQ_HISTOGRAM_BUCKETS) {
+            bucket = IRQ_HISTOGRAM_BUCKETS - 1;
+        }
+        s.histogram[bucket].store(s.histogram[bucket].load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        irq_in_isr = true;
+        m_handler(e.pin);
+        irq_in_isr = false;
+        m_done.store(m_done.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        m_running.store(false, std::memory_order_release);
+    }
+}
+bool interrupt_controller::in_isr() {
+    return irq_in_isr;
+}
+void interrupt_controller::mask() {
+    if (irq_in_isr) {
+        // already exclusive
+        return;
+    }
+    m_masked.store(true, std::memory_order_seq_cst);
+    while (m_running.load(std::memory_order_seq_cst)) {
+        std::this_thread::yield();
+    }
+}
+void interrupt_controller::unmask() {
+    if (irq_in_isr) {
+        return;
+    }
+    m_masked.store(false, std::memory_order_seq_cst);
+    if (m_threaded && m_thread.joinable()) {
+        uint32_t target = m_head.load(std::memory_order_acquire);
+        if (m_done.load(std::memory_order_acquire) == target) {
+            return;
+        }
+        {
+            // held back edges are waiting
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_cond.notify_one();
+        }
+        // stop if someone masks again, since nothing will run until they unmask
+        while ((int32_t)(m_done.load(std::memory_order_acquire) - target) < 0 &&
+               !m_masked.load(std::memory_order_seq_cst)) {
+            std::this_thread::yield();
+        }
+    }
+}
+bool interrupt_controller::priority(uint8_t pin, uint8_t level) {
+    if (level >= IRQ_PRIORITY_LEVELS) {
+        return false;
+    }
+    m_priority[pin].store(level, std::memory_order_relaxed);
+    return true;
+}
+void interrupt_controller::stats(uint8_t pin, uint32_t* out_count, uint32_t* out_dropped, uint32_t* out_max_latency, uint64_t* out_total_latency, uint32_t* out_histogram) const {
+    const pin_stats_t& s = m_stats[pin];
+    *out_count += s.count.load(std::memory_order_relaxed);
+    *out_dropped += s.dropped.load(std::memory_order_relaxed);
+    uint32_t max_latency = s.max_latency.load(std::memory_order_relaxed);
+    if (max_latency > *out_max_latency) {
+        *out_max_latency = max_latency;
+    }
+    *out_total_latency += s.total_latency.load(std::memory_order_relaxed);
+    for (int i = 0; i < IRQ_HISTOGRAM_BUCKETS; ++i) {
+        out_histogram[i] += s.histogram[i].load(std::memory_order_relaxed);
+    }
+}
+void interrupt_controller::thread_proc() {
+    TRACE_THREAD_NAME("isr");
+    while (true) {
+        dispatch();
+        // poll for a while, since edges tend to come in bursts
+        uint64_t idle_start = m_clock();
+        while (queue_empty() && m_clock() - idle_start < IRQ_SPIN_NS) {
+            std::this_thread::yield();
+        }
+        if (!queue_empty() && !m_masked.load(std::memory_order_relaxed)) {
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_sleeping.store(true, std::memory_order_seq_cst);
+        m_cond.wait(lock, [this] {
+            return m_quit || (!m_masked.load(std::memory_order_seq_cst) && (!queue_empty() || has_pending()));
+        });
+        m_sleeping.store(false, std::memory_order_relaxed);
+        if (m_quit) {
+            return;
+        }
+    }
+}
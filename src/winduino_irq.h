@@ -0,0 +1,93 @@
+#pragma once
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+// how many edges can be waiting before new ones are dropped
+#ifndef WINDUINO_IRQ_QUEUE
+#define WINDUINO_IRQ_QUEUE 4096
+#endif
+#define IRQ_PRIORITY_LEVELS 8
+#define IRQ_HISTOGRAM_BUCKETS 32
+// runs the ISR attached to a pin
+typedef void (*irq_handler_fn)(uint8_t pin);
+// the current time in nanoseconds
+typedef uint64_t (*irq_clock_fn)();
+
+// takes edges from any thread and runs their ISRs one at a time,
+// highest priority first, either on its own thread or on whichever
+// thread calls dispatch(). Masking holds edges back until unmasked
+class interrupt_controller {
+    typedef struct edge {
+        uint8_t pin;
+        uint64_t timestamp;
+    } edge_t;
+    typedef struct cell {
+        std::atomic<uint32_t> seq;
+        edge_t edge;
+    } cell_t;
+    typedef struct pin_stats {
+        std::atomic<uint32_t> count;
+        std::atomic<uint32_t> dropped;
+        std::atomic<uint32_t> max_latency;
+        std::atomic<uint64_t> total_latency;
+        std::atomic<uint32_t> histogram[IRQ_HISTOGRAM_BUCKETS];
+    } pin_stats_t;
+    // bounded multi producer, single consumer ring. Each cell's
+    // sequence number says whether it's free for the lap a producer
+    // is on or holds an edge for the consumer
+    cell_t m_cells[WINDUINO_IRQ_QUEUE];
+    std::atomic<uint32_t> m_head;
+    uint32_t m_tail;
+    // edges taken off the ring but not dispatched yet, by priority.
+    // only the consumer touches these
+    std::vector<edge_t> m_pending[IRQ_PRIORITY_LEVELS];
+    size_t m_pending_read[IRQ_PRIORITY_LEVELS];
+    std::atomic<uint8_t> m_priority[256];
+    pin_stats_t m_stats[256];
+    std::atomic<bool> m_masked;
+    // set while an ISR runs, so masking can wait it out
+    std::atomic<bool> m_running;
+    // how many edges have been dispatched, to compare against m_head
+    std::atomic<uint32_t> m_done;
+    irq_handler_fn m_handler;
+    irq_clock_fn m_clock;
+    std::thread m_thread;
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    std::atomic<bool> m_sleeping;
+    bool m_quit;
+    bool m_threaded;
+    bool pop(edge_t* out_edge);
+    bool queue_empty() const;
+    bool has_pending() const;
+    void drain();
+    void thread_proc();
+
+   public:
+    interrupt_controller();
+    ~interrupt_controller();
+    // threaded is false to dispatch from the caller's thread instead
+    bool begin(irq_handler_fn handler, irq_clock_fn clock, bool threaded);
+    void end();
+    // queues an edge. Safe from any thread. Returns false if it was dropped
+    bool raise(uint8_t pin, uint64_t timestamp);
+    // runs every pending ISR unless masked
+    void dispatch();
+    // true if called from inside an ISR
+    static bool in_isr();
+    // holds back ISRs. Waits for one in progress to finish
+    void mask();
+    // like hardware, ISRs that were held back run before this returns
+    void unmask();
+    bool masked() const {
+        return m_masked.load(std::memory_order_relaxed);
+    }
+    // 0 to IRQ_PRIORITY_LEVELS-1. Higher runs first
+    bool priority(uint8_t pin, uint8_t level);
+    // out_histogram has IRQ_HISTOGRAM_BUCKETS entries. Bucket i counts
+    // latencies from 2^i ns up to 2^(i+1) ns. Stats are added to the outputs
+    void stats(uint8_t pin, uint32_t* out_count, uint32_t* out_dropped, uint32_t* out_max_latency, uint64_t* out_total_latency, uint32_t* out_histogram) const;
+};
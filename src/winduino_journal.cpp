@@ -0,0 +1,181 @@
+#include "winduino_journal.h"
+
+#include <string.h>
+
+static const char journal_magic[8] = {'W', 'D', 'I', 'N', 'P', '1', 0, 0};
+#define JOURNAL_RECORD_SIZE 32
+
+static void put_u16(uint8_t* out, uint16_t value) {
+    out[0] = (uint8_t)value;
+    out[1] = (uint8_t)(value >> 8);
+}
+static void put_u32(uint8_t* out, uint32_t value) {
+    for (int i = 0; i < 4; ++i) {
+        out[i] = (uint8_t)(value >> (i * 8));
+    }
+}
+static void put_u64(uint8_t* out, uint64_t value) {
+    put_u32(out, (uint32_t)value);
+    put_u32(out + 4, (uint32_t)(value >> 32));
+}
+static uint16_t get_u16(const uint8_t* in) {
+    return (uint16_t)(in[0] | (in[1] << 8));
+}
+static uint32_t get_u32(const uint8_t* in) {
+    return in[0] | (in[1] << 8) | (in[2] << 16) | ((uint32_t)in[3] << 24);
+}
+static uint64_t get_u64(const uint8_t* in) {
+    return get_u32(in) | ((uint64_t)get_u32(in + 4) << 32);
+}
+static void write_record(FILE* file, uint64_t iteration, const input_event_t& e, const uint8_t* data) {
+    uint8_t record[JOURNAL_RECORD_SIZE];
+    put_u64(record, iteration);
+    put_u64(record + 8, e.timestamp);
+    record[16] = e.kind;
+    record[17] = e.channel;
+    record[18] = e.type;
+    record[19] = 0;
+    put_u16(record + 20, (uint16_t)e.x);
+    put_u16(record + 22, (uint16_t)e.y);
+    put_u32(record + 24, e.value);
+    put_u32(record + 28, e.size);
+    fwrite(record, 1, sizeof(record), file);
+    if (e.size != 0) {
+        fwrite(data, 1, e.size, file);
+    }
+}
+
+input_journal::input_journal() : m_file(nullptr), m_mode(JOURNAL_OFF), m_next_iteration(0) {
+}
+input_journal::~input_journal() {
+    if (m_file != nullptr) {
+        fclose(m_file);
+    }
+}
+bool input_journal::record(const char* path, uint32_t seed) {
+    if (m_file != nullptr || path == nullptr) {
+        return false;
+    }
+    m_file = fopen(path, "wb");
+    if (m_file == nullptr) {
+        return false;
+    }
+    uint8_t header[16];
+    memcpy(header, journal_magic, sizeof(journal_magic));
+    put_u32(header + 8, seed);
+    put_u32(header + 12, 0);
+    fwrite(header, 1, sizeof(header), m_file);
+    m_mode.store(JOURNAL_RECORD, std::memory_order_release);
+    return true;
+}
+bool input_journal::replay(const char* path, uint32_t* out_seed) {
+    if (m_file != nullptr || path == nullptr) {
+        return false;
+    }
+    m_file = fopen(path, "rb");
+    if (m_file == nullptr) {
+        return false;
+    }
+    uint8_t header[16];
+    if (sizeof(header) != fread(header, 1, sizeof(header), m_file) ||
+        0 != memcmp(header, journal_magic, sizeof(journal_magic)) || !read_next()) {
+        fclose(m_file);
+        m_file = nullptr;
+        return false;
+    }
+    *out_seed = get_u32(header + 8);
+    m_mode.store(JOURNAL_REPLAY, std::memory_order_release);
+    return true;
+}
+void input_journal::end(uint64_t iteration) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_file == nullptr) {
+        return;
+    }
+    if (m_mode.load(std::memory_order_relaxed) == JOURNAL_RECORD) {
+        // anything still held never made it to the sketch, so it's not logged
+        input_event_t e;
+        memset(&e, 0, sizeof(e));
+        e.kind = INPUT_KIND_END;
+        write_record(m_file, iteration, e, nullptr);
+    }
+    fclose(m_file);
+    m_file = nullptr;
+    m_mode.store(JOURNAL_OFF, std::memory_order_release);
+}
+bool input_journal::read_next() {
+    uint8_t record[JOURNAL_RECORD_SIZE];
+    if (sizeof(record) != fread(record, 1, sizeof(record), m_file)) {
+        return false;
+    }
+    m_next_iteration = get_u64(record);
+    m_next.timestamp = get_u64(record + 8);
+    m_next.kind = record[16];
+    m_next.channel = record[17];
+    m_next.type = record[18];
+    m_next.x = (int16_t)get_u16(record + 20);
+    m_next.y = (int16_t)get_u16(record + 22);
+    m_next.value = get_u32(record + 24);
+    m_next.size = get_u32(record + 28);
+    m_next_data.resize(m_next.size);
+    return m_next.size == 0 || m_next.size == fread(m_next_data.data(), 1, m_next.size, m_file);
+}
+bool input_journal::capture(const input_event_t& event, const uint8_t* data) {
+    const int mode = m_mode.load(std::memory_order_acquire);
+    if (mode == JOURNAL_OFF) {
+        return false;
+    }
+    if (mode == JOURNAL_RECORD) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_pending.push_back(event);
+        if (event.size != 0) {
+            m_pending_data.insert(m_pending_data.end(), data, data + event.size);
+        }
+    }
+    // a replay supplies its own
+    return true;
+}
+bool input_journal::apply(uint64_t iteration, input_handler_fn handler) {
+    const int mode = m_mode.load(std::memory_order_acquire);
+    if (mode == JOURNAL_RECORD) {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (m_pending.empty() || m_file == nullptr) {
+                return true;
+            }
+            m_applying.swap(m_pending);
+            m_applying_data.swap(m_pending_data);
+            m_pending.clear();
+            m_pending_data.clear();
+            const uint8_t* data = m_applying_data.data();
+            for (const input_event_t& e : m_applying) {
+                write_record(m_file, iteration, e, data);
+                data += e.size;
+            }
+        }
+        // the handler may well take locks of its own
+        const uint8_t* data = m_applying_data.data();
+        for (const input_event_t& e : m_applying) {
+            handler(e, data);
+            data += e.size;
+        }
+        return true;
+    }
+    if (mode == JOURNAL_REPLAY) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_file == nullptr) {
+            return false;
+        }
+        while (m_next_iteration <= iteration) {
+            if (m_next.kind == INPUT_KIND_END) {
+                return false;
+            }
+            handler(m_next, m_next_data.data());
+            if (!read_next()) {
+                // cut short, so there's no end record
+                return false;
+            }
+        }
+    }
+    return true;
+}
@@ -0,0 +1,74 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <atomic>
+#include <mutex>
+#include <vector>
+// Input journal layout. Everything is little endian.
+// header: "WDINP1\0\0", u32 random seed, u32 reserved
+// record: u64 iteration, u64 timestamp (us), u8 kind, u8 channel,
+//   u8 type, u8 reserved, i16 x, i16 y, u32 value, u32 size, data
+// The last record is INPUT_KIND_END, at the iteration the recording stopped
+#define JOURNAL_OFF 0
+#define JOURNAL_RECORD 1
+#define JOURNAL_REPLAY 2
+// a touch_event_t. channel is the touch point and type its event type
+#define INPUT_KIND_TOUCH 1
+// a pin driven from outside the sketch. channel is the pin
+#define INPUT_KIND_PIN 2
+// bytes received on a UART. channel is the UART and data the bytes
+#define INPUT_KIND_SERIAL 3
+#define INPUT_KIND_END 4
+typedef struct input_event {
+    uint64_t timestamp;
+    uint8_t kind;
+    uint8_t channel;
+    uint8_t type;
+    int16_t x;
+    int16_t y;
+    uint32_t value;
+    // the length of the data that goes with it
+    uint32_t size;
+} input_event_t;
+typedef void (*input_handler_fn)(const input_event_t& event, const uint8_t* data);
+
+// makes a run repeatable by putting every input from outside the
+// sketch through one place. While recording, inputs are held until
+// the start of the next loop() iteration, applied then and logged
+// against that iteration. A replay applies them at the same iterations
+// and ignores live input
+class input_journal {
+    FILE* m_file;
+    std::atomic<int> m_mode;
+    std::mutex m_mutex;
+    // inputs waiting for the next iteration, and their data
+    std::vector<input_event_t> m_pending;
+    std::vector<uint8_t> m_pending_data;
+    // the app thread's copies while applying
+    std::vector<input_event_t> m_applying;
+    std::vector<uint8_t> m_applying_data;
+    // the next record of a replay
+    uint64_t m_next_iteration;
+    input_event_t m_next;
+    std::vector<uint8_t> m_next_data;
+    bool read_next();
+
+   public:
+    input_journal();
+    ~input_journal();
+    bool record(const char* path, uint32_t seed);
+    bool replay(const char* path, uint32_t* out_seed);
+    // finishes a recording at the given iteration and closes the file
+    void end(uint64_t iteration);
+    int mode() const {
+        return m_mode.load(std::memory_order_relaxed);
+    }
+    // called wherever an input arrives. Returns true if the journal
+    // took it, in which case the caller doesn't apply it
+    bool capture(const input_event_t& event, const uint8_t* data);
+    // called from the app thread at the start of each iteration to
+    // apply the inputs due. Returns false once a replay is over
+    bool apply(uint64_t iteration, input_handler_fn handler);
+};
+extern input_journal inputs;
@@ -0,0 +1,799 @@
+#include "winduino_log.h"
+
+#include <string.h>
+
+static_assert((WINDUINO_LOG_CELLS & (WINDUINO_LOG_CELLS - 1)) == 0, "WINDUINO_LOG_CELLS must be a power of 2");
+// how long the drain thread sleeps when nothing wakes it. Writers
+// only nudge it, without locking, so a wakeup can occasionally be missed
+#define LOG_IDLE_MS 50
+// the most the drain hands to the sinks at once
+#define LOG_BATCH_MAX 16384
+
+log_ring::log_ring()
+    : m_head(0),
+      m_tail(0),
+      m_written(0),
+      m_dropped(0),
+      m_dropped_writes(0),
+      m_sink_count(0),
+      m_sleeping(false),
+      m_quit(false) {
+    for (uint32_t i = 0; i < WINDUINO_LOG_CELLS; ++i) {
+        m_cells[i].seq.store(i, std::memory_order_relaxed);
+    }
+}
+log_ring::~log_ring() {
+    end();
+}
+bool log_ring::begin() {
+    if (m_thread.joinable()) {
+        return false;
+    }
+    m_quit = false;
+    m_batch.reserve(LOG_BATCH_MAX + LOG_CELL_DATA);
+    m_thread = std::thread(&log_ring::thread_proc, this);
+    return true;
+}
+void log_ring::end() {
+    if (!m_thread.joinable()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_quit = true;
+    }
+    m_cond.notify_one();
+    m_thread.join();
+}
+bool log_ring::write(const char* text, size_t size) {
+    if (size == 0) {
+        return true;
+    }
+    const size_t count = (size + LOG_CELL_DATA - 1) / LOG_CELL_DATA;
+    if (count > WINDUINO_LOG_CELLS) {
+        m_dropped.fetch_add(size, std::memory_order_relaxed);
+        m_dropped_writes.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    // claim the cells in one go so writes from different threads
+    // don't interleave. The drain frees cells in order, so if the
+    // last one is free the rest are too
+    uint32_t pos = m_head.load(std::memory_order_relaxed);
+    while (true) {
+        const uint32_t last = pos + (uint32_t)count - 1;
+        uint32_t seq = m_cells[last & (WINDUINO_LOG_CELLS - 1)].seq.load(std::memory_order_acquire);
+        int32_t diff = (int32_t)(seq - last);
+        if (diff == 0) {
+            if (m_head.compare_exchange_weak(pos, pos + (uint32_t)count, std::memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            m_dropped.fetch_add(size, std::memory_order_relaxed);
+            m_dropped_writes.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        } else {
+            pos = m_head.load(std::memory_order_relaxed);
+        }
+    }
+    m_written.fetch_add(size, std::memory_order_relaxed);
+    for (size_t i = 0; i < count; ++i) {
+        cell_t& c = m_cells[(pos + i) & (WINDUINO_LOG_CELLS - 1)];
+        size_t n = size < LOG_CELL_DATA ? size : LOG_CELL_DATA;
+        memcpy(c.data, text, n);
+        c.size = (uint32_t)n;
+        text += n;
+        size -= n;
+        c.seq.store(pos + (uint32_t)i + 1, std::memory_order_release);
+    }
+    if (m_sleeping.load(std::memory_order_relaxed)) {
+        m_cond.notify_one();
+    }
+    return true;
+}
+bool log_ring::drain() {
+    uint32_t tail = m_tail.load(std::memory_order_relaxed);
+    m_batch.clear();
+    while (m_batch.size() < LOG_BATCH_MAX) {
+        cell_t& c = m_cells[tail & (WINDUINO_LOG_CELLS - 1)];
+        if (c.seq.load(std::memory_order_acquire) != tail + 1) {
+            break;
+        }
+        m_batch.insert(m_batch.end(), c.data, c.data + c.size);
+        c.seq.store(tail + WINDUINO_LOG_CELLS, std::memory_order_release);
+        ++tail;
+    }
+    if (m_batch.empty()) {
+        return false;
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_sink_mutex);
+        for (size_t i = 0; i < m_sink_count; ++i) {
+            m_sinks[i].fn(m_batch.data(), m_batch.size(), m_sinks[i].state);
+        }
+    }
+    // only now is it out, as far as flush() is concerned
+    m_tail.store(tail, std::memory_order_release);
+    return true;
+}
+void log_ring::flush() {
+    if (!m_thread.joinable() || m_thread.get_id() == std::this_thread::get_id()) {
+        return;
+    }
+    const uint32_t target = m_head.load(std::memory_order_acquire);
+    m_cond.notify_one();
+    while ((int32_t)(m_tail.load(std::memory_order_acquire) - target) < 0) {
+        std::this_thread::yield();
+    }
+}
+bool log_ring::add_sink(log_sink_fn sink, void* state) {
+    if (sink == nullptr) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(m_sink_mutex);
+    if (m_sink_count == WINDUINO_LOG_SINKS) {
+        return false;
+    }
+    m_sinks[m_sink_count].fn = sink;
+    m_sinks[m_sink_count].state = state;
+    ++m_sink_count;
+    return true;
+}
+bool log_ring::remove_sink(log_sink_fn sink, void* state) {
+    std::lock_guard<std::mutex> lock(m_sink_mutex);
+    for (size_t i = 0; i < m_sink_count; ++i) {
+        if (m_sinks[i].fn == sink && m_sinks[i].state == state) {
+            memmove(m_sinks + i, m_sinks + i + 1, (m_sink_count - i - 1) * sizeof(sink_t));
+            --m_sink_count;
+            return true;
+        }
+    }
+    return false;
+}
+void log_ring::stats(uint64_t* out_written, uint64_t* out_dropped, uint64_t* out_dropped_writes) const {
+    *out_written = m_written.load(std::memory_order_relaxed);
+    *out_dropped = m_dropped.load(std::memory_order_relaxed);
+    *out_dropped_writes = m_dropped_writes.load(std::memory_order_relaxed);
+}
+void log_ring::thread_proc() {
+    while (true) {
+        while (drain()) {
+        }
+        std::unique_lock<std::mutex> lock(m_mutex);
+        if (m_quit) {
+            break;
+        }
+        m_sleeping.store(true, std::memory_order_seq_cst);
+        const uint32_t tail = m_tail.load(std::memory_order_relaxed);
+        if (m_cells[tail & (WINDUINO_LOG_CELLS - 1)].seq.load(std::memory_order_seq_cst) != tail + 1) {
+            m_cond.wait_for(lock, std::chrono::milliseconds(LOG_IDLE_MS));
+        }
+        m_sleeping.store(false, std::memory_order_relaxed);
+    }
+    // whatever came in while we were quitting
+    while (drain()) {
+    }
+}
+
+log_file::log_file() : m_file(nullptr), m_size(0), m_max_size(0), m_max_files(0) {
+}
+log_file::~log_file() {
+    end();
+}
+bool log_file::begin(const char* path, size_t max_size, int max_files) {
+    end();
+    if (path == nullptr || max_size == 0 || max_files < 0) {
+        return false;
+    }
+    m_file = fopen(path, "wb");
+    if (m_file == nullptr) {
+        return false;
+    }
+    m_path.assign(path, path + strlen(path) + 1);
+    m_size = 0;
+    m_max_size = max_size;
+    m_max_files = max_files;
+    return true;
+}
+void log_file::end() {
+    if (m_file != nullptr) {
+        fclose(m_file);
+        m_file = nullptr;
+    }
+}
+void log_file::rotate() {
+    fclose(m_file);
+    m_file = nullptr;
+    const char* path = m_path.data();
+    std::vector<char> from(m_path.size() + 12);
+    std::vector<char> to(m_path.size() + 12);
+    // rename() won't replace an existing file everywhere, so clear the way first
+    for (int i = m_max_files; i > 0; --i) {
+        snprintf(to.data(), to.size(), "%s.%d", path, i);
+        remove(to.data());
+        if (i > 1) {
+            snprintf(from.data(), from.size(), "%s.%d", path, i - 1);
+        } else {
+            snprintf(from.data(), from.size(), "%s", path);
+        }
+        rename(from.data(), to.data());
+    }
+    m_file = fopen(path, "wb");
+    m_size = 0;
+}
+void log_file::sink(const char* text, size_t size, void* state) {
+    log_file* file = (log_file*)state;
+    if (file->m_file == nullptr) {
+        return;
+    }
+    if (file->m_size != 0 && file->m_size + size > file->m_max_size) {
+        file->rotate();
+        if (file->m_file == nullptr) {
+            return;
+        }
+    }
+    fwrite(text, 1, size, file->m_file);
+    fflush(file->m_file);
+    file->m_size += size;
+}
+void log_stdout_sink(const char* text, size_t size, void*) {
+    fwrite(text, 1, size, stdout);
+    fflush(stdout);
+}
+
+log_filter::log_filter(uint8_t default_level) : m_default(default_level) {
+}
+void log_filter::set(const char* tag, uint8_t level) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (tag == nullptr || 0 == strcmp(tag, "*")) {
+        // everything goes back to the default
+        m_default = level;
+        m_entries.clear();
+        return;
+    }
+    for (entry_t& e : m_entries) {
+        if (0 == strncmp(e.tag, tag, sizeof(e.tag) - 1)) {
+            e.level = level;
+            return;
+        }
+    }
+    entry_t e;
+    strncpy(e.tag, tag, sizeof(e.tag) - 1);
+    e.tag[sizeof(e.tag) - 1] = 0;
+    e.level = level;
+    m_entries.push_back(e);
+}
+uint8_t log_filter::get(const char* tag) const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (tag != nullptr) {
+        for (const entry_t& e : m_entries) {
+            if (0 == strncmp(e.tag, tag, sizeof(e.tag) - 1)) {
+                return e.level;
+            }
+        }
+    }
+    return m_default;
+}
+
+static const char log_magic[8] = {'W', 'D', 'L', 'O', 'G', '1', 0, 0};
+// keeps an entry's size within its u16
+#define LOG_STR_MAX 1024
+#define LOG_RECORD_MAX 65535
+#define LOG_LENGTH_NONE 0
+#define LOG_LENGTH_HH 1
+#define LOG_LENGTH_H 2
+#define LOG_LENGTH_L 3
+#define LOG_LENGTH_LL 4
+#define LOG_LENGTH_J 5
+#define LOG_LENGTH_Z 6
+#define LOG_LENGTH_T 7
+#define LOG_LENGTH_LD 8
+// a printf conversion, like %-8.3lf
+typedef struct log_spec {
+    // the flags, and the width and precision unless they're *
+    const char* flags;
+    size_t flags_size;
+    const char* width;
+    size_t width_size;
+    const char* precision;
+    size_t precision_size;
+    bool star_width;
+    bool star_precision;
+    int length;
+    char conversion;
+} log_spec_t;
+
+static void put_u16(std::vector<uint8_t>& out, uint16_t value) {
+    out.push_back((uint8_t)value);
+    out.push_back((uint8_t)(value >> 8));
+}
+static void put_u32(std::vector<uint8_t>& out, uint32_t value) {
+    for (int i = 0; i < 4; ++i) {
+        out.push_back((uint8_t)(value >> (i * 8)));
+    }
+}
+static void put_u64(std::vector<uint8_t>& out, uint64_t value) {
+    put_u32(out, (uint32_t)value);
+    put_u32(out, (uint32_t)(value >> 32));
+}
+static void put_str(std::vector<uint8_t>& out, const char* text, size_t max) {
+    size_t size = text == nullptr ? 0 : strlen(text);
+    if (size > max) {
+        size = max;
+    }
+    put_u16(out, (uint16_t)size);
+    out.insert(out.end(), text, text + size);
+}
+static uint16_t get_u16(const uint8_t* in) {
+    return (uint16_t)(in[0] | (in[1] << 8));
+}
+static uint32_t get_u32(const uint8_t* in) {
+    return in[0] | (in[1] << 8) | (in[2] << 16) | ((uint32_t)in[3] << 24);
+}
+static uint64_t get_u64(const uint8_t* in) {
+    return get_u32(in) | ((uint64_t)get_u32(in + 4) << 32);
+}
+// finds the next conversion, copying the text before it to literal.
+// Returns nullptr at the end of the format
+static const char* log_next_spec(const char* format, log_spec_t* out_spec, std::vector<char>* literal) {
+    while (*format != 0) {
+        if (*format != '%') {
+            if (literal != nullptr) {
+                literal->push_back(*format);
+            }
+            ++format;
+            continue;
+        }
+        if (format[1] == '%') {
+            if (literal != nullptr) {
+                literal->push_back('%');
+            }
+            format += 2;
+            continue;
+        }
+        const char* p = format + 1;
+        out_spec->flags = p;
+        while (*p != 0 && strchr("-+ #0", *p) != nullptr) {
+            ++p;
+        }
+        out_spec->flags_size = p - out_spec->flags;
+        out_spec->star_width = *p == '*';
+        out_spec->width = p;
+        if (out_spec->star_width) {
+            ++p;
+        } else {
+            while (*p >= '0' && *p <= '9') {
+                ++p;
+            }
+        }
+        out_spec->width_size = out_spec->star_width ? 0 : p - out_spec->width;
+        out_spec->star_precision = false;
+        out_spec->precision = p;
+        out_spec->precision_size = 0;
+        if (*p == '.') {
+            ++p;
+            if (*p == '*') {
+                out_spec->star_precision = true;
+                ++p;
+            } else {
+                while (*p >= '0' && *p <= '9') {
+                    ++p;
+                }
+                out_spec->precision_size = p - out_spec->precision;
+            }
+        }
+        out_spec->length = LOG_LENGTH_NONE;
+        if (p[0] == 'h' && p[1] == 'h') {
+            out_spec->length = LOG_LENGTH_HH;
+            p += 2;
+        } else if (p[0] == 'l' && p[1] == 'l') {
+            out_spec->length = LOG_LENGTH_LL;
+            p += 2;
+        } else if (*p != 0 && strchr("hljztL", *p) != nullptr) {
+            const char* lengths = "hljztL";
+            static const int codes[] = {LOG_LENGTH_H, LOG_LENGTH_L, LOG_LENGTH_J, LOG_LENGTH_Z, LOG_LENGTH_T, LOG_LENGTH_LD};
+            out_spec->length = codes[strchr(lengths, *p) - lengths];
+            ++p;
+        }
+        if (*p == 0) {
+            return nullptr;
+        }
+        out_spec->conversion = *p;
+        return p + 1;
+    }
+    return nullptr;
+}
+void log_encode_header(std::vector<uint8_t>& out) {
+    out.insert(out.end(), log_magic, log_magic + sizeof(log_magic));
+    put_u32(out, 0);
+}
+void log_encode_site(std::vector<uint8_t>& out, uint32_t id, uint8_t level, uint32_t line, const char* tag, const char* file, const char* function, const char* format) {
+    const size_t start = out.size();
+    out.push_back(LOG_RECORD_SITE);
+    put_u16(out, 0);
+    put_u32(out, id);
+    out.push_back(level);
+    put_u32(out, line);
+    put_str(out, tag, LOG_STR_MAX);
+    put_str(out, file, LOG_STR_MAX);
+    put_str(out, function, LOG_STR_MAX);
+    put_str(out, format, LOG_STR_MAX * 8);
+    const size_t size = out.size() - start - 3;
+    out[start + 1] = (uint8_t)size;
+    out[start + 2] = (uint8_t)(size >> 8);
+}
+void log_encode_entry(std::vector<uint8_t>& out, uint32_t id, uint64_t timestamp, const char* format, va_list args) {
+    const size_t start = out.size();
+    out.push_back(LOG_RECORD_ENTRY);
+    put_u16(out, 0);
+    put_u32(out, id);
+    put_u64(out, timestamp);
+    log_spec_t spec;
+    while ((format = log_next_spec(format, &spec, nullptr)) != nullptr) {
+        if (spec.star_width) {
+            out.push_back(LOG_ARG_INT);
+            put_u64(out, (uint64_t)(int64_t)va_arg(args, int));
+        }
+        if (spec.star_precision) {
+            out.push_back(LOG_ARG_INT);
+            put_u64(out, (uint64_t)(int64_t)va_arg(args, int));
+        }
+        switch (spec.conversion) {
+            case 'd':
+            case 'i': {
+                int64_t value;
+                switch (spec.length) {
+                    // promoted to int, so narrowed here the way printf() would
+                    case LOG_LENGTH_HH:
+                        value = (signed char)va_arg(args, int);
+                        break;
+                    case LOG_LENGTH_H:
+                        value = (short)va_arg(args, int);
+                        break;
+                    case LOG_LENGTH_L:
+                        value = va_arg(args, long);
+                        break;
+                    case LOG_LENGTH_LL:
+                        value = va_arg(args, long long);
+                        break;
+                    case LOG_LENGTH_J:
+                        value = va_arg(args, intmax_t);
+                        break;
+                    case LOG_LENGTH_Z:
+                    case LOG_LENGTH_T:
+                        value = va_arg(args, ptrdiff_t);
+                        break;
+                    default:
+                        value = va_arg(args, int);
+                        break;
+                }
+                out.push_back(LOG_ARG_INT);
+                put_u64(out, (uint64_t)value);
+            } break;
+            case 'u':
+            case 'o':
+            case 'x':
+            case 'X':
+            case 'c': {
+                uint64_t value;
+                switch (spec.length) {
+                    case LOG_LENGTH_HH:
+                        value = (unsigned char)va_arg(args, unsigned int);
+                        break;
+                    case LOG_LENGTH_H:
+                        value = (unsigned short)va_arg(args, unsigned int);
+                        break;
+                    case LOG_LENGTH_L:
+                        value = va_arg(args, unsigned long);
+                        break;
+                    case LOG_LENGTH_LL:
+                        value = va_arg(args, unsigned long long);
+                        break;
+                    case LOG_LENGTH_J:
+                        value = va_arg(args, uintmax_t);
+                        break;
+                    case LOG_LENGTH_Z:
+                    case LOG_LENGTH_T:
+                        value = va_arg(args, size_t);
+                        break;
+                    default:
+                        value = va_arg(args, unsigned int);
+                        break;
+                }
+                out.push_back(LOG_ARG_UINT);
+                put_u64(out, value);
+            } break;
+            case 'p':
+                out.push_back(LOG_ARG_UINT);
+                put_u64(out, (uint64_t)(uintptr_t)va_arg(args, void*));
+                break;
+            case 'f':
+            case 'F':
+            case 'e':
+            case 'E':
+            case 'g':
+            case 'G':
+            case 'a':
+            case 'A': {
+                double value = spec.length == LOG_LENGTH_LD ? (double)va_arg(args, long double) : va_arg(args, double);
+                uint64_t bits;
+                memcpy(&bits, &value, sizeof(bits));
+                out.push_back(LOG_ARG_FLOAT);
+                put_u64(out, bits);
+            } break;
+            case 's': {
+                // wide strings aren't supported
+                const char* text = spec.length == LOG_LENGTH_L ? (va_arg(args, void*), "?") : va_arg(args, const char*);
+                if (text == nullptr) {
+                    text = "(null)";
+                }
+                size_t room = LOG_RECORD_MAX - (out.size() - start) - 3;
+                out.push_back(LOG_ARG_STR);
+                put_str(out, text, room < LOG_STR_MAX ? room : LOG_STR_MAX);
+            } break;
+            case 'n':
+                va_arg(args, void*);
+                break;
+        }
+        if (out.size() - start > LOG_RECORD_MAX - LOG_STR_MAX) {
+            // no room for more, so the rest of the arguments show as missing
+            break;
+        }
+    }
+    const size_t size = out.size() - start - 3;
+    out[start + 1] = (uint8_t)size;
+    out[start + 2] = (uint8_t)(size >> 8);
+}
+static const char* log_file_name(const char* path) {
+    const char* name = path;
+    for (const char* p = path; *p != 0; ++p) {
+        if (*p == '/' || *p == '\\') {
+            name = p + 1;
+        }
+    }
+    return name;
+}
+size_t log_format_prefix(char* out, size_t size, uint64_t timestamp, uint8_t level, const char* tag, const char* file, uint32_t line, const char* function) {
+    static const char letters[] = "NEWIDV";
+    const char letter = level < sizeof(letters) - 1 ? letters[level] : '?';
+    int result;
+    if (tag == nullptr) {
+        // as the ESP32 core does for log_x()
+        result = snprintf(out, size, "[%6u][%c][%s:%u] %s(): ", (unsigned)(timestamp / 1000), letter, log_file_name(file),
+                          (unsigned)line, function);
+    } else {
+        // as ESP-IDF does for ESP_LOGx()
+        result = snprintf(out, size, "%c (%u) %s: ", letter, (unsigned)(timestamp / 1000), tag);
+    }
+    if (result < 0) {
+        return 0;
+    }
+    return (size_t)result < size ? (size_t)result : size - 1;
+}
+
+log_reader::log_reader() : m_file(nullptr) {
+}
+log_reader::~log_reader() {
+    end();
+}
+bool log_reader::begin(const char* path) {
+    end();
+    m_file = fopen(path, "rb");
+    if (m_file == nullptr) {
+        return false;
+    }
+    uint8_t header[12];
+    if (sizeof(header) != fread(header, 1, sizeof(header), m_file) || 0 != memcmp(header, log_magic, sizeof(log_magic))) {
+        end();
+        return false;
+    }
+    return true;
+}
+void log_reader::end() {
+    if (m_file != nullptr) {
+        fclose(m_file);
+        m_file = nullptr;
+    }
+    m_sites.clear();
+}
+// reads a u16 length and text, with a terminator
+static bool read_str(const uint8_t*& in, const uint8_t* end, std::vector<char>& out) {
+    if (end - in < 2) {
+        return false;
+    }
+    uint16_t size = get_u16(in);
+    in += 2;
+    if (end - in < size) {
+        return false;
+    }
+    out.assign((const char*)in, (const char*)in + size);
+    out.push_back(0);
+    in += size;
+    return true;
+}
+static void append_format(std::vector<char>& out, const char* format, ...) {
+    char buf[64];
+    va_list args;
+    va_start(args, format);
+    int size = vsnprintf(buf, sizeof(buf), format, args);
+    va_end(args);
+    if (size < 0) {
+        return;
+    }
+    if ((size_t)size < sizeof(buf)) {
+        out.insert(out.end(), buf, buf + size);
+        return;
+    }
+    const size_t at = out.size();
+    out.resize(at + size + 1);
+    va_start(args, format);
+    vsnprintf(out.data() + at, size + 1, format, args);
+    va_end(args);
+    out.pop_back();
+}
+bool log_reader::next(std::vector<char>& out) {
+    out.clear();
+    if (m_file == nullptr) {
+        return false;
+    }
+    while (true) {
+        uint8_t head[3];
+        if (sizeof(head) != fread(head, 1, sizeof(head), m_file)) {
+            return false;
+        }
+        const uint16_t size = get_u16(head + 1);
+        m_record.resize(size);
+        if (size != fread(m_record.data(), 1, size, m_file)) {
+            return false;
+        }
+        const uint8_t* in = m_record.data();
+        const uint8_t* end = in + size;
+        if (head[0] == LOG_RECORD_SITE) {
+            if (size < 9) {
+                continue;
+            }
+            uint32_t id = get_u32(in);
+            if (id >= m_sites.size()) {
+                m_sites.resize(id + 1);
+            }
+            site_t& site = m_sites[id];
+            site.level = in[4];
+            site.line = get_u32(in + 5);
+            in += 9;
+            read_str(in, end, site.tag) && read_str(in, end, site.file) && read_str(in, end, site.function) &&
+                read_str(in, end, site.format);
+            continue;
+        }
+        if (head[0] != LOG_RECORD_ENTRY || size < 12) {
+            // from a later version
+            continue;
+        }
+        const uint32_t id = get_u32(in);
+        const uint64_t timestamp = get_u64(in + 4);
+        in += 12;
+        if (id >= m_sites.size() || m_sites[id].format.empty()) {
+            // its site was dropped
+            append_format(out, "[%6u][?] (unknown log site %u)\r\n", (unsigned)(timestamp / 1000), (unsigned)id);
+            return true;
+        }
+        const site_t& site = m_sites[id];
+        char prefix[256];
+        size_t prefix_size = log_format_prefix(prefix, sizeof(prefix), timestamp, site.level,
+                                               site.tag.size() > 1 ? site.tag.data() : nullptr,
+                                               site.file.data(), site.line, site.function.data());
+        out.insert(out.end(), prefix, prefix + prefix_size);
+        const char* format = site.format.data();
+        log_spec_t spec;
+        // pulls the next argument of the kind expected, if it's there
+        auto arg = [&](char kind, uint64_t* value, std::vector<char>* text) {
+            if (in >= end || *in != kind) {
+                return false;
+            }
+            ++in;
+            if (kind == LOG_ARG_STR) {
+                return read_str(in, end, *text);
+            }
+            if (end - in < 8) {
+                return false;
+            }
+            *value = get_u64(in);
+            in += 8;
+            return true;
+        };
+        while ((format = log_next_spec(format, &spec, &out)) != nullptr) {
+            uint64_t value;
+            std::vector<char> rebuilt;
+            rebuilt.push_back('%');
+            rebuilt.insert(rebuilt.end(), spec.flags, spec.flags + spec.flags_size);
+            if (spec.star_width) {
+                if (!arg(LOG_ARG_INT, &value, nullptr)) {
+                    break;
+                }
+                append_format(rebuilt, "%d", (int)(int64_t)value);
+            } else {
+                rebuilt.insert(rebuilt.end(), spec.width, spec.width + spec.width_size);
+            }
+            if (spec.star_precision) {
+                if (!arg(LOG_ARG_INT, &value, nullptr)) {
+                    break;
+                }
+                append_format(rebuilt, ".%d", (int)(int64_t)value);
+            } else {
+                rebuilt.insert(rebuilt.end(), spec.precision, spec.precision + spec.precision_size);
+            }
+            bool ok = true;
+            switch (spec.conversion) {
+                case 'd':
+                case 'i':
+                    rebuilt.push_back('l');
+                    rebuilt.push_back('l');
+                    rebuilt.push_back(spec.conversion);
+                    rebuilt.push_back(0);
+                    ok = arg(LOG_ARG_INT, &value, nullptr);
+                    if (ok) {
+                        append_format(out, rebuilt.data(), (long long)(int64_t)value);
+                    }
+                    break;
+                case 'c':
+                    rebuilt.push_back('c');
+                    rebuilt.push_back(0);
+                    ok = arg(LOG_ARG_UINT, &value, nullptr);
+                    if (ok) {
+                        append_format(out, rebuilt.data(), (int)value);
+                    }
+                    break;
+                case 'u':
+                case 'o':
+                case 'x':
+                case 'X':
+                    rebuilt.push_back('l');
+                    rebuilt.push_back('l');
+                    rebuilt.push_back(spec.conversion);
+                    rebuilt.push_back(0);
+                    ok = arg(LOG_ARG_UINT, &value, nullptr);
+                    if (ok) {
+                        append_format(out, rebuilt.data(), (unsigned long long)value);
+                    }
+                    break;
+                case 'p':
+                    // the pointer came from the app, so it's shown as a number
+                    ok = arg(LOG_ARG_UINT, &value, nullptr);
+                    if (ok) {
+                        append_format(out, "0x%llx", (unsigned long long)value);
+                    }
+                    break;
+                case 'f':
+                case 'F':
+                case 'e':
+                case 'E':
+                case 'g':
+                case 'G':
+                case 'a':
+                case 'A': {
+                    rebuilt.push_back(spec.conversion);
+                    rebuilt.push_back(0);
+                    ok = arg(LOG_ARG_FLOAT, &value, nullptr);
+                    if (ok) {
+                        double d;
+                        memcpy(&d, &value, sizeof(d));
+                        append_format(out, rebuilt.data(), d);
+                    }
+                } break;
+                case 's': {
+                    std::vector<char> text;
+                    rebuilt.push_back('s');
+                    rebuilt.push_back(0);
+                    ok = arg(LOG_ARG_STR, &value, &text);
+                    if (ok) {
+                        append_format(out, rebuilt.data(), text.data());
+                    }
+                } break;
+            }
+            if (!ok) {
+                break;
+            }
+        }
+        out.push_back('\r');
+        out.push_back('\n');
+        return true;
+    }
+}
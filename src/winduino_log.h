@@ -0,0 +1,156 @@
+#pragma once
+#include <stddef.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+// the number of cells in the log ring. Must be a power of 2
+#ifndef WINDUINO_LOG_CELLS
+#define WINDUINO_LOG_CELLS 4096
+#endif
+#ifndef WINDUINO_LOG_SINKS
+#define WINDUINO_LOG_SINKS 8
+#endif
+// Binary log layout, for log_x() calls when formatting is deferred.
+// Everything is little endian.
+// header: "WDLOG1\0\0", u32 reserved
+// record: u8 type, u16 size of the rest, then
+//   LOG_RECORD_SITE: u32 id, u8 level, u32 line, then the tag, file,
+//     function and format, each as u16 length and text
+//   LOG_RECORD_ENTRY: u32 id, u64 timestamp (us), then for each
+//     argument a kind byte followed by 8 bytes for LOG_ARG_INT,
+//     LOG_ARG_UINT and LOG_ARG_FLOAT, or u16 length and text for LOG_ARG_STR
+// A site is written before the first entry that refers to it
+#define LOG_RECORD_SITE 1
+#define LOG_RECORD_ENTRY 2
+#define LOG_ARG_INT 'i'
+#define LOG_ARG_UINT 'u'
+#define LOG_ARG_FLOAT 'f'
+#define LOG_ARG_STR 's'
+// the text each cell holds, which keeps a cell at 64 bytes
+#define LOG_CELL_DATA 56
+typedef void (*log_sink_fn)(const char* text, size_t size, void* state);
+
+// carries log output from any thread to a drain thread, which hands
+// it to the sinks in batches. Writers never wait. When they outrun
+// the drain, whole writes are dropped and counted
+class log_ring {
+    typedef struct cell {
+        std::atomic<uint32_t> seq;
+        uint32_t size;
+        char data[LOG_CELL_DATA];
+    } cell_t;
+    typedef struct sink {
+        log_sink_fn fn;
+        void* state;
+    } sink_t;
+    alignas(64) std::atomic<uint32_t> m_head;
+    // only the drain thread moves this. It's published for flush()
+    alignas(64) std::atomic<uint32_t> m_tail;
+    cell_t m_cells[WINDUINO_LOG_CELLS];
+    std::atomic<uint64_t> m_written;
+    std::atomic<uint64_t> m_dropped;
+    std::atomic<uint64_t> m_dropped_writes;
+    std::mutex m_sink_mutex;
+    sink_t m_sinks[WINDUINO_LOG_SINKS];
+    size_t m_sink_count;
+    std::vector<char> m_batch;
+    std::thread m_thread;
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    std::atomic<bool> m_sleeping;
+    std::atomic<bool> m_quit;
+    bool drain();
+    void thread_proc();
+
+   public:
+    log_ring();
+    ~log_ring();
+    // starts the drain thread. Anything written before then waits in the ring
+    bool begin();
+    // drains what's left and stops the drain thread
+    void end();
+    // returns false if the text was dropped
+    bool write(const char* text, size_t size);
+    // waits until everything written so far has gone to the sinks
+    void flush();
+    bool add_sink(log_sink_fn sink, void* state);
+    bool remove_sink(log_sink_fn sink, void* state);
+    void stats(uint64_t* out_written, uint64_t* out_dropped, uint64_t* out_dropped_writes) const;
+};
+extern log_ring log_output;
+
+// a log sink that writes to a file, starting a new one when it gets
+// too big. The older files get .1, .2 and so on, up to max_files
+class log_file {
+    FILE* m_file;
+    std::vector<char> m_path;
+    size_t m_size;
+    size_t m_max_size;
+    int m_max_files;
+    void rotate();
+
+   public:
+    log_file();
+    ~log_file();
+    bool begin(const char* path, size_t max_size, int max_files);
+    void end();
+    bool running() const {
+        return m_file != nullptr;
+    }
+    static void sink(const char* text, size_t size, void* state);
+};
+// a log sink that writes to stdout
+void log_stdout_sink(const char* text, size_t size, void* state);
+
+// the runtime log levels, by tag. "*" sets the level for the tags
+// that aren't listed
+class log_filter {
+    typedef struct entry {
+        char tag[32];
+        uint8_t level;
+    } entry_t;
+    mutable std::mutex m_mutex;
+    std::vector<entry_t> m_entries;
+    uint8_t m_default;
+
+   public:
+    log_filter(uint8_t default_level);
+    void set(const char* tag, uint8_t level);
+    uint8_t get(const char* tag) const;
+};
+
+// builds binary log records. They're appended to out
+void log_encode_header(std::vector<uint8_t>& out);
+void log_encode_site(std::vector<uint8_t>& out, uint32_t id, uint8_t level, uint32_t line, const char* tag, const char* file, const char* function, const char* format);
+// stores the arguments format calls for, without formatting them
+void log_encode_entry(std::vector<uint8_t>& out, uint32_t id, uint64_t timestamp, const char* format, va_list args);
+// writes the start of a log_x() or ESP_LOGx() line. Returns its length
+size_t log_format_prefix(char* out, size_t size, uint64_t timestamp, uint8_t level, const char* tag, const char* file, uint32_t line, const char* function);
+
+// turns a binary log back into text
+class log_reader {
+    typedef struct site {
+        uint8_t level;
+        uint32_t line;
+        std::vector<char> tag;
+        std::vector<char> file;
+        std::vector<char> function;
+        std::vector<char> format;
+    } site_t;
+    FILE* m_file;
+    std::vector<site_t> m_sites;
+    std::vector<uint8_t> m_record;
+
+   public:
+    log_reader();
+    ~log_reader();
+    bool begin(const char* path);
+    void end();
+    // formats the next entry into out, as the log would have shown it
+    bool next(std::vector<char>& out);
+};
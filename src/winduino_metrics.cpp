@@ -0,0 +1,171 @@
+#include "winduino_metrics.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+metric_histogram::metric_histogram() {
+    reset();
+}
+uint64_t metric_histogram::bucket_end(size_t index) {
+    if (index < METRIC_SUB_BUCKETS) {
+        return index;
+    }
+    const int exponent = (int)(index / METRIC_SUB_BUCKETS) + METRIC_SUB_BITS - 1;
+    const uint64_t sub = index % METRIC_SUB_BUCKETS;
+    const uint64_t start = (METRIC_SUB_BUCKETS + sub) << (exponent - METRIC_SUB_BITS);
+    return start + ((uint64_t)1 << (exponent - METRIC_SUB_BITS)) - 1;
+}
+void metric_histogram::record(uint64_t value) {
+    m_buckets[bucket(value)].fetch_add(1, std::memory_order_relaxed);
+    m_count.fetch_add(1, std::memory_order_relaxed);
+    m_sum.fetch_add(value, std::memory_order_relaxed);
+    uint64_t current = m_min.load(std::memory_order_relaxed);
+    while (value < current && !m_min.compare_exchange_weak(current, value, std::memory_order_relaxed)) {
+    }
+    current = m_max.load(std::memory_order_relaxed);
+    while (value > current && !m_max.compare_exchange_weak(current, value, std::memory_order_relaxed)) {
+    }
+}
+void metric_histogram::reset() {
+    for (size_t i = 0; i < METRIC_BUCKETS; ++i) {
+        m_buckets[i].store(0, std::memory_order_relaxed);
+    }
+    m_count.store(0, std::memory_order_relaxed);
+    m_sum.store(0, std::memory_order_relaxed);
+    m_min.store(UINT64_MAX, std::memory_order_relaxed);
+    m_max.store(0, std::memory_order_relaxed);
+}
+uint64_t metric_histogram::min() const {
+    uint64_t result = m_min.load(std::memory_order_relaxed);
+    return result == UINT64_MAX ? 0 : result;
+}
+uint64_t metric_histogram::percentile(double fraction) const {
+    uint64_t total = 0;
+    for (size_t i = 0; i < METRIC_BUCKETS; ++i) {
+        total += m_buckets[i].load(std::memory_order_relaxed);
+    }
+    if (total == 0) {
+        return 0;
+    }
+    uint64_t rank = (uint64_t)(fraction * total + 0.5);
+    if (rank == 0) {
+        rank = 1;
+    }
+    uint64_t seen = 0;
+    for (size_t i = 0; i < METRIC_BUCKETS; ++i) {
+        seen += m_buckets[i].load(std::memory_order_relaxed);
+        if (seen >= rank) {
+            // the top of the bucket, but never past what was recorded
+            uint64_t end = bucket_end(i);
+            uint64_t highest = max();
+            return end < highest ? end : highest;
+        }
+    }
+    return max();
+}
+
+void* metrics_registry::find_or_add(const char* name, int kind) {
+    if (name == nullptr) {
+        return nullptr;
+    }
+    std::lock_guard<std::mutex> lock(m_mutex);
+    const size_t count = m_count.load(std::memory_order_relaxed);
+    for (size_t i = 0; i < count; ++i) {
+        if (0 == strncmp(m_entries[i].name, name, METRIC_NAME_MAX - 1)) {
+            return m_entries[i].kind == kind ? m_entries[i].metric : nullptr;
+        }
+    }
+    if (count == WINDUINO_METRICS_MAX) {
+        return nullptr;
+    }
+    entry_t& e = m_entries[count];
+    strncpy(e.name, name, METRIC_NAME_MAX - 1);
+    e.name[METRIC_NAME_MAX - 1] = 0;
+    e.kind = kind;
+    if (kind == METRIC_COUNTER) {
+        e.metric = new metric_counter();
+    } else {
+        e.metric = new metric_histogram();
+    }
+    m_count.store(count + 1, std::memory_order_release);
+    return e.metric;
+}
+metric_counter* metrics_registry::counter(const char* name) {
+    return (metric_counter*)find_or_add(name, METRIC_COUNTER);
+}
+metric_histogram* metrics_registry::histogram(const char* name) {
+    return (metric_histogram*)find_or_add(name, METRIC_HISTOGRAM);
+}
+int metrics_registry::find(const char* name, void** out_metric) const {
+    const size_t count = m_count.load(std::memory_order_acquire);
+    for (size_t i = 0; i < count; ++i) {
+        if (0 == strncmp(m_entries[i].name, name, METRIC_NAME_MAX - 1)) {
+            *out_metric = m_entries[i].metric;
+            return m_entries[i].kind;
+        }
+    }
+    return -1;
+}
+void metrics_registry::reset() {
+    const size_t count = m_count.load(std::memory_order_acquire);
+    for (size_t i = 0; i < count; ++i) {
+        if (m_entries[i].kind == METRIC_COUNTER) {
+            ((metric_counter*)m_entries[i].metric)->reset();
+        } else {
+            ((metric_histogram*)m_entries[i].metric)->reset();
+        }
+    }
+}
+static void append_json(std::vector<char>& out, const char* format, ...) {
+    char buf[256];
+    va_list args;
+    va_start(args, format);
+    int size = vsnprintf(buf, sizeof(buf), format, args);
+    va_end(args);
+    if (size > 0) {
+        out.insert(out.end(), buf, buf + (size < (int)sizeof(buf) ? size : (int)sizeof(buf) - 1));
+    }
+}
+void metrics_registry::write_json(std::vector<char>& out, uint64_t elapsed_us) const {
+    const size_t count = m_count.load(std::memory_order_acquire);
+    const double seconds = elapsed_us / 1000000.0;
+    append_json(out, "{\n  \"elapsed_us\": %llu,\n  \"counters\": {", (unsigned long long)elapsed_us);
+    bool first = true;
+    for (size_t i = 0; i < count; ++i) {
+        const entry_t& e = m_entries[i];
+        if (e.kind != METRIC_COUNTER) {
+            continue;
+        }
+        const uint64_t value = ((const metric_counter*)e.metric)->value();
+        if (value == 0) {
+            continue;
+        }
+        // names are ours or the sketch's, and don't need escaping
+        append_json(out, "%s\n    \"%s\": {\"value\": %llu, \"per_second\": %.1f}", first ? "" : ",", e.name,
+                    (unsigned long long)value, seconds > 0 ? value / seconds : 0.0);
+        first = false;
+    }
+    append_json(out, "\n  },\n  \"histograms\": {");
+    first = true;
+    for (size_t i = 0; i < count; ++i) {
+        const entry_t& e = m_entries[i];
+        if (e.kind != METRIC_HISTOGRAM) {
+            continue;
+        }
+        const metric_histogram& h = *(const metric_histogram*)e.metric;
+        const uint64_t samples = h.count();
+        if (samples == 0) {
+            continue;
+        }
+        append_json(out,
+                    "%s\n    \"%s\": {\"count\": %llu, \"min\": %llu, \"mean\": %.1f, \"p50\": %llu, \"p90\": %llu, "
+                    "\"p99\": %llu, \"p999\": %llu, \"max\": %llu}",
+                    first ? "" : ",", e.name, (unsigned long long)samples, (unsigned long long)h.min(),
+                    (double)h.sum() / samples, (unsigned long long)h.percentile(.5), (unsigned long long)h.percentile(.9),
+                    (unsigned long long)h.percentile(.99), (unsigned long long)h.percentile(.999),
+                    (unsigned long long)h.max());
+        first = false;
+    }
+    append_json(out, "\n  }\n}\n");
+}
@@ -0,0 +1,102 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+#include <vector>
+#ifndef WINDUINO_METRICS_MAX
+#define WINDUINO_METRICS_MAX 128
+#endif
+#define METRIC_NAME_MAX 48
+#define METRIC_COUNTER 0
+#define METRIC_HISTOGRAM 1
+// values below this are counted exactly. Above it each power of 2 is
+// split into this many buckets, so a bucket is within about 6% of
+// the values in it
+#define METRIC_SUB_BUCKETS 16
+#define METRIC_SUB_BITS 4
+#define METRIC_BUCKETS ((64 - METRIC_SUB_BITS + 1) * METRIC_SUB_BUCKETS)
+
+// a running total. Adding is a relaxed atomic add, so any thread can
+class metric_counter {
+    std::atomic<uint64_t> m_value;
+
+   public:
+    constexpr metric_counter() : m_value(0) {
+    }
+    void add(uint64_t value) {
+        m_value.fetch_add(value, std::memory_order_relaxed);
+    }
+    uint64_t value() const {
+        return m_value.load(std::memory_order_relaxed);
+    }
+    void reset() {
+        m_value.store(0, std::memory_order_relaxed);
+    }
+};
+// a distribution of values, bucketed the way HdrHistogram does.
+// Recording never locks, so any thread can
+class metric_histogram {
+    std::atomic<uint64_t> m_buckets[METRIC_BUCKETS];
+    std::atomic<uint64_t> m_count;
+    std::atomic<uint64_t> m_sum;
+    std::atomic<uint64_t> m_min;
+    std::atomic<uint64_t> m_max;
+    static size_t bucket(uint64_t value) {
+        if (value < METRIC_SUB_BUCKETS) {
+            return (size_t)value;
+        }
+        const int exponent = 63 - __builtin_clzll(value);
+        const size_t sub = (size_t)(value >> (exponent - METRIC_SUB_BITS)) & (METRIC_SUB_BUCKETS - 1);
+        return (size_t)(exponent - METRIC_SUB_BITS + 1) * METRIC_SUB_BUCKETS + sub;
+    }
+    static uint64_t bucket_end(size_t index);
+
+   public:
+    metric_histogram();
+    void record(uint64_t value);
+    void reset();
+    uint64_t count() const {
+        return m_count.load(std::memory_order_relaxed);
+    }
+    uint64_t sum() const {
+        return m_sum.load(std::memory_order_relaxed);
+    }
+    // 0 when nothing has been recorded
+    uint64_t min() const;
+    uint64_t max() const {
+        return m_max.load(std::memory_order_relaxed);
+    }
+    // the value at or below which the given fraction of the values lie
+    uint64_t percentile(double fraction) const;
+};
+
+// the metrics by name. Metrics are never removed, so pointers to them
+// stay good. It needs no constructor to run, so metrics can be made
+// from other static constructors
+class metrics_registry {
+    typedef struct entry {
+        char name[METRIC_NAME_MAX];
+        int kind;
+        void* metric;
+    } entry_t;
+    std::mutex m_mutex;
+    std::atomic<size_t> m_count;
+    entry_t m_entries[WINDUINO_METRICS_MAX];
+    void* find_or_add(const char* name, int kind);
+
+   public:
+    constexpr metrics_registry() : m_count(0), m_entries{} {
+    }
+    // finds the metric, or makes it. Returns nullptr if the name is
+    // taken by the other kind, or the registry is full
+    metric_counter* counter(const char* name);
+    metric_histogram* histogram(const char* name);
+    // returns the metric's kind, or -1 if there isn't one by that name
+    int find(const char* name, void** out_metric) const;
+    void reset();
+    // writes every metric that has seen something as JSON. elapsed_us
+    // is how long they've been running, for the rates
+    void write_json(std::vector<char>& out, uint64_t elapsed_us) const;
+};
+extern metrics_registry metrics;
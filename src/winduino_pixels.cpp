@@ -0,0 +1,249 @@
+#include "winduino_pixels.h"
+
+#include <string.h>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define PIXELS_X86
+#include <immintrin.h>
+#define SSE2_TARGET __attribute__((target("sse2")))
+#define AVX2_TARGET __attribute__((target("avx2")))
+#endif
+
+// the byte positions of each channel in the native format
+#ifdef USE_RGB
+#define NATIVE_SHIFT_R 0
+#define NATIVE_SHIFT_B 16
+#else
+#define NATIVE_SHIFT_R 16
+#define NATIVE_SHIFT_B 0
+#endif
+
+static inline uint32_t pack_native(uint32_t r, uint32_t g, uint32_t b) {
+    return 0xFF000000 | (r << NATIVE_SHIFT_R) | (g << 8) | (b << NATIVE_SHIFT_B);
+}
+static inline uint32_t from_565(uint16_t p) {
+    uint32_t r = p >> 11;
+    uint32_t g = (p >> 5) & 0x3F;
+    uint32_t b = p & 0x1F;
+    // replicate the high bits so full intensity maps to 0xFF
+    return pack_native((r << 3) | (r >> 2), (g << 2) | (g >> 4), (b << 3) | (b >> 2));
+}
+
+// scalar versions. These work everywhere
+static void convert_native(uint32_t* dst, const uint8_t* src, size_t count, const uint32_t* /*palette*/) {
+    memcpy(dst, src, count * 4);
+}
+template <bool swap>
+static void convert_565(uint32_t* dst, const uint8_t* src, size_t count, const uint32_t* /*palette*/) {
+    for (size_t i = 0; i < count; ++i) {
+        uint16_t p = swap ? (uint16_t)((src[0] << 8) | src[1]) : (uint16_t)(src[0] | (src[1] << 8));
+        dst[i] = from_565(p);
+        src += 2;
+    }
+}
+static void convert_888(uint32_t* dst, const uint8_t* src, size_t count, const uint32_t* /*palette*/) {
+    for (size_t i = 0; i < count; ++i) {
+        dst[i] = pack_native(src[0], src[1], src[2]);
+        src += 3;
+    }
+}
+static void convert_indexed8(uint32_t* dst, const uint8_t* src, size_t count, const uint32_t* palette) {
+    for (size_t i = 0; i < count; ++i) {
+        dst[i] = palette[src[i]];
+    }
+}
+
+#ifdef PIXELS_X86
+// SSE2 does 8 pixels at a time
+template <bool swap>
+SSE2_TARGET static void convert_565_sse2(uint32_t* dst, const uint8_t* src, size_t count, const uint32_t* palette) {
+    const __m128i mask_g = _mm_set1_epi16(0x3F);
+    const __m128i mask_b = _mm_set1_epi16(0x1F);
+    const __m128i alpha = _mm_set1_epi16((short)0xFF00);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128i p = _mm_loadu_si128((const __m128i*)(src + i * 2));
+        if (swap) {
+            p = _mm_or_si128(_mm_slli_epi16(p, 8), _mm_srli_epi16(p, 8));
+        }
+        __m128i r = _mm_srli_epi16(p, 11);
+        __m128i g = _mm_and_si128(_mm_srli_epi16(p, 5), mask_g);
+        __m128i b = _mm_and_si128(p, mask_b);
+        r = _mm_or_si128(_mm_slli_epi16(r, 3), _mm_srli_epi16(r, 2));
+        g = _mm_or_si128(_mm_slli_epi16(g, 2), _mm_srli_epi16(g, 4));
+        b = _mm_or_si128(_mm_slli_epi16(b, 3), _mm_srli_epi16(b, 2));
+        // build the low and high halves of each pixel then interleave
+#ifdef USE_RGB
+        __m128i lo = _mm_or_si128(r, _mm_slli_epi16(g, 8));
+        __m128i hi = _mm_or_si128(b, alpha);
+#else
+        __m128i lo = _mm_or_si128(b, _mm_slli_epi16(g, 8));
+        __m128i hi = _mm_or_si128(r, alpha);
+#endif
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_unpacklo_epi16(lo, hi));
+        _mm_storeu_si128((__m128i*)(dst + i + 4), _mm_unpackhi_epi16(lo, hi));
+    }
+    convert_565<swap>(dst + i, src + i * 2, count - i, palette);
+}
+
+// AVX2 does 16 pixels at a time for 16-bit, 8 otherwise
+template <bool swap>
+AVX2_TARGET static void convert_565_avx2(uint32_t* dst, const uint8_t* src, size_t count, const uint32_t* palette) {
+    const __m256i mask_g = _mm256_set1_epi16(0x3F);
+    const __m256i mask_b = _mm256_set1_epi16(0x1F);
+    const __m256i alpha = _mm256_set1_epi16((short)0xFF00);
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m256i p = _mm256_loadu_si256((const __m256i*)(src + i * 2));
+        if (swap) {
+            p = _mm256_or_si256(_mm256_slli_epi16(p, 8), _mm256_srli_epi16(p, 8));
+        }
+        __m256i r = _mm256_srli_epi16(p, 11);
+        __m256i g = _mm256_and_si256(_mm256_srli_epi16(p, 5), mask_g);
+        __m256i b = _mm256_and_si256(p, mask_b);
+        r = _mm256_or_si256(_mm256_slli_epi16(r, 3), _mm256_srli_epi16(r, 2));
+        g = _mm256_or_si256(_mm256_slli_epi16(g, 2), _mm256_srli_epi16(g, 4));
+        b = _mm256_or_si256(_mm256_slli_epi16(b, 3), _mm256_srli_epi16(b, 2));
+#ifdef USE_RGB
+        __m256i lo = _mm256_or_si256(r, _mm256_slli_epi16(g, 8));
+        __m256i hi = _mm256_or_si256(b, alpha);
+#else
+        __m256i lo = _mm256_or_si256(b, _mm256_slli_epi16(g, 8));
+        __m256i hi = _mm256_or_si256(r, alpha);
+#endif
+        // unpack works within each 128-bit lane, so put
+        // the lanes back in order afterward
+        __m256i a = _mm256_unpacklo_epi16(lo, hi);
+        __m256i c = _mm256_unpackhi_epi16(lo, hi);
+        _mm256_storeu_si256((__m256i*)(dst + i), _mm256_permute2x128_si256(a, c, 0x20));
+        _mm256_storeu_si256((__m256i*)(dst + i + 8), _mm256_permute2x128_si256(a, c, 0x31));
+    }
+    convert_565<swap>(dst + i, src + i * 2, count - i, palette);
+}
+AVX2_TARGET static void convert_888_avx2(uint32_t* dst, const uint8_t* src, size_t count, const uint32_t* palette) {
+    // gathers the 4 pixels in each lane into 32-bit slots
+#ifdef USE_RGB
+    const __m256i shuffle = _mm256_setr_epi8(
+        0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1,
+        0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+#else
+    const __m256i shuffle = _mm256_setr_epi8(
+        2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1,
+        2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1);
+#endif
+    const __m256i alpha = _mm256_set1_epi32((int)0xFF000000);
+    size_t i = 0;
+    // each iteration reads 28 bytes, so stop while there are
+    // still at least 30 left rather than reading past the end
+    for (; i + 10 <= count; i += 8) {
+        const uint8_t* s = src + i * 3;
+        __m256i p = _mm256_inserti128_si256(
+            _mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)s)),
+            _mm_loadu_si128((const __m128i*)(s + 12)), 1);
+        p = _mm256_or_si256(_mm256_shuffle_epi8(p, shuffle), alpha);
+        _mm256_storeu_si256((__m256i*)(dst + i), p);
+    }
+    convert_888(dst + i, src + i * 3, count - i, palette);
+}
+AVX2_TARGET static void convert_indexed8_avx2(uint32_t* dst, const uint8_t* src, size_t count, const uint32_t* palette) {
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i index = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(src + i)));
+        _mm256_storeu_si256((__m256i*)(dst + i), _mm256_i32gather_epi32((const int*)palette, index, 4));
+    }
+    convert_indexed8(dst + i, src + i, count - i, palette);
+}
+#endif
+
+size_t pixel_format_size(flush_format_t format) {
+    switch (format) {
+        case FLUSH_FORMAT_NATIVE:
+            return 4;
+        case FLUSH_FORMAT_RGB565:
+        case FLUSH_FORMAT_RGB565_BE:
+            return 2;
+        case FLUSH_FORMAT_RGB888:
+            return 3;
+        case FLUSH_FORMAT_INDEXED8:
+            return 1;
+    }
+    return 0;
+}
+pixel_isa_t pixel_best_isa() {
+#ifdef PIXELS_X86
+    static int result = -1;
+    if (result == -1) {
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            result = PIXEL_ISA_AVX2;
+        } else if (__builtin_cpu_supports("sse2")) {
+            result = PIXEL_ISA_SSE2;
+        } else {
+            result = PIXEL_ISA_SCALAR;
+        }
+    }
+    return (pixel_isa_t)result;
+#else
+    return PIXEL_ISA_SCALAR;
+#endif
+}
+pixel_convert_fn pixel_converter(flush_format_t format, pixel_isa_t isa) {
+    if (isa > pixel_best_isa()) {
+        return nullptr;
+    }
+    switch (isa) {
+        case PIXEL_ISA_SCALAR:
+            switch (format) {
+                case FLUSH_FORMAT_NATIVE:
+                    return convert_native;
+                case FLUSH_FORMAT_RGB565:
+                    return convert_565<false>;
+                case FLUSH_FORMAT_RGB565_BE:
+                    return convert_565<true>;
+                case FLUSH_FORMAT_RGB888:
+                    return convert_888;
+                case FLUSH_FORMAT_INDEXED8:
+                    return convert_indexed8;
+            }
+            break;
+#ifdef PIXELS_X86
+        // SSE2 has no byte shuffle or gather, so 24-bit and
+        // indexed only have scalar and AVX2 versions
+        case PIXEL_ISA_SSE2:
+            switch (format) {
+                case FLUSH_FORMAT_RGB565:
+                    return convert_565_sse2<false>;
+                case FLUSH_FORMAT_RGB565_BE:
+                    return convert_565_sse2<true>;
+                default:
+                    break;
+            }
+            break;
+        case PIXEL_ISA_AVX2:
+            switch (format) {
+                case FLUSH_FORMAT_RGB565:
+                    return convert_565_avx2<false>;
+                case FLUSH_FORMAT_RGB565_BE:
+                    return convert_565_avx2<true>;
+                case FLUSH_FORMAT_RGB888:
+                    return convert_888_avx2;
+                case FLUSH_FORMAT_INDEXED8:
+                    return convert_indexed8_avx2;
+                default:
+                    break;
+            }
+            break;
+#endif
+        default:
+            break;
+    }
+    return nullptr;
+}
+pixel_convert_fn pixel_converter(flush_format_t format) {
+    for (int isa = pixel_best_isa(); isa >= PIXEL_ISA_SCALAR; --isa) {
+        pixel_convert_fn result = pixel_converter(format, (pixel_isa_t)isa);
+        if (result != nullptr) {
+            return result;
+        }
+    }
+    return nullptr;
+}
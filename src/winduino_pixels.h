@@ -0,0 +1,20 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include "Arduino.h"
+// converts count pixels from src into the native display format
+typedef void (*pixel_convert_fn)(uint32_t* dst, const uint8_t* src, size_t count, const uint32_t* palette);
+typedef enum pixel_isa {
+    PIXEL_ISA_SCALAR = 0,
+    PIXEL_ISA_SSE2,
+    PIXEL_ISA_AVX2
+} pixel_isa_t;
+/// @brief Reports the number of bytes per pixel of a format
+size_t pixel_format_size(flush_format_t format);
+/// @brief Reports the fastest instruction set the host supports
+pixel_isa_t pixel_best_isa();
+/// @brief Retrieves the converter for a format using the specified instruction set
+/// @return The converter, or nullptr if it's not available on this host
+pixel_convert_fn pixel_converter(flush_format_t format, pixel_isa_t isa);
+/// @brief Retrieves the fastest converter for a format on this host
+pixel_convert_fn pixel_converter(flush_format_t format);
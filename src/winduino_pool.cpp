@@ -0,0 +1,120 @@
+#include "winduino_pool.h"
+#include "winduino_trace.h"
+
+work_pool::work_pool()
+    : m_name(nullptr),
+      m_workers(nullptr),
+      m_worker_count(0),
+      m_fn(nullptr),
+      m_state(nullptr),
+      m_remaining(0),
+      m_generation(0),
+      m_quit(false) {
+}
+work_pool::~work_pool() {
+    end();
+}
+bool work_pool::begin(size_t threads, const char* name) {
+    end();
+    m_name = name;
+    m_worker_count = threads + 1;
+    m_workers = new worker_t[m_worker_count];
+    m_quit = false;
+    for (size_t i = 1; i < m_worker_count; ++i) {
+        m_threads.emplace_back(&work_pool::thread_proc, this, i);
+    }
+    return true;
+}
+void work_pool::end() {
+    if (m_workers == nullptr) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_quit = true;
+    }
+    m_cond.notify_all();
+    for (std::thread& t : m_threads) {
+        t.join();
+    }
+    m_threads.clear();
+    delete[] m_workers;
+    m_workers = nullptr;
+    m_worker_count = 0;
+}
+bool work_pool::take(size_t worker, size_t* out_index) {
+    {
+        // newest first from our own queue
+        worker_t& w = m_workers[worker];
+        std::lock_guard<std::mutex> lock(w.mutex);
+        if (!w.tasks.empty()) {
+            *out_index = w.tasks.back();
+            w.tasks.pop_back();
+            return true;
+        }
+    }
+    // oldest first from everyone else's
+    for (size_t i = 1; i < m_worker_count; ++i) {
+        worker_t& w = m_workers[(worker + i) % m_worker_count];
+        std::lock_guard<std::mutex> lock(w.mutex);
+        if (!w.tasks.empty()) {
+            *out_index = w.tasks.front();
+            w.tasks.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+void work_pool::work(size_t worker) {
+    size_t index;
+    while (take(worker, &index)) {
+        m_fn(m_state, index);
+        m_remaining.fetch_sub(1, std::memory_order_acq_rel);
+    }
+}
+void work_pool::thread_proc(size_t worker) {
+    TRACE_THREAD_NAME(m_name);
+    uint64_t seen = 0;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_cond.wait(lock, [this, seen] { return m_quit || m_generation != seen; });
+            if (m_quit) {
+                return;
+            }
+            seen = m_generation;
+        }
+        work(worker);
+    }
+}
+void work_pool::start(size_t count, void (*fn)(void* state, size_t index), void* state) {
+    if (count == 0 || m_workers == nullptr) {
+        return;
+    }
+    m_fn = fn;
+    m_state = state;
+    m_remaining.store(count, std::memory_order_release);
+    for (size_t i = 0; i < count; ++i) {
+        worker_t& w = m_workers[i % m_worker_count];
+        std::lock_guard<std::mutex> lock(w.mutex);
+        w.tasks.push_back(i);
+    }
+    if (m_worker_count > 1) {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            ++m_generation;
+        }
+        m_cond.notify_all();
+    }
+}
+void work_pool::wait() {
+    if (m_workers == nullptr) {
+        return;
+    }
+    work(0);
+    // the barrier. Everything has been taken, so wait for the
+    // stragglers to finish
+    while (m_remaining.load(std::memory_order_acquire) != 0) {
+        std::this_thread::yield();
+    }
+}
@@ -0,0 +1,54 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+// runs a batch of independent tasks across a few threads and the
+// caller. Each thread has its own queue and steals from the others
+// when it runs dry, so one slow task doesn't hold up the rest
+class work_pool {
+    typedef struct worker {
+        std::mutex mutex;
+        std::deque<size_t> tasks;
+    } worker_t;
+    std::vector<std::thread> m_threads;
+    // what the threads are called in a trace
+    const char* m_name;
+    // the caller's queue is first
+    worker_t* m_workers;
+    size_t m_worker_count;
+    void (*m_fn)(void* state, size_t index);
+    void* m_state;
+    std::atomic<size_t> m_remaining;
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    uint64_t m_generation;
+    bool m_quit;
+    bool take(size_t worker, size_t* out_index);
+    void work(size_t worker);
+    void thread_proc(size_t worker);
+
+   public:
+    work_pool();
+    ~work_pool();
+    // name must be a string literal
+    bool begin(size_t threads, const char* name);
+    void end();
+    size_t threads() const {
+        return m_threads.size();
+    }
+    // hands out fn(state, i) for each i below count and returns
+    // without waiting, so the caller can do other work meanwhile
+    void start(size_t count, void (*fn)(void* state, size_t index), void* state);
+    // helps with whatever hasn't been taken yet, then waits for the
+    // rest of the batch to finish
+    void wait();
+    void run(size_t count, void (*fn)(void* state, size_t index), void* state) {
+        start(count, fn, state);
+        wait();
+    }
+};
@@ -0,0 +1,104 @@
+#pragma once
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include "winduino_damage.h"
+// hands completed frames from the app thread to the presenter without
+// locking. There are three slots: the app fills one, the presenter
+// uploads from another, and the third holds the latest completed frame.
+// Each side swaps its slot with the middle one atomically.
+// A slot only carries valid pixels inside its damage rectangles, since
+// the presenter's bitmap keeps everything else from earlier frames.
+class present_chain {
+    typedef struct frame {
+        damage_region damage;
+        uint32_t* pixels;
+    } frame_t;
+    // set on the ready index when it holds a frame the presenter hasn't seen
+    constexpr static int fresh = 4;
+    frame_t m_frames[3];
+    // everything published that the presenter may not have seen yet
+    damage_region m_pending;
+    int m_width;
+    int m_write;
+    int m_present;
+    std::atomic<int> m_ready;
+
+   public:
+    present_chain() : m_width(0), m_write(0), m_present(1), m_ready(2) {
+        for (int i = 0; i < 3; ++i) {
+            m_frames[i].pixels = nullptr;
+        }
+    }
+    ~present_chain() {
+        end();
+    }
+    bool begin(int width, int height) {
+        end();
+        m_width = width;
+        for (int i = 0; i < 3; ++i) {
+            m_frames[i].pixels = (uint32_t*)malloc((size_t)width * height * sizeof(uint32_t));
+            if (m_frames[i].pixels == nullptr) {
+                end();
+                return false;
+            }
+            m_frames[i].damage.clear();
+        }
+        m_pending.clear();
+        return true;
+    }
+    void end() {
+        for (int i = 0; i < 3; ++i) {
+            if (m_frames[i].pixels != nullptr) {
+                free(m_frames[i].pixels);
+                m_frames[i].pixels = nullptr;
+            }
+        }
+    }
+    // called from the app thread. Copies the damaged areas of the
+    // framebuffer into a slot and makes it the latest frame
+    void publish(const uint32_t* framebuffer, const damage_region& damage) {
+        for (size_t i = 0; i < damage.size(); ++i) {
+            m_pending.add(damage[i]);
+        }
+        frame_t& f = m_frames[m_write];
+        f.damage = m_pending;
+        // this includes the damage of any frame that was dropped
+        // so always copy from the framebuffer, which is current
+        for (size_t i = 0; i < f.damage.size(); ++i) {
+            const damage_rect_t& r = f.damage[i];
+            size_t offs = (size_t)r.y1 * m_width + r.x1;
+            const uint32_t* src = framebuffer + offs;
+            uint32_t* dst = f.pixels + offs;
+            for (int y = r.y1; y < r.y2; ++y) {
+                memcpy(dst, src, (r.x2 - r.x1) * sizeof(uint32_t));
+                src += m_width;
+                dst += m_width;
+            }
+        }
+        int old = m_ready.exchange(m_write | fresh, std::memory_order_acq_rel);
+        m_write = old & ~fresh;
+        if (!(old & fresh)) {
+            // the presenter took the previous frame, which covered
+            // everything before this one
+            m_pending = damage;
+        }
+        // otherwise the previous frame was dropped, but this one
+        // covers it, so keep accumulating
+    }
+    // called from the presenter thread. Returns the latest frame,
+    // or null if there hasn't been a new one since the last call
+    const damage_region* acquire(const uint32_t** out_pixels) {
+        if (!(m_ready.load(std::memory_order_acquire) & fresh)) {
+            return nullptr;
+        }
+        int old = m_ready.exchange(m_present, std::memory_order_acq_rel);
+        m_present = old & ~fresh;
+        *out_pixels = m_frames[m_present].pixels;
+        return &m_frames[m_present].damage;
+    }
+    int stride() const {
+        return m_width;
+    }
+};
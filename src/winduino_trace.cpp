@@ -0,0 +1,159 @@
+#include "winduino_trace.h"
+
+#include <stdio.h>
+#include <string.h>
+
+// the calling thread's buffer, made on its first event
+static thread_local trace_buffer* trace_thread_buffer = nullptr;
+// the name given before the buffer was made
+static thread_local char trace_thread_label[TRACE_NAME_MAX] = {0};
+
+trace_buffer::trace_buffer(uint32_t id, uint32_t session)
+    : m_head(nullptr), m_tail(nullptr), m_blocks(0), m_dropped(0), m_session(session), m_id(id), m_next(nullptr) {
+    m_name[0] = 0;
+    m_head = m_tail = new_block();
+}
+trace_buffer::block_t* trace_buffer::new_block() {
+    block_t* b = new block_t();
+    b->count.store(0, std::memory_order_relaxed);
+    b->next.store(nullptr, std::memory_order_relaxed);
+    ++m_blocks;
+    return b;
+}
+void trace_buffer::add(const trace_event_t& event, uint32_t session) {
+    if (m_session.load(std::memory_order_relaxed) != session) {
+        // the events are from the last trace. end() won't look at them
+        // until the new session is stored
+        for (block_t* b = m_head; b != nullptr; b = b->next.load(std::memory_order_relaxed)) {
+            b->count.store(0, std::memory_order_relaxed);
+        }
+        m_tail = m_head;
+        m_dropped.store(0, std::memory_order_relaxed);
+        m_session.store(session, std::memory_order_release);
+    }
+    uint32_t count = m_tail->count.load(std::memory_order_relaxed);
+    if (count == WINDUINO_TRACE_BLOCK) {
+        block_t* b = m_tail->next.load(std::memory_order_relaxed);
+        if (b == nullptr) {
+            if (m_blocks == WINDUINO_TRACE_BLOCKS_MAX) {
+                // only this thread writes it
+                m_dropped.store(m_dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+                return;
+            }
+            b = new_block();
+            m_tail->next.store(b, std::memory_order_release);
+        }
+        m_tail = b;
+        count = 0;
+    }
+    m_tail->events[count] = event;
+    m_tail->count.store(count + 1, std::memory_order_release);
+}
+trace_buffer* trace_recorder::buffer() {
+    trace_buffer* result = trace_thread_buffer;
+    if (result != nullptr) {
+        return result;
+    }
+    // only once per thread
+    std::lock_guard<std::mutex> lock(m_mutex);
+    result = new trace_buffer(++m_count, m_session.load(std::memory_order_relaxed));
+    strcpy(result->m_name, trace_thread_label);
+    result->m_next = m_buffers;
+    m_buffers = result;
+    trace_thread_buffer = result;
+    return result;
+}
+bool trace_recorder::begin(const char* path, trace_clock_fn clock) {
+    if (path == nullptr || clock == nullptr || strlen(path) >= sizeof(m_path)) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_running.load(std::memory_order_relaxed)) {
+        return false;
+    }
+    strcpy(m_path, path);
+    m_clock.store(clock, std::memory_order_relaxed);
+    // so the events from the last trace aren't written again
+    m_session.store(m_session.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    m_running.store(true, std::memory_order_release);
+    return true;
+}
+void trace_recorder::name_thread(const char* name) {
+    strncpy(trace_thread_label, name, TRACE_NAME_MAX - 1);
+    trace_thread_label[TRACE_NAME_MAX - 1] = 0;
+    if (trace_thread_buffer != nullptr) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        strcpy(trace_thread_buffer->m_name, trace_thread_label);
+    }
+}
+void trace_recorder::span(const char* category, const char* name, uint64_t start_ns, uint64_t value) {
+    trace_event_t e;
+    e.start_ns = start_ns;
+    e.duration_ns = now() - start_ns;
+    e.name = name;
+    e.category = category;
+    e.value = value;
+    e.type = TRACE_EVENT_SPAN;
+    buffer()->add(e, m_session.load(std::memory_order_acquire));
+}
+void trace_recorder::instant(const char* category, const char* name, uint64_t value) {
+    trace_event_t e;
+    e.start_ns = now();
+    e.duration_ns = 0;
+    e.name = name;
+    e.category = category;
+    e.value = value;
+    e.type = TRACE_EVENT_INSTANT;
+    buffer()->add(e, m_session.load(std::memory_order_acquire));
+}
+bool trace_recorder::end() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!m_running.load(std::memory_order_relaxed)) {
+        return false;
+    }
+    m_running.store(false, std::memory_order_release);
+    FILE* file = fopen(m_path, "wb");
+    if (file == nullptr) {
+        return false;
+    }
+    fputs("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n", file);
+    fputs("{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"winduino\"}}", file);
+    const uint32_t session = m_session.load(std::memory_order_relaxed);
+    for (trace_buffer* t = m_buffers; t != nullptr; t = t->m_next) {
+        if (t->m_session.load(std::memory_order_acquire) != session) {
+            // nothing from this thread since begin()
+            continue;
+        }
+        // names are ours, and don't need escaping
+        if (t->m_name[0] != 0) {
+            fprintf(file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+                    (unsigned)t->m_id, t->m_name);
+        }
+        const uint64_t dropped = t->m_dropped.load(std::memory_order_relaxed);
+        if (dropped != 0) {
+            fprintf(file, ",\n{\"name\":\"dropped\",\"cat\":\"trace\",\"ph\":\"C\",\"ts\":0,\"pid\":1,\"tid\":%u,\"args\":{\"events\":%llu}}",
+                    (unsigned)t->m_id, (unsigned long long)dropped);
+        }
+        // only what has been published. The thread may still be adding more
+        for (trace_buffer::block_t* b = t->m_head; b != nullptr; b = b->next.load(std::memory_order_acquire)) {
+            const uint32_t count = b->count.load(std::memory_order_acquire);
+            for (uint32_t i = 0; i < count; ++i) {
+                const trace_event_t& e = b->events[i];
+                if (e.type == TRACE_EVENT_SPAN) {
+                    fprintf(file,
+                            ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%u,\"args\":{\"value\":%llu}}",
+                            e.name, e.category, e.start_ns / 1000.0, e.duration_ns / 1000.0, (unsigned)t->m_id,
+                            (unsigned long long)e.value);
+                } else {
+                    fprintf(file,
+                            ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,\"pid\":1,\"tid\":%u,\"args\":{\"value\":%llu}}",
+                            e.name, e.category, e.start_ns / 1000.0, (unsigned)t->m_id, (unsigned long long)e.value);
+                }
+            }
+        }
+    }
+    fputs("\n]}\n", file);
+    const bool result = 0 == ferror(file);
+    fclose(file);
+    return result;
+}
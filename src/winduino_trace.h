@@ -0,0 +1,138 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+// set to 0 to compile out every trace point
+#ifndef WINDUINO_TRACE
+#define WINDUINO_TRACE 1
+#endif
+// the events in each block of a thread's buffer
+#ifndef WINDUINO_TRACE_BLOCK
+#define WINDUINO_TRACE_BLOCK 4096
+#endif
+// the most blocks one thread can fill before its events are dropped
+#ifndef WINDUINO_TRACE_BLOCKS_MAX
+#define WINDUINO_TRACE_BLOCKS_MAX 256
+#endif
+#define TRACE_NAME_MAX 32
+// trace_event_t types
+#define TRACE_EVENT_SPAN 0
+#define TRACE_EVENT_INSTANT 1
+
+typedef uint64_t (*trace_clock_fn)();
+// name and category must be string literals, since they're only
+// looked at when the trace is written
+typedef struct trace_event {
+    uint64_t start_ns;
+    uint64_t duration_ns;
+    const char* name;
+    const char* category;
+    // shown in the viewer, such as the bits in a transfer
+    uint64_t value;
+    uint8_t type;
+} trace_event_t;
+
+// a thread's events. Only its thread writes to it, publishing each
+// event with a release store of the count, so the trace can be written
+// while the thread is still running. The first block is made before the
+// buffer is shared, so m_head never changes once another thread can see it.
+// Blocks are kept between traces. The thread empties them itself on its
+// first event of a new trace, then publishes that with m_session
+class trace_buffer {
+    friend class trace_recorder;
+    typedef struct block {
+        trace_event_t events[WINDUINO_TRACE_BLOCK];
+        std::atomic<uint32_t> count;
+        std::atomic<block*> next;
+    } block_t;
+    block_t* m_head;
+    block_t* m_tail;
+    size_t m_blocks;
+    std::atomic<uint64_t> m_dropped;
+    // the trace the events are from
+    std::atomic<uint32_t> m_session;
+    uint32_t m_id;
+    char m_name[TRACE_NAME_MAX];
+    trace_buffer* m_next;
+    trace_buffer(uint32_t id, uint32_t session);
+    block_t* new_block();
+    void add(const trace_event_t& event, uint32_t session);
+};
+
+// collects the events from every thread and writes them in the
+// Chrome trace event format, which chrome://tracing and Perfetto read.
+// Buffers are never freed, so a thread can't be caught writing to one
+class trace_recorder {
+    std::atomic<bool> m_running;
+    // a thread can still be finishing an event when the next trace begins
+    std::atomic<trace_clock_fn> m_clock;
+    // which begin() we're on
+    std::atomic<uint32_t> m_session;
+    std::mutex m_mutex;
+    trace_buffer* m_buffers;
+    uint32_t m_count;
+    char m_path[260];
+    trace_buffer* buffer();
+
+   public:
+    constexpr trace_recorder() : m_running(false), m_clock(nullptr), m_session(0), m_buffers(nullptr), m_count(0), m_path{} {
+    }
+    bool begin(const char* path, trace_clock_fn clock);
+    // writes the trace. Events from after this are ignored
+    bool end();
+    bool running() const {
+        return m_running.load(std::memory_order_relaxed);
+    }
+    uint64_t now() const {
+        return m_clock.load(std::memory_order_relaxed)();
+    }
+    // names the calling thread in the trace
+    void name_thread(const char* name);
+    void span(const char* category, const char* name, uint64_t start_ns, uint64_t value = 0);
+    void instant(const char* category, const char* name, uint64_t value = 0);
+};
+extern trace_recorder traces;
+
+// traces the enclosing scope
+class trace_scope {
+    const char* m_category;
+    const char* m_name;
+    uint64_t m_start;
+    uint64_t m_value;
+
+   public:
+    trace_scope(const char* category, const char* name, uint64_t value = 0) : m_category(category), m_name(nullptr), m_start(0), m_value(value) {
+        if (traces.running()) {
+            m_name = name;
+            m_start = traces.now();
+        }
+    }
+    ~trace_scope() {
+        if (m_name != nullptr) {
+            traces.span(m_category, m_name, m_start, m_value);
+        }
+    }
+};
+#if WINDUINO_TRACE
+#define TRACE_CONCAT2(x, y) x##y
+#define TRACE_CONCAT(x, y) TRACE_CONCAT2(x, y)
+#define TRACE_SCOPE(category, name) trace_scope TRACE_CONCAT(trace_scope_, __LINE__)(category, name)
+#define TRACE_SCOPE_VALUE(category, name, value) trace_scope TRACE_CONCAT(trace_scope_, __LINE__)(category, name, value)
+#define TRACE_INSTANT(category, name, value)       \
+    do {                                           \
+        if (traces.running()) {                    \
+            traces.instant(category, name, value); \
+        }                                          \
+    } while (0)
+#define TRACE_THREAD_NAME(name) traces.name_thread(name)
+#else
+#define TRACE_SCOPE(category, name)
+#define TRACE_SCOPE_VALUE(category, name, value)
+#define TRACE_INSTANT(category, name, value) \
+    do {                                     \
+    } while (0)
+#define TRACE_THREAD_NAME(name) \
+    do {                        \
+    } while (0)
+#endif
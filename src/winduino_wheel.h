@@ -0,0 +1,82 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#ifndef WINDUINO_WHEEL_SLOTS
+#define WINDUINO_WHEEL_SLOTS 256
+#endif
+// the width of a slot in microseconds
+#ifndef WINDUINO_WHEEL_TICK_US
+#define WINDUINO_WHEEL_TICK_US 250
+#endif
+// a hashed timer wheel. Items hang off the slot for their deadline's
+// tick, so advancing only looks at the slots that time has passed
+// through, however many items are waiting. Items due more than a turn
+// of the wheel away stay in their slot until their turn comes around.
+// T needs T* wheel_next and uint64_t wheel_deadline members.
+template <typename T>
+class timer_wheel {
+    T* m_slots[WINDUINO_WHEEL_SLOTS];
+    // the next tick to look at
+    uint64_t m_tick;
+    size_t m_count;
+
+   public:
+    timer_wheel() : m_tick(0), m_count(0) {
+        for (size_t i = 0; i < WINDUINO_WHEEL_SLOTS; ++i) {
+            m_slots[i] = nullptr;
+        }
+    }
+    size_t size() const {
+        return m_count;
+    }
+    void insert(T* item, uint64_t deadline_us) {
+        uint64_t tick = deadline_us / WINDUINO_WHEEL_TICK_US;
+        if (tick < m_tick) {
+            // already due. Put it where the next advance looks first
+            tick = m_tick;
+        }
+        T*& slot = m_slots[tick % WINDUINO_WHEEL_SLOTS];
+        item->wheel_deadline = deadline_us;
+        item->wheel_next = slot;
+        slot = item;
+        ++m_count;
+    }
+    // removes everything due by now_us and passes it to fire, which
+    // may insert it again
+    template <typename F>
+    void advance(uint64_t now_us, F fire) {
+        if (m_count == 0) {
+            m_tick = now_us / WINDUINO_WHEEL_TICK_US;
+            return;
+        }
+        const uint64_t end = now_us / WINDUINO_WHEEL_TICK_US;
+        // after a big jump in time, one pass over the wheel covers it
+        uint64_t first = m_tick;
+        if (end >= first + WINDUINO_WHEEL_SLOTS) {
+            first = end - WINDUINO_WHEEL_SLOTS + 1;
+        }
+        // collect first so fire() can insert without us seeing it again
+        T* due = nullptr;
+        for (uint64_t tick = first; tick <= end; ++tick) {
+            T** link = &m_slots[tick % WINDUINO_WHEEL_SLOTS];
+            while (*link != nullptr) {
+                T* item = *link;
+                if (item->wheel_deadline <= now_us) {
+                    *link = item->wheel_next;
+                    item->wheel_next = due;
+                    due = item;
+                    --m_count;
+                } else {
+                    link = &item->wheel_next;
+                }
+            }
+        }
+        // the current tick may still have items due later in it
+        m_tick = end;
+        while (due != nullptr) {
+            T* item = due;
+            due = due->wheel_next;
+            fire(item);
+        }
+    }
+};
@@ -0,0 +1,53 @@
+// inspects captures made with hardware_start_capture() and converts them to video
+// build with -DWINDUINO_BUILD_TOOLS=ON
+//   wdcapture info <capture>
+//   wdcapture y4m <capture> <output.y4m> [fps]
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "winduino_capture.h"
+
+static int info(const char* path) {
+    frame_player player;
+    if (!player.begin(path)) {
+        fprintf(stderr, "unable to open capture %s\n", path);
+        return 1;
+    }
+    uint64_t first = 0, last = 0, timestamp;
+    size_t frames = 0, rects = 0, pixels = 0;
+    damage_region damage;
+    while (player.next(&timestamp, &damage)) {
+        if (frames == 0) {
+            first = timestamp;
+        }
+        last = timestamp;
+        ++frames;
+        rects += damage.size();
+        for (size_t i = 0; i < damage.size(); ++i) {
+            pixels += damage[i].area();
+        }
+    }
+    printf("%dx%d, %zu frames over %.3f seconds\n", player.width(), player.height(), frames,
+           (last - first) / 1000000.0);
+    if (frames > 0) {
+        printf("%.1f rects and %.0f pixels changed per frame\n", (double)rects / frames,
+               (double)pixels / frames);
+    }
+    return 0;
+}
+int main(int argc, char* argv[]) {
+    if (argc >= 3 && 0 == strcmp(argv[1], "info")) {
+        return info(argv[2]);
+    }
+    if (argc >= 4 && 0 == strcmp(argv[1], "y4m")) {
+        int fps = argc > 4 ? atoi(argv[4]) : 30;
+        if (!capture_export_y4m(argv[2], argv[3], fps)) {
+            fprintf(stderr, "unable to convert %s\n", argv[2]);
+            return 1;
+        }
+        return 0;
+    }
+    fprintf(stderr, "usage: wdcapture info <capture>\n       wdcapture y4m <capture> <output.y4m> [fps]\n");
+    return 1;
+}
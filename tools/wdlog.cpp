@@ -0,0 +1,23 @@
+// formats binary logs made with hardware_log_binary()
+// build with -DWINDUINO_BUILD_TOOLS=ON
+//   wdlog <binary log>
+#include <stdio.h>
+#include <vector>
+#include "winduino_log.h"
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: wdlog <binary log>\n");
+        return 1;
+    }
+    log_reader reader;
+    if (!reader.begin(argv[1])) {
+        fprintf(stderr, "unable to open log %s\n", argv[1]);
+        return 1;
+    }
+    std::vector<char> line;
+    while (reader.next(line)) {
+        fwrite(line.data(), 1, line.size(), stdout);
+    }
+    return 0;
+}